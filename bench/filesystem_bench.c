@@ -0,0 +1,96 @@
+/**
+ * Benchmark of the in-memory filesystem tree: expands everything below a directory and reports the number of
+ * entries, the time taken and the peak resident set size of the process.
+ *
+ * usage: filesystem_bench [directory]
+ * The directory defaults to /usr; pseudo file systems below it (/proc, /sys, /dev, /run) are skipped.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "../src/filesystem.h"
+
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static long peak_rss_kib() {
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+	return usage.ru_maxrss;
+}
+
+
+/**
+ * Skips every directory that is neither on the way to nor below the directory given on the command line.
+ */
+static bool skip_outside(struct filesystem_entry_t * entry, void * user_data) {
+	const char * directory = (const char *)user_data;
+	char *       path      = filesystem_entry_get_path(entry);
+	size_t       length    = strlen(path),
+	             prefix    = strlen(directory);
+	bool         result;
+	if(prefix > 0 && directory[prefix - 1] == '/')
+		prefix--; // "/" and "/usr/" have their children one '/' further down
+	if(strcmp(path, "/proc") == 0 || strcmp(path, "/sys") == 0 || strcmp(path, "/dev") == 0 || strcmp(path, "/run") == 0)
+		result = true;
+	else if(strncmp(path, directory, length) == 0 && (directory[length] == '/' || directory[length] == '\0'))
+		result = false; // on the way to the directory, or the directory itself
+	else
+		result = !(strncmp(path, directory, prefix) == 0 && path[prefix] == '/');
+	free(path);
+	return result;
+}
+
+
+static size_t count_entries(struct filesystem_entry_t * entry, const char * directory) {
+	size_t count = 1;
+	if(filesystem_entry_has_children(entry)) {
+		for(struct filesystem_entry_t * child = filesystem_entry_get_first_child(entry); child != NULL; child = filesystem_entry_get_next(child)) {
+			if(filesystem_entry_is_directory(child) && skip_outside(child, (void *)directory))
+				count++;
+			else
+				count += count_entries(child, directory);
+		}
+	}
+	return count;
+}
+
+
+int main(int argc, char ** argv) {
+	const char * directory = (argc > 1 ? argv[1] : "/usr");
+	if(directory[0] != '/') {
+		fprintf(stderr, "error: `%s' is not an absolute path\n", directory);
+		return 1;
+	}
+
+	long   before = peak_rss_kib();
+	double start  = now();
+
+	struct filesystem_t * filesystem = filesystem_open();
+	if(filesystem == NULL) {
+		fprintf(stderr, "error: out of memory\n");
+		return 1;
+	}
+	filesystem_scan(filesystem, 1, skip_outside, (void *)directory);
+	double elapsed = now() - start;
+
+	struct filesystem_entry_t * entry = filesystem_get_path(filesystem, directory);
+	size_t count = (entry != NULL ? count_entries(entry, directory) : 0);
+	long   after = peak_rss_kib();
+
+	printf("%zu entries in %.2f s, peak rss %ld KiB (%ld KiB for the tree, %.1f bytes per entry)\n",
+		count, elapsed, after, after - before, count > 0 ? (after - before) * 1024.0 / count : 0.0);
+
+	filesystem_close(filesystem);
+	return 0;
+}
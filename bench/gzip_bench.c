@@ -0,0 +1,152 @@
+/**
+ * Benchmark of decompressing the mtree files of all installed packages: the one-shot read_gzip_file and the
+ * chunked read_gzip_file_chunked versus the former gzread loop, which enlarged its buffer by 1 KiB per call.
+ * Every round starts with an empty buffer that is reused for all files, like a run of arch-diff does. The files
+ * stay in the page cache after the first round, so mostly inflating is timed.
+ *
+ * usage: gzip_bench [database path] [rounds]
+ * The database path defaults to /var/lib/pacman/, the number of rounds to 10.
+ */
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <zlib.h>
+
+#include "../src/gzip.h"
+
+
+#define CHUNK_SIZE (64 * 1024)
+
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static int read_gzread(const char * file_path, char ** buffer, unsigned int * allocated) {
+	gzFile file = gzopen(file_path, "r");
+	if(file == NULL)
+		return -1;
+
+	unsigned int position = 0;
+	while(1) {
+		unsigned int allowed_bytes = *allocated - position;
+		int bytes_read = gzread(file, *buffer + position, allowed_bytes);
+		if(bytes_read == allowed_bytes) {
+			position   += bytes_read;
+			*allocated += 1024;
+			*buffer     = (char *)realloc(*buffer, *allocated);
+			if(*buffer == NULL) {
+				gzclose(file);
+				return -1;
+			}
+		}
+		else if(bytes_read >= 0 && bytes_read < allowed_bytes && gzeof(file)) {
+			position += bytes_read;
+			(*buffer)[position] = '\0';
+			break;
+		}
+		else {
+			gzclose(file);
+			return -1;
+		}
+	}
+
+	gzclose(file);
+	return position;
+}
+
+
+static void count_chunk(const char * data, size_t size, void * user_data) {
+	*(size_t *)user_data += size;
+}
+
+
+static int read_chunked(const char * file_path, char ** buffer, unsigned int * allocated) {
+	size_t size = 0;
+	if(read_gzip_file_chunked(file_path, CHUNK_SIZE, count_chunk, &size) != 0)
+		return -1;
+	return size;
+}
+
+
+typedef struct {
+	const char * name;
+	int (*read)(const char * file_path, char ** buffer, unsigned int * allocated);
+} variant_t;
+
+
+int main(int argc, char ** argv) {
+	const char *  db_path = (argc > 1 ? argv[1] : "/var/lib/pacman/");
+	unsigned long rounds  = (argc > 2 ? strtoul(argv[2], NULL, 10) : 10);
+
+	char * local_path;
+	asprintf(&local_path, "%s/local", db_path);
+	DIR * dir = opendir(local_path);
+	if(dir == NULL) {
+		perror(local_path);
+		return 1;
+	}
+
+	char **         paths = NULL;
+	size_t          count = 0;
+	struct dirent * entry;
+	while((entry = readdir(dir)) != NULL) {
+		if(entry->d_name[0] == '.')
+			continue;
+		paths = (char **)realloc(paths, (count + 1) * sizeof(char *));
+		if(paths == NULL) {
+			fprintf(stderr, "error: out of memory\n");
+			return 1;
+		}
+		asprintf(&paths[count++], "%s/%s/mtree", local_path, entry->d_name);
+	}
+	closedir(dir);
+	free(local_path);
+	if(count == 0) {
+		fprintf(stderr, "error: no packages found below %s\n", db_path);
+		return 1;
+	}
+
+#ifdef HAVE_LIBDEFLATE
+	printf("backend: libdeflate\n");
+#else
+	printf("backend: zlib\n");
+#endif
+
+	const variant_t variants[] = {
+		{"gzread loop", read_gzread},
+		{"one-shot",    read_gzip_file},
+		{"chunked",     read_chunked}
+	};
+	for(size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+		size_t files   = 0,
+		       total   = 0;
+		double elapsed = 0;
+		for(unsigned long round = 0; round < rounds; round++) {
+			char *       buffer    = NULL;
+			unsigned int allocated = 0;
+
+			double start = now();
+			for(size_t i = 0; i < count; i++) {
+				int size = variants[v].read(paths[i], &buffer, &allocated);
+				if(size < 0)
+					continue;
+				files++;
+				total += size;
+			}
+			elapsed += now() - start;
+			free(buffer);
+		}
+		printf("%-12s %zu files, %.1f MiB in %.3f s, %.1f MiB/s\n", variants[v].name, files / rounds, total / (1024.0 * 1024.0) / rounds, elapsed, total / (1024.0 * 1024.0) / elapsed);
+	}
+
+	for(size_t i = 0; i < count; i++)
+		free(paths[i]);
+	free(paths);
+	return 0;
+}
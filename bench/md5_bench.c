@@ -0,0 +1,86 @@
+/**
+ * Throughput benchmark of the scalar md5 implementation versus the multi-buffer kernel.
+ *
+ * usage: md5_bench [message size in bytes] [number of messages]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/md5.h"
+#include "../src/md5_mb.h"
+
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+int main(int argc, char ** argv) {
+	size_t size  = (argc > 1 ? strtoul(argv[1], NULL, 10) : 16384);
+	size_t count = (argc > 2 ? strtoul(argv[2], NULL, 10) : 16384);
+
+	unsigned char * data = (unsigned char *)malloc(size * count);
+	unsigned char * scalar_digests = (unsigned char *)malloc(16 * count);
+	unsigned char * mb_digests     = (unsigned char *)malloc(16 * count);
+	if(data == NULL || scalar_digests == NULL || mb_digests == NULL) {
+		fprintf(stderr, "error: out of memory\n");
+		return 1;
+	}
+	srand(42);
+	for(size_t i = 0; i < size * count; i++)
+		data[i] = rand();
+
+	// scalar
+	double start = now();
+	for(size_t i = 0; i < count; i++) {
+		MD5_CTX ctx;
+		MD5_Init(&ctx);
+		MD5_Update(&ctx, data + i * size, size);
+		MD5_Final(scalar_digests + 16 * i, &ctx);
+	}
+	double scalar_time = now() - start;
+	printf("scalar:       %8.1f MB/s\n", size * count / scalar_time / 1e6);
+
+	size_t lanes = md5_mb_lanes();
+	if(lanes == 0) {
+		printf("multi-buffer: not supported on this cpu\n");
+		return 0;
+	}
+
+	// multi-buffer, every lane takes the next message as soon as it is done
+	start = now();
+	md5_mb_t ctx;
+	md5_mb_init(&ctx);
+	size_t next = 0, done = 0, lane_message[MD5_MB_MAX_LANES];
+	while(done < count) {
+		for(size_t lane = 0; lane < lanes; lane++) {
+			if(!ctx.active[lane] && next < count) {
+				md5_mb_start(&ctx, lane);
+				md5_mb_feed(&ctx, lane, data + next * size, size);
+				lane_message[lane] = next++;
+			}
+			else if(md5_mb_hungry(&ctx, lane)) {
+				md5_mb_final(mb_digests + 16 * lane_message[lane], &ctx, lane);
+				done++;
+			}
+		}
+		md5_mb_run(&ctx);
+	}
+	double mb_time = now() - start;
+	printf("multi-buffer: %8.1f MB/s (%zu lanes, %.2fx)\n", size * count / mb_time / 1e6, lanes, scalar_time / mb_time);
+
+	if(memcmp(scalar_digests, mb_digests, 16 * count) != 0) {
+		fprintf(stderr, "error: digests differ\n");
+		return 1;
+	}
+
+	free(mb_digests);
+	free(scalar_digests);
+	free(data);
+	return 0;
+}
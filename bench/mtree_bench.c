@@ -0,0 +1,131 @@
+/**
+ * Benchmark of the mtree parser over the mtree files of the installed packages: decompresses them all into memory
+ * once, then parses every file a number of rounds and reports the entries and bytes parsed per second. Only the
+ * parsing is timed, not the decompression nor releasing the entries. Finally, the entries of all files are kept at
+ * once to report the heap memory they take.
+ *
+ * usage: mtree_bench [database path] [rounds]
+ * The database path defaults to /var/lib/pacman/, the number of rounds to 10.
+ */
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/gzip.h"
+#include "../src/mtree.h"
+
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+typedef struct {
+	char * contents;
+	size_t size; // without the terminating null byte
+} corpus_t;
+
+
+int main(int argc, char ** argv) {
+	const char *  db_path = (argc > 1 ? argv[1] : "/var/lib/pacman/");
+	unsigned long rounds  = (argc > 2 ? strtoul(argv[2], NULL, 10) : 10);
+
+	char * local_path;
+	asprintf(&local_path, "%s/local", db_path);
+	DIR * dir = opendir(local_path);
+	if(dir == NULL) {
+		perror(local_path);
+		return 1;
+	}
+
+	// decompress every mtree file up front
+	corpus_t *      corpora   = NULL;
+	size_t          count     = 0,
+	                total     = 0,
+	                largest   = 0;
+	char *          buffer    = NULL;
+	unsigned int    allocated = 0;
+	struct dirent * entry;
+	while((entry = readdir(dir)) != NULL) {
+		if(entry->d_name[0] == '.')
+			continue;
+
+		char * mtree_path;
+		asprintf(&mtree_path, "%s/%s/mtree", local_path, entry->d_name);
+		int size = read_gzip_file(mtree_path, &buffer, &allocated);
+		free(mtree_path);
+		if(size < 0)
+			continue;
+
+		corpora = (corpus_t *)realloc(corpora, (count + 1) * sizeof(corpus_t));
+		if(corpora == NULL || (corpora[count].contents = strndup(buffer, size)) == NULL) {
+			fprintf(stderr, "error: out of memory\n");
+			return 1;
+		}
+		corpora[count].size = size;
+		total  += size;
+		largest = ((size_t)size > largest ? (size_t)size : largest);
+		count++;
+	}
+	closedir(dir);
+	free(local_path);
+	free(buffer);
+	if(count == 0) {
+		fprintf(stderr, "error: no mtree files found below %s\n", db_path);
+		return 1;
+	}
+
+	// the parser tokenizes in place, so every round parses a fresh copy
+	char * scratch = (char *)malloc(largest + 1);
+	size_t entries = 0;
+	double elapsed = 0;
+	if(scratch == NULL) {
+		fprintf(stderr, "error: out of memory\n");
+		return 1;
+	}
+	for(unsigned long round = 0; round < rounds; round++) {
+		for(size_t i = 0; i < count; i++) {
+			memcpy(scratch, corpora[i].contents, corpora[i].size + 1);
+
+			double        start  = now();
+			alpm_list_t * parsed = mtree_parse(scratch);
+			elapsed += now() - start;
+
+			entries += alpm_list_count(parsed);
+			alpm_list_free_inner(parsed, (alpm_list_fn_free)mtree_entry_destroy);
+			alpm_list_free(parsed);
+		}
+	}
+
+	printf("%zu mtree files, %.1f MiB, %lu rounds\n", count, total / (1024.0 * 1024.0), rounds);
+	printf("parse: %.3f s, %.0f entries/s, %.1f MiB/s\n", elapsed, entries / elapsed, rounds * total / (1024.0 * 1024.0) / elapsed);
+
+	// the heap in use grows by what the entries take, including allocator overhead
+	alpm_list_t ** kept   = (alpm_list_t **)calloc(count, sizeof(alpm_list_t *));
+	size_t         before = mallinfo2().uordblks;
+	entries = 0;
+	for(size_t i = 0; i < count; i++) {
+		memcpy(scratch, corpora[i].contents, corpora[i].size + 1);
+		kept[i]  = mtree_parse(scratch);
+		entries += alpm_list_count(kept[i]);
+	}
+	size_t used = mallinfo2().uordblks - before;
+	printf("memory: %.1f MiB for %zu entries, %.0f bytes per entry\n", used / (1024.0 * 1024.0), entries, (double)used / entries);
+	for(size_t i = 0; i < count; i++) {
+		alpm_list_free_inner(kept[i], (alpm_list_fn_free)mtree_entry_destroy);
+		alpm_list_free(kept[i]);
+	}
+	free(kept);
+
+	free(scratch);
+	for(size_t i = 0; i < count; i++)
+		free(corpora[i].contents);
+	free(corpora);
+	return 0;
+}
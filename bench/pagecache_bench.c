@@ -0,0 +1,169 @@
+/**
+ * Benchmark of the cache neutral reader: hashes a set of files, a quarter of which are cached beforehand to stand in
+ * for the working set of other processes, and reports md5 throughput and the page cache footprint left behind,
+ * once with a regular and once with a cache neutral reader.
+ *
+ * usage: pagecache_bench [directory] [size in MiB]
+ * The files are generated in a temporary directory below directory (default: the current directory), which has to
+ * be on a disk based file system: tmpfs keeps everything in the page cache anyway.
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/md5.h"
+#include "../src/reader.h"
+
+
+#define FILE_SIZE (1024 * 1024)
+
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/**
+ * Returns the number of pages of the file at path that are in the page cache.
+ */
+static size_t resident_pages(const char * path) {
+	int fd = open(path, O_RDONLY);
+	if(fd == -1)
+		return 0;
+	struct stat st;
+	size_t result = 0;
+	if(fstat(fd, &st) == 0 && st.st_size > 0) {
+		size_t pages = (st.st_size + 4095) / 4096;
+		unsigned char * vector = (unsigned char *)malloc(pages);
+		void * map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if(vector != NULL && map != MAP_FAILED && mincore(map, st.st_size, vector) == 0)
+			for(size_t i = 0; i < pages; i++)
+				result += vector[i] & 1;
+		if(map != MAP_FAILED)
+			munmap(map, st.st_size);
+		free(vector);
+	}
+	close(fd);
+	return result;
+}
+
+
+static size_t resident_pages_total(char ** paths, size_t first, size_t count) {
+	size_t result = 0;
+	for(size_t i = first; i < first + count; i++)
+		result += resident_pages(paths[i]);
+	return result;
+}
+
+
+/**
+ * Evicts all files, then caches the first quarter of them.
+ */
+static void prepare_cache(char ** paths, size_t count) {
+	for(size_t i = 0; i < count; i++) {
+		int fd = open(paths[i], O_RDONLY);
+		if(fd == -1)
+			continue;
+		fdatasync(fd);
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		if(i < count / 4) {
+			static unsigned char buffer[FILE_SIZE];
+			while(read(fd, buffer, sizeof(buffer)) > 0)
+				;
+		}
+		close(fd);
+	}
+}
+
+
+static void run(const char * name, bool cache_neutral, char ** paths, size_t count) {
+	prepare_cache(paths, count);
+	size_t before = resident_pages_total(paths, 0, count);
+
+	struct reader_t * reader = reader_create(cache_neutral);
+	if(reader == NULL) {
+		fprintf(stderr, "error: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	size_t total = 0;
+	double start = now();
+	for(size_t i = 0; i < count; i++) {
+		if(reader_open(reader, paths[i]) != 0) {
+			perror(paths[i]);
+			exit(EXIT_FAILURE);
+		}
+		MD5_CTX ctx;
+		MD5_Init(&ctx);
+		const unsigned char * data;
+		ssize_t size;
+		while((size = reader_read(reader, &data)) > 0) {
+			MD5_Update(&ctx, data, size);
+			total += size;
+		}
+		reader_close(reader);
+		unsigned char digest[16];
+		MD5_Final(digest, &ctx);
+	}
+	double elapsed = now() - start;
+	reader_destroy(reader);
+
+	size_t after = resident_pages_total(paths, 0, count),
+	       warm  = resident_pages_total(paths, 0, count / 4);
+	printf("%-8s %7.1f MB/s  cached before %6zu KiB, after %6zu KiB (working set %zu of %zu KiB kept)\n",
+		name, total / elapsed / 1e6, before * 4, after * 4, warm * 4, (count / 4) * (FILE_SIZE / 1024));
+}
+
+
+int main(int argc, char ** argv) {
+	const char * parent = (argc > 1 ? argv[1] : ".");
+	size_t       count  = (argc > 2 ? strtoul(argv[2], NULL, 10) : 256);
+
+	char * directory;
+	if(asprintf(&directory, "%s/pagecache_bench.XXXXXX", parent) == -1 || mkdtemp(directory) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+
+	char ** paths = (char **)malloc(count * sizeof(char *));
+	static unsigned char data[FILE_SIZE];
+	if(paths == NULL) {
+		fprintf(stderr, "error: out of memory\n");
+		return 1;
+	}
+	srand(42);
+	for(size_t i = 0; i < count; i++) {
+		for(size_t j = 0; j < FILE_SIZE; j++)
+			data[j] = rand();
+		if(asprintf(&paths[i], "%s/%zu", directory, i) == -1) {
+			fprintf(stderr, "error: out of memory\n");
+			return 1;
+		}
+		FILE * fp = fopen(paths[i], "w");
+		if(fp == NULL || fwrite(data, 1, FILE_SIZE, fp) != FILE_SIZE || fclose(fp) != 0) {
+			perror(paths[i]);
+			return 1;
+		}
+	}
+
+	run("regular", false, paths, count);
+	run("neutral", true,  paths, count);
+
+	for(size_t i = 0; i < count; i++) {
+		unlink(paths[i]);
+		free(paths[i]);
+	}
+	free(paths);
+	rmdir(directory);
+	free(directory);
+	return 0;
+}
@@ -0,0 +1,195 @@
+/**
+ * Benchmark of the file reader versus the former fopen/fread loop with a 4 KiB buffer.
+ * Reports read() calls (from /proc/self/io) and throughput with a warm page cache; the contents are folded into
+ * a cheap checksum so both sides touch every byte without the cost of a digest.
+ *
+ * usage: read_bench [file...]
+ * Without arguments, a temporary mix of small and large files is generated.
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/reader.h"
+
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/**
+ * Returns the number of read system calls issued by this process so far.
+ */
+static unsigned long long read_calls() {
+	unsigned long long result = 0;
+	FILE * fp = fopen("/proc/self/io", "r");
+	if(fp == NULL)
+		return 0;
+	char line[128];
+	while(fgets(line, sizeof(line), fp) != NULL)
+		if(sscanf(line, "syscr: %llu", &result) == 1)
+			break;
+	fclose(fp);
+	return result;
+}
+
+
+static uint64_t fold(uint64_t sum, const unsigned char * data, size_t size) {
+	size_t i = 0;
+	for(; i + 8 <= size; i += 8) {
+		uint64_t word;
+		memcpy(&word, data + i, 8);
+		sum ^= word;
+	}
+	for(; i < size; i++)
+		sum += data[i];
+	return sum;
+}
+
+
+static uint64_t read_stdio(const char * path, size_t * total) {
+	uint64_t sum = 0;
+	FILE * fp = fopen(path, "r");
+	if(fp == NULL)
+		return 0;
+	while(!feof(fp)) {
+		unsigned char buffer[4096];
+		size_t size = fread(buffer, 1, sizeof(buffer), fp);
+		if(size == 0)
+			break;
+		sum = fold(sum, buffer, size);
+		*total += size;
+	}
+	fclose(fp);
+	return sum;
+}
+
+
+static uint64_t read_reader(struct reader_t * reader, const char * path, size_t * total, size_t * mapped) {
+	uint64_t sum = 0;
+	if(reader_open(reader, path) != 0)
+		return 0;
+	if(reader_is_mapped(reader))
+		(*mapped)++;
+	const unsigned char * data;
+	ssize_t size;
+	while((size = reader_read(reader, &data)) > 0) {
+		sum = fold(sum, data, size);
+		*total += size;
+	}
+	reader_close(reader);
+	return sum;
+}
+
+
+static char ** generate(char * directory, size_t * count) {
+	static const struct { size_t size, count; } mix[] = {
+		{ 2 * 1024,         512 },
+		{ 24 * 1024,        256 },
+		{ 200 * 1024,        32 },
+		{ 8 * 1024 * 1024,    8 }
+	};
+
+	if(mkdtemp(directory) == NULL) {
+		perror("mkdtemp");
+		exit(EXIT_FAILURE);
+	}
+
+	*count = 0;
+	for(size_t i = 0; i < sizeof(mix) / sizeof(mix[0]); i++)
+		*count += mix[i].count;
+	char ** paths = (char **)malloc(*count * sizeof(char *));
+	unsigned char * data = (unsigned char *)malloc(8 * 1024 * 1024);
+	if(paths == NULL || data == NULL) {
+		fprintf(stderr, "error: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	srand(42);
+	for(size_t i = 0; i < 8 * 1024 * 1024; i++)
+		data[i] = rand();
+
+	size_t n = 0;
+	for(size_t i = 0; i < sizeof(mix) / sizeof(mix[0]); i++) {
+		for(size_t j = 0; j < mix[i].count; j++, n++) {
+			if(asprintf(&paths[n], "%s/%zu", directory, n) == -1) {
+				fprintf(stderr, "error: out of memory\n");
+				exit(EXIT_FAILURE);
+			}
+			FILE * fp = fopen(paths[n], "w");
+			if(fp == NULL || fwrite(data, 1, mix[i].size, fp) != mix[i].size || fclose(fp) != 0) {
+				perror(paths[n]);
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+
+	free(data);
+	return paths;
+}
+
+
+int main(int argc, char ** argv) {
+	char    directory[] = "/tmp/read_bench.XXXXXX";
+	char ** paths       = argv + 1;
+	size_t  count       = argc - 1;
+	bool    generated   = (count == 0);
+	if(generated)
+		paths = generate(directory, &count);
+
+	struct reader_t * reader = reader_create(false);
+	if(reader == NULL) {
+		fprintf(stderr, "error: out of memory\n");
+		return 1;
+	}
+
+	// warm up the page cache
+	size_t total = 0, mapped = 0;
+	for(size_t i = 0; i < count; i++)
+		read_stdio(paths[i], &total);
+
+	// before: stdio with a 4 KiB buffer
+	uint64_t sum_stdio = 0;
+	total = 0;
+	unsigned long long calls = read_calls();
+	double start = now();
+	for(size_t i = 0; i < count; i++)
+		sum_stdio += read_stdio(paths[i], &total);
+	double stdio_time = now() - start;
+	calls = read_calls() - calls;
+	printf("stdio:  %10llu read calls  %6.2f GB/s\n", calls, total / stdio_time / 1e9);
+
+	// after: the reader
+	uint64_t sum_reader = 0;
+	total = 0;
+	calls = read_calls();
+	start = now();
+	for(size_t i = 0; i < count; i++)
+		sum_reader += read_reader(reader, paths[i], &total, &mapped);
+	double reader_time = now() - start;
+	calls = read_calls() - calls;
+	printf("reader: %10llu read calls  %6.2f GB/s (%zu of %zu files mapped, %.2fx)\n", calls, total / reader_time / 1e9, mapped, count, stdio_time / reader_time);
+
+	reader_destroy(reader);
+
+	if(generated) {
+		for(size_t i = 0; i < count; i++) {
+			unlink(paths[i]);
+			free(paths[i]);
+		}
+		free(paths);
+		rmdir(directory);
+	}
+
+	if(sum_stdio != sum_reader) {
+		fprintf(stderr, "error: contents differ\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,223 @@
+#define _GNU_SOURCE
+#include "cache.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/**
+ * On-disk format: a header followed by count records, all in host byte order.
+ * The cache is a local, per-host file, so there is no need for a portable encoding.
+ */
+static const char CACHE_MAGIC[8] = { 'A', 'D', 'C', 'A', 'C', 'H', 'E', '1' };
+
+typedef struct {
+	char     magic[8];
+	uint64_t count;
+} cache_header_t;
+
+typedef struct {
+	cache_key_t   key;
+	unsigned char digest[CACHE_DIGEST_SIZE];
+} cache_record_t;
+
+
+typedef struct {
+	cache_record_t record;
+	bool           occupied;
+	bool           used; // looked up or stored during this run
+} cache_slot_t;
+
+
+typedef struct {
+	char *         file_path;
+	cache_slot_t * slots;
+	size_t         slots_count;     // always a power of two
+	size_t         slots_occupied;
+	size_t         hits;
+	size_t         misses;
+} cache_internal_t;
+
+
+bool cache_key_equals(const cache_key_t * a, const cache_key_t * b) {
+	return a->device == b->device && a->inode == b->inode && a->size == b->size && a->mtime == b->mtime && a->ctime == b->ctime && a->digest == b->digest;
+}
+
+
+size_t cache_key_hash(const cache_key_t * key) {
+	uint64_t h = key->device * 0x9e3779b97f4a7c15ULL;
+	h ^= key->inode + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+	h ^= (uint64_t)key->digest + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return (size_t)h;
+}
+
+
+/**
+ * Returns the slot holding key, or the free slot where it belongs.
+ */
+static cache_slot_t * cache_find_slot(cache_internal_t * priv, const cache_key_t * key) {
+	size_t mask = priv->slots_count - 1;
+	for(size_t i = cache_key_hash(key) & mask; ; i = (i + 1) & mask) {
+		cache_slot_t * slot = &priv->slots[i];
+		if(!slot->occupied || cache_key_equals(&slot->record.key, key))
+			return slot;
+	}
+}
+
+
+static void cache_insert(cache_internal_t * priv, const cache_record_t * record, bool used) {
+	// keep the load factor below 1/2
+	if(2 * (priv->slots_occupied + 1) > priv->slots_count) {
+		cache_slot_t * old_slots = priv->slots;
+		size_t         old_count = priv->slots_count;
+		priv->slots_count *= 2;
+		priv->slots        = (cache_slot_t *)calloc(priv->slots_count, sizeof(cache_slot_t));
+		assert(priv->slots != NULL);
+		for(size_t i = 0; i < old_count; i++)
+			if(old_slots[i].occupied)
+				*cache_find_slot(priv, &old_slots[i].record.key) = old_slots[i];
+		free(old_slots);
+	}
+
+	cache_slot_t * slot = cache_find_slot(priv, &record->key);
+	if(!slot->occupied)
+		priv->slots_occupied++;
+	slot->record   = *record;
+	slot->occupied = true;
+	slot->used     = used;
+}
+
+
+struct cache_t * cache_open(const char * file_path) {
+	cache_internal_t * priv = (cache_internal_t *)malloc(sizeof(cache_internal_t));
+	if(priv == NULL)
+		return NULL;
+	priv->file_path      = strdup(file_path);
+	priv->slots_count    = 1024;
+	priv->slots          = (cache_slot_t *)calloc(priv->slots_count, sizeof(cache_slot_t));
+	priv->slots_occupied = 0;
+	priv->hits           = 0;
+	priv->misses         = 0;
+	assert(priv->file_path != NULL && priv->slots != NULL);
+
+	FILE * fp = fopen(file_path, "r");
+	if(fp == NULL)
+		return (struct cache_t *)priv;
+
+	cache_header_t header;
+	if(fread(&header, sizeof(header), 1, fp) == 1 && memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0) {
+		cache_record_t record;
+		for(uint64_t i = 0; i < header.count && fread(&record, sizeof(record), 1, fp) == 1; i++)
+			cache_insert(priv, &record, false);
+	}
+
+	fclose(fp);
+	return (struct cache_t *)priv;
+}
+
+
+int cache_save(struct cache_t * handle) {
+	cache_internal_t * priv = (cache_internal_t *)handle;
+
+	// make sure the cache directory exists
+	char * directory = strdup(priv->file_path);
+	assert(directory != NULL);
+	if(mkdir(dirname(directory), 0755) != 0 && errno != EEXIST) {
+		free(directory);
+		return -1;
+	}
+	free(directory);
+
+	char * temp_path;
+	int result = asprintf(&temp_path, "%s.tmp", priv->file_path);
+	assert(result != -1);
+
+	FILE * fp = fopen(temp_path, "w");
+	if(fp == NULL) {
+		free(temp_path);
+		return -1;
+	}
+
+	cache_header_t header;
+	memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	header.count = 0;
+	for(size_t i = 0; i < priv->slots_count; i++)
+		if(priv->slots[i].occupied && priv->slots[i].used)
+			header.count++;
+
+	bool ok = (fwrite(&header, sizeof(header), 1, fp) == 1);
+	for(size_t i = 0; ok && i < priv->slots_count; i++)
+		if(priv->slots[i].occupied && priv->slots[i].used)
+			ok = (fwrite(&priv->slots[i].record, sizeof(cache_record_t), 1, fp) == 1);
+
+	if(fclose(fp) != 0)
+		ok = false;
+	if(!ok || rename(temp_path, priv->file_path) != 0) {
+		int error = errno;
+		unlink(temp_path);
+		free(temp_path);
+		errno = error;
+		return -1;
+	}
+
+	free(temp_path);
+	return 0;
+}
+
+
+void cache_close(struct cache_t * handle) {
+	cache_internal_t * priv = (cache_internal_t *)handle;
+	free(priv->slots);
+	free(priv->file_path);
+	free(priv);
+}
+
+
+bool cache_lookup(struct cache_t * handle, const cache_key_t * key, unsigned char * digest, size_t size) {
+	cache_internal_t * priv = (cache_internal_t *)handle;
+	assert(size <= CACHE_DIGEST_SIZE);
+
+	cache_slot_t * slot = cache_find_slot(priv, key);
+	if(!slot->occupied) {
+		priv->misses++;
+		return false;
+	}
+
+	slot->used = true;
+	memcpy(digest, slot->record.digest, size);
+	priv->hits++;
+	return true;
+}
+
+
+void cache_store(struct cache_t * handle, const cache_key_t * key, const unsigned char * digest, size_t size) {
+	cache_internal_t * priv = (cache_internal_t *)handle;
+	assert(size <= CACHE_DIGEST_SIZE);
+
+	cache_record_t record;
+	memset(&record, 0, sizeof(record));
+	record.key = *key;
+	memcpy(record.digest, digest, size);
+	cache_insert(priv, &record, true);
+}
+
+
+size_t cache_get_hits(const struct cache_t * handle) {
+	const cache_internal_t * priv = (const cache_internal_t *)handle;
+	return priv->hits;
+}
+
+
+size_t cache_get_misses(const struct cache_t * handle) {
+	const cache_internal_t * priv = (const cache_internal_t *)handle;
+	return priv->misses;
+}
@@ -0,0 +1,86 @@
+#ifndef INCLUDE_CACHE_H
+#define INCLUDE_CACHE_H
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * Opaque handle of the persistent digest cache. It maps the identity of a file to the digest of its contents,
+ * so unchanged files don't have to be read again on the next run.
+ */
+struct cache_t;
+
+/**
+ * Identity of a file: if any of these changes, the cached digest is not trusted anymore.
+ * Times are in nanoseconds since the epoch. digest distinguishes digest algorithms.
+ */
+typedef struct {
+	uint64_t device;
+	uint64_t inode;
+	int64_t  size;
+	int64_t  mtime;
+	int64_t  ctime;
+	uint32_t digest;
+} cache_key_t;
+
+/**
+ * Compares and hashes keys, for other tables keyed by file identity.
+ */
+bool   cache_key_equals(const cache_key_t * a, const cache_key_t * b);
+size_t cache_key_hash  (const cache_key_t * key);
+
+/**
+ * Maximum size of a cached digest in bytes.
+ */
+#define CACHE_DIGEST_SIZE 32
+
+/**
+ * Opens the cache stored at file_path. A missing or unreadable cache file results in an empty cache.
+ * Returns NULL on failure.
+ */
+struct cache_t * cache_open(const char * file_path);
+
+/**
+ * Writes all entries that have been looked up or stored since cache_open back to the cache file, replacing it
+ * atomically. Stale entries of files that are gone are dropped this way.
+ * Returns -1 on failure (with errno set), 0 otherwise.
+ */
+int cache_save(struct cache_t * handle);
+
+/**
+ * Releases the handle without saving.
+ */
+void cache_close(struct cache_t * handle);
+
+/**
+ * Looks up the digest for key and copies its size bytes to digest.
+ * Returns true on a hit.
+ */
+bool cache_lookup(struct cache_t * handle, const cache_key_t * key, unsigned char * digest, size_t size);
+
+/**
+ * Stores the size bytes of digest for key.
+ */
+void cache_store(struct cache_t * handle, const cache_key_t * key, const unsigned char * digest, size_t size);
+
+/**
+ * Statistics about all lookups since cache_open.
+ */
+size_t cache_get_hits  (const struct cache_t * handle);
+size_t cache_get_misses(const struct cache_t * handle);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
@@ -4,10 +4,18 @@
 #include <assert.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/sysmacros.h>
 #include <unistd.h>
 #include <linux/limits.h>
 
@@ -23,10 +31,27 @@ typedef enum {
 } filesystem_entry_type_t;
 
 
+enum {
+	FILESYSTEM_ENTRY_FLAG_STATTED   = 1 << 0, // the metadata has been read, entries are built from d_type
+	FILESYSTEM_ENTRY_FLAG_NETWORK   = 1 << 1, // on a network file system, see filesystem_is_network
+	FILESYSTEM_ENTRY_FLAG_EVALUATED = 1 << 2, // the children of a directory have been read
+	FILESYSTEM_ENTRY_FLAG_TRACKED   = 1 << 3,
+	FILESYSTEM_ENTRY_FLAG_REUSED    = 1 << 4, // the children of a directory were taken from the snapshot
+	FILESYSTEM_ENTRY_FLAG_VANISHED  = 1 << 5, // removed since its directory was read, found when statted
+	FILESYSTEM_ENTRY_FLAG_OWNED     = 1 << 6  // the children of a directory or the target of a link are malloc'd
+};
+
+
+#define FILESYSTEM_SNAPSHOT_NONE UINT32_MAX
+
+
+struct filesystem_entry_internal_t;
+
+
 typedef struct {
-	bool                                  children_evaluated;
-	struct filesystem_entry_internal_t ** children;
-	size_t                                children_count;
+	struct filesystem_entry_internal_t * children; // contiguous and sorted by name, siblings are found by position
+	uint32_t                             children_count;
+	uint32_t                             snapshot;       // record of the directory in the snapshot, or FILESYSTEM_SNAPSHOT_NONE
 } filesystem_directory_t;
 
 
@@ -36,129 +61,447 @@ typedef struct {
 
 
 typedef struct {
-	char * target;
+	char * target; // NULL until needed
 } filesystem_symlink_t;
 
 
+/**
+ * Nodes, names and link targets are allocated from the arena of the filesystem and released all at once. Only
+ * what is read again while the tree is kept up to date owns its storage instead (FILESYSTEM_ENTRY_FLAG_OWNED),
+ * as does everything read below it: the children of such a directory are one malloc'd block with their names
+ * following the nodes, which is freed once they are read again.
+ */
 typedef struct filesystem_entry_internal_t {
-	struct filesystem_entry_internal_t * parent,
-	                                   * prev,
-	                                   * next;
-	filesystem_entry_type_t              type;
-
-	char *                  name;
-	mode_t                  mode;
-	uid_t                   uid;
-	gid_t                   gid;
-	time_t                  mtime;
-	void *                  user_data;
+	struct filesystem_entry_internal_t * parent;
+	const char *                         name;
+	dev_t                                device;
+	ino_t                                inode;
+	struct timespec                      mtime;
+	struct timespec                      ctime;
 
 	union {
-		filesystem_directory_t   dir;
-		filesystem_file_t        file;
-		filesystem_symlink_t     link;
+		filesystem_directory_t           dir;
+		filesystem_file_t                file;
+		filesystem_symlink_t             link;
 	} data;
+
+	mode_t                               mode;
+	uid_t                                uid;
+	gid_t                                gid;
+	uint8_t                              type;  // filesystem_entry_type_t
+	uint8_t                              flags; // FILESYSTEM_ENTRY_FLAG_*
 } filesystem_entry_internal_t;
 
 
+#define FILESYSTEM_ARENA_BLOCK_SIZE (1024 * 1024)
+
+
+/**
+ * Alignment of the memory handed out by the arena (max_align_t is C11).
+ */
+typedef union {
+	long double d;
+	long long   l;
+	void *      p;
+} filesystem_align_t;
+
+
+/**
+ * A block of the bump allocator; the memory handed out follows the header.
+ */
+typedef struct filesystem_arena_block_t {
+	struct filesystem_arena_block_t * next;
+	size_t                            size;
+	size_t                            used;
+	filesystem_align_t                data[];
+} filesystem_arena_block_t;
+
+
+/**
+ * Snapshot file format: a header, the directory records, the entry records and the names, all in host byte order
+ * (the snapshot is a local, per-host file). Entry 0 is the root; the children of a directory are the contiguous
+ * entries starting at first_child, sorted by name. Times are in nanoseconds since the epoch.
+ */
+static const char FILESYSTEM_SNAPSHOT_MAGIC[8] = { 'A', 'D', 'S', 'N', 'A', 'P', 'S', '1' };
+
+typedef struct {
+	char     magic[8];
+	uint32_t directories_count;
+	uint32_t entries_count;
+	uint64_t names_size;
+} filesystem_snapshot_header_t;
+
+typedef struct {
+	uint64_t device;
+	uint64_t inode;
+	int64_t  mtime;
+	int64_t  ctime;
+	uint32_t first_child;
+	uint32_t children_count;
+} filesystem_snapshot_directory_t;
+
+typedef struct {
+	uint64_t device;
+	uint64_t inode;
+	int64_t  mtime;
+	int64_t  ctime;
+	int64_t  size;
+	uint32_t name;      // offset into the names
+	uint32_t target;    // offset into the names, or FILESYSTEM_SNAPSHOT_NONE if the link wasn't read
+	uint32_t mode;
+	uint32_t uid;
+	uint32_t gid;
+	uint32_t directory; // record of the directory, or FILESYSTEM_SNAPSHOT_NONE if its children weren't read
+	uint8_t  type;
+	uint8_t  flags;     // FILESYSTEM_ENTRY_FLAG_STATTED if the metadata is valid
+	uint8_t  reserved[6];
+} filesystem_snapshot_entry_t;
+
+
+typedef struct {
+	const filesystem_entry_internal_t * entry;
+	int                                 fd;
+} filesystem_parent_t;
+
+
 typedef struct {
-	filesystem_entry_internal_t * root;
+	filesystem_entry_internal_t             root;   // first, so an entry finds the filesystem by walking up its parents
+	pthread_mutex_t                         mutex;  // scan threads allocate from the arena concurrently
+	filesystem_arena_block_t *              blocks; // the current one first
+	bool                                    owned;  // some entries own their storage, see filesystem_entry_release
+
+	// the snapshot of the previous run, see filesystem_load_snapshot
+	bool                                    snapshot_enabled;
+	bool                                    snapshot_trusted;
+	struct timespec                         snapshot_started;
+	void *                                  snapshot;
+	size_t                                  snapshot_size;
+	const filesystem_snapshot_directory_t * snapshot_directories;
+	const filesystem_snapshot_entry_t *     snapshot_entries;
+	const char *                            snapshot_names;
+
+	// descriptors of the directories from the root down to the one of the last entry statted or link read on
+	// demand, see filesystem_entry_get_parent_fd
+	filesystem_parent_t *                   parents;
+	size_t                                  parents_count;
+	size_t                                  parents_allocated;
 } filesystem_internal_t;
 
 
 struct filesystem_t * filesystem_open() {
-	filesystem_entry_internal_t * root = (filesystem_entry_internal_t *)malloc(sizeof(filesystem_entry_internal_t));
-	if(root == NULL)
+	filesystem_internal_t * fs = (filesystem_internal_t *)calloc(1, sizeof(filesystem_internal_t));
+	if(fs == NULL)
 		return NULL;
-	root->parent                      = NULL;
-	root->prev                        = NULL;
-	root->next                        = NULL;
-	root->type                        = FILESYSTEM_ENTRY_TYPE_DIR;
-	root->name                        = strdup("");
-	root->mode                        = 0;
-	root->uid                         = 0;
-	root->gid                         = 0;
-	root->mtime                       = 0;
-	root->user_data                   = NULL;
-	root->data.dir.children_evaluated = false;
-
-	filesystem_internal_t * fs = (filesystem_internal_t *)malloc(sizeof(filesystem_internal_t));
-	fs->root = root;
+
+	filesystem_entry_internal_t * root = &fs->root;
+	root->parent = NULL;
+	root->name   = "";
+	root->type   = FILESYSTEM_ENTRY_TYPE_DIR;
+	root->flags  = FILESYSTEM_ENTRY_FLAG_STATTED;
+	root->data.dir.snapshot = FILESYSTEM_SNAPSHOT_NONE;
+	pthread_mutex_init(&fs->mutex, NULL);
+	fs->blocks    = NULL;
+	fs->owned     = false;
+	fs->snapshot  = NULL;
+	fs->parents   = NULL;
 	return (struct filesystem_t *)fs;
 }
 
 
-static void filesystem_free_entry(filesystem_entry_internal_t * entry, filesystem_fn_free fn) {
-	free(entry->name);
-	if(fn != NULL && entry->user_data != NULL)
-		fn(entry->user_data);
+static void filesystem_entry_release(filesystem_entry_internal_t * entry);
+
+
+static void filesystem_free_arena(filesystem_internal_t * fs) {
+	while(fs->blocks != NULL) {
+		filesystem_arena_block_t * next = fs->blocks->next;
+		free(fs->blocks);
+		fs->blocks = next;
+	}
+}
+
+
+void filesystem_close(struct filesystem_t * handle) {
+	filesystem_internal_t * priv = (filesystem_internal_t *)handle;
+	if(priv->owned)
+		filesystem_entry_release(&priv->root);
+	filesystem_free_arena(priv);
+	if(priv->snapshot != NULL)
+		munmap(priv->snapshot, priv->snapshot_size);
+	for(size_t i = 0; i < priv->parents_count; i++)
+		close(priv->parents[i].fd);
+	free(priv->parents);
+	pthread_mutex_destroy(&priv->mutex);
+	free(priv);
+}
+
+
+static filesystem_internal_t * filesystem_entry_get_filesystem(const filesystem_entry_internal_t * entry) {
+	while(entry->parent != NULL)
+		entry = entry->parent;
+	return (filesystem_internal_t *)entry;
+}
+
+
+/**
+ * Allocates size bytes (aligned for any type) from the arena of the filesystem the entry belongs to.
+ */
+static void * filesystem_entry_alloc(const filesystem_entry_internal_t * entry, size_t size) {
+	filesystem_internal_t * priv = filesystem_entry_get_filesystem(entry);
+	size = (size + sizeof(filesystem_align_t) - 1) / sizeof(filesystem_align_t) * sizeof(filesystem_align_t);
+
+	pthread_mutex_lock(&priv->mutex);
+	filesystem_arena_block_t * block = priv->blocks;
+	if(block == NULL || block->size - block->used < size) {
+		// large requests get a block of their own, behind the current one so its free space isn't lost
+		size_t capacity = (size > FILESYSTEM_ARENA_BLOCK_SIZE / 4 ? size : FILESYSTEM_ARENA_BLOCK_SIZE);
+		block = (filesystem_arena_block_t *)malloc(sizeof(filesystem_arena_block_t) + capacity);
+		assert(block != NULL);
+		block->size = capacity;
+		block->used = 0;
+		if(capacity != FILESYSTEM_ARENA_BLOCK_SIZE && priv->blocks != NULL) {
+			block->next        = priv->blocks->next;
+			priv->blocks->next = block;
+		}
+		else {
+			block->next  = priv->blocks;
+			priv->blocks = block;
+		}
+	}
+	void * result = (char *)block->data + block->used;
+	block->used += size;
+	pthread_mutex_unlock(&priv->mutex);
+	return result;
+}
+
+
+/**
+ * Allocates the children of a directory followed by names_size bytes for their names, from the arena unless the
+ * directory owns its storage.
+ */
+static filesystem_entry_internal_t * filesystem_entry_alloc_children(const filesystem_entry_internal_t * entry, size_t count, size_t names_size) {
+	size_t size = count * sizeof(filesystem_entry_internal_t) + names_size;
+	if(!(entry->flags & FILESYSTEM_ENTRY_FLAG_OWNED))
+		return (filesystem_entry_internal_t *)filesystem_entry_alloc(entry, size);
+
+	filesystem_entry_internal_t * children = (filesystem_entry_internal_t *)malloc(size);
+	assert(children != NULL);
+	return children;
+}
 
-	switch(entry->type) {
-		case FILESYSTEM_ENTRY_TYPE_DIR:
-			if(entry->data.dir.children_evaluated) {
-				for(size_t i = 0; i < entry->data.dir.children_count; i++)
-					filesystem_free_entry(entry->data.dir.children[i], fn);
-			}
-			break;
 
-		case FILESYSTEM_ENTRY_TYPE_LINK:
+/**
+ * Drops the children of a directory or the target of a link, and frees what entries below own (the rest is left
+ * to the arena). A directory is unevaluated afterwards.
+ */
+static void filesystem_entry_release(filesystem_entry_internal_t * entry) {
+	if(entry->type == FILESYSTEM_ENTRY_TYPE_DIR && (entry->flags & FILESYSTEM_ENTRY_FLAG_EVALUATED)) {
+		for(uint32_t i = 0; i < entry->data.dir.children_count; i++)
+			filesystem_entry_release(&entry->data.dir.children[i]);
+		if(entry->flags & FILESYSTEM_ENTRY_FLAG_OWNED)
+			free(entry->data.dir.children);
+		entry->data.dir.children       = NULL;
+		entry->data.dir.children_count = 0;
+		entry->flags                  &= ~(FILESYSTEM_ENTRY_FLAG_EVALUATED | FILESYSTEM_ENTRY_FLAG_REUSED);
+	}
+	else if(entry->type == FILESYSTEM_ENTRY_TYPE_LINK) {
+		if(entry->flags & FILESYSTEM_ENTRY_FLAG_OWNED)
 			free(entry->data.link.target);
-			break;
+		entry->data.link.target = NULL;
+	}
+}
 
-		default:
-			break;
+
+typedef struct {
+	size_t stats_avoided;
+	size_t readlinks_avoided;
+	size_t directories_reused;
+} filesystem_counters_t;
+
+
+static void filesystem_count(const filesystem_entry_internal_t * entry, filesystem_counters_t * counters) {
+	if(!(entry->flags & FILESYSTEM_ENTRY_FLAG_STATTED))
+		counters->stats_avoided++;
+	if(entry->type == FILESYSTEM_ENTRY_TYPE_LINK && entry->data.link.target == NULL)
+		counters->readlinks_avoided++;
+	if(entry->flags & FILESYSTEM_ENTRY_FLAG_REUSED)
+		counters->directories_reused++;
+	if(entry->type == FILESYSTEM_ENTRY_TYPE_DIR && (entry->flags & FILESYSTEM_ENTRY_FLAG_EVALUATED)) {
+		for(uint32_t i = 0; i < entry->data.dir.children_count; i++)
+			filesystem_count(&entry->data.dir.children[i], counters);
 	}
+}
+
 
-	free(entry);
+size_t filesystem_get_stats_avoided(struct filesystem_t * handle) {
+	filesystem_internal_t * priv     = (filesystem_internal_t *)handle;
+	filesystem_counters_t   counters = { 0, 0, 0 };
+	filesystem_count(&priv->root, &counters);
+	return counters.stats_avoided;
 }
 
 
-void filesystem_close(struct filesystem_t * handle, filesystem_fn_free fn) {
-	filesystem_internal_t * priv = (filesystem_internal_t *)handle;
-	filesystem_free_entry(priv->root, fn);
-	free(handle);
+size_t filesystem_get_readlinks_avoided(struct filesystem_t * handle) {
+	filesystem_internal_t * priv     = (filesystem_internal_t *)handle;
+	filesystem_counters_t   counters = { 0, 0, 0 };
+	filesystem_count(&priv->root, &counters);
+	return counters.readlinks_avoided;
+}
+
+
+size_t filesystem_get_directories_reused(struct filesystem_t * handle) {
+	filesystem_internal_t * priv     = (filesystem_internal_t *)handle;
+	filesystem_counters_t   counters = { 0, 0, 0 };
+	filesystem_count(&priv->root, &counters);
+	return counters.directories_reused;
 }
 
 
+static filesystem_entry_internal_t * filesystem_entry_find_child(filesystem_entry_internal_t * entry, const char * name, size_t length, const filesystem_entry_internal_t * hint);
+
+
 struct filesystem_entry_t * filesystem_get_path(struct filesystem_t * handle, const char * path) {
 	if(path[0] != '/')
 		return NULL;
 
 	filesystem_internal_t * priv = (filesystem_internal_t *)handle;
 
-	struct filesystem_entry_t * entry = (struct filesystem_entry_t *)priv->root;
-	const char * left = path + 1;
+	filesystem_entry_internal_t * entry = &priv->root;
+	const char *                  left  = path + 1;
 	while(entry != NULL) {
 		if(*left == '\0')
-			return entry;
+			return (struct filesystem_entry_t *)entry;
+
+		const char * right = strchrnul(left, '/');
+		entry = filesystem_entry_find_child(entry, left, right - left, NULL);
+		if(*right == '\0')
+			break;
+
+		left = right + 1; // skip '/'
+	}
 
-		const char * right = strchr(left, '/');
-		if(right == NULL)
-			return filesystem_entry_get_child_by_name(entry, left);
+	return (struct filesystem_entry_t *)entry;
+}
+
+
+/**
+ * Remembers the directory chain of the last resolved path: entries[i] is the entry of its first i components,
+ * entries[0] the root, of which depth + 1 are valid.
+ */
+typedef struct {
+	filesystem_internal_t *        fs;
+	filesystem_entry_internal_t ** entries;
+	size_t                         entries_allocated;
+	size_t                         depth;
+	char *                         path;
+	size_t                         path_allocated;
+} filesystem_cursor_internal_t;
+
+
+struct filesystem_cursor_t * filesystem_cursor_create(struct filesystem_t * handle) {
+	filesystem_cursor_internal_t * cursor = (filesystem_cursor_internal_t *)malloc(sizeof(filesystem_cursor_internal_t));
+	if(cursor == NULL)
+		return NULL;
+	cursor->fs                = (filesystem_internal_t *)handle;
+	cursor->entries_allocated = 32;
+	cursor->entries           = (filesystem_entry_internal_t **)malloc(cursor->entries_allocated * sizeof(filesystem_entry_internal_t *));
+	cursor->depth             = 0;
+	cursor->path_allocated    = PATH_MAX;
+	cursor->path              = (char *)malloc(cursor->path_allocated);
+	if(cursor->entries == NULL || cursor->path == NULL) {
+		filesystem_cursor_destroy((struct filesystem_cursor_t *)cursor);
+		return NULL;
+	}
+	cursor->entries[0] = &cursor->fs->root;
+	cursor->path[0]    = '\0';
+	return (struct filesystem_cursor_t *)cursor;
+}
+
+
+void filesystem_cursor_destroy(struct filesystem_cursor_t * handle) {
+	filesystem_cursor_internal_t * cursor = (filesystem_cursor_internal_t *)handle;
+	free(cursor->path);
+	free(cursor->entries);
+	free(cursor);
+}
+
+
+struct filesystem_entry_t * filesystem_cursor_resolve(struct filesystem_cursor_t * handle, const char * path) {
+	filesystem_cursor_internal_t * cursor = (filesystem_cursor_internal_t *)handle;
+	if(path[0] != '/')
+		return NULL;
+
+	// the components both paths have in common are already resolved
+	size_t i      = 0,
+	       shared = 0;
+	while(path[i] != '\0' && path[i] == cursor->path[i]) {
+		if(i > 0 && path[i] == '/')
+			shared++;
+		i++;
+	}
+	if(i > 1 && (path[i] == '/' || path[i] == '\0') && (cursor->path[i] == '/' || cursor->path[i] == '\0') && path[i - 1] != '/')
+		shared++; // the last common component ends in both paths
+	if(shared > cursor->depth)
+		shared = cursor->depth;
+
+	// remember the path for the next call, the buffer only grows
+	size_t length = i + strlen(path + i) + 1; // 1 for terminating '\0'-byte
+	if(length > cursor->path_allocated) {
+		cursor->path_allocated = length;
+		cursor->path           = (char *)realloc(cursor->path, cursor->path_allocated);
+		assert(cursor->path != NULL);
+	}
+	memcpy(cursor->path + i, path + i, length - i);
+
+	// skip the shared components and resolve the rest from the deepest common ancestor
+	const char * left = path + 1;
+	for(size_t j = 0; j < shared; j++) {
+		left = strchrnul(left, '/');
+		if(*left == '/')
+			left++;
+	}
+
+	// the child the previous path went through at the first differing level is where a sorted stream continues
+	filesystem_entry_internal_t * entry = cursor->entries[shared];
+	filesystem_entry_internal_t * hint  = (shared < cursor->depth ? cursor->entries[shared + 1] : NULL);
+	cursor->depth = shared;
+	while(*left != '\0') {
+		const char * right = strchrnul(left, '/');
+		entry = filesystem_entry_find_child(entry, left, right - left, hint);
+		hint  = NULL; // newly entered directories are merged from their first child
+		if(entry == NULL)
+			return NULL;
 
-		char * name = strndup(left, right - left);
-		entry = filesystem_entry_get_child_by_name(entry, name);
-		free(name);
+		if(cursor->depth + 1 == cursor->entries_allocated) {
+			cursor->entries_allocated *= 2;
+			cursor->entries            = (filesystem_entry_internal_t **)realloc(cursor->entries, cursor->entries_allocated * sizeof(filesystem_entry_internal_t *));
+			assert(cursor->entries != NULL);
+		}
+		cursor->entries[++cursor->depth] = entry;
 
+		if(*right == '\0')
+			break;
 		left = right + 1; // skip '/'
 	}
 
-	return NULL;
+	return (struct filesystem_entry_t *)entry;
 }
 
 
-static int compare_entries(const filesystem_entry_internal_t ** a, const filesystem_entry_internal_t ** b) {
-	return strcmp((*a)->name, (*b)->name);
+static int compare_entries(const filesystem_entry_internal_t * a, const filesystem_entry_internal_t * b) {
+	return strcmp(a->name, b->name);
 }
 
 
-static char * readlink_malloc(const char * path, size_t probable_length) {
+/**
+ * Reads the target of the symbolic link name, relative to the directory dirfd unless it is absolute.
+ */
+static char * readlinkat_malloc(int dirfd, const char * name, size_t probable_length) {
 	size_t allocated = (probable_length != 0 ? probable_length : PATH_MAX);
 	char * buffer    = (char *)malloc(allocated + 1); // 1 for terminating '\0'-byte
 	assert(buffer != NULL);
 
 	int result;
-	while((result = readlink(path, buffer, allocated + 1)) == allocated + 1) {
+	while((result = readlinkat(dirfd, name, buffer, allocated + 1)) == allocated + 1) {
 		// we did not allocate enough space, so lets try again
 		allocated *= 2;
 		buffer     = (char *)realloc(buffer, allocated + 1); // 1 for terminating '\0'-byte
@@ -167,10 +510,16 @@ static char * readlink_malloc(const char * path, size_t probable_length) {
 
 	if(result == -1) {
 		if(errno == EACCES) {
-			fprintf(stderr, "error: permission denied `%s'\n", path);
+			fprintf(stderr, "error: permission denied `%s'\n", name);
 			buffer = (char *)realloc(buffer, 1); // 1 for terminating '\0'-byte
 			assert(buffer != NULL);
 			buffer[0] = '\0';
+			return buffer;
+		}
+		else if(errno == ENOENT || errno == EINVAL) {
+			// removed or replaced since its directory was read
+			buffer[0] = '\0';
+			return buffer;
 		}
 		else {
 			perror("readlink");
@@ -189,16 +538,344 @@ static char * readlink_malloc(const char * path, size_t probable_length) {
 }
 
 
+/**
+ * Returns true if the directory dirfd is on a network file system, where metadata doesn't have to be synchronized
+ * with the server for our purposes.
+ */
+static bool filesystem_is_network(int dirfd) {
+	struct statfs info;
+	if(fstatfs(dirfd, &info) != 0)
+		return false;
+
+	switch((unsigned long)info.f_type) {
+		case 0x6969:     // NFS
+		case 0x517b:     // SMB
+		case 0xff534d42: // CIFS
+		case 0xfe534d42: // SMB2
+		case 0x00c36400: // Ceph
+		case 0x5346414f: // AFS
+		case 0x6b414653: // kAFS
+		case 0x01021997: // 9P
+			return true;
+		default:
+			return false;
+	}
+}
+
+
+static filesystem_entry_type_t filesystem_type_from_mode(mode_t mode) {
+	switch(mode & S_IFMT) {
+		case S_IFBLK:  return FILESYSTEM_ENTRY_TYPE_BLOCK;
+		case S_IFCHR:  return FILESYSTEM_ENTRY_TYPE_CHAR;
+		case S_IFDIR:  return FILESYSTEM_ENTRY_TYPE_DIR;
+		case S_IFIFO:  return FILESYSTEM_ENTRY_TYPE_FIFO;
+		case S_IFLNK:  return FILESYSTEM_ENTRY_TYPE_LINK;
+		case S_IFREG:  return FILESYSTEM_ENTRY_TYPE_FILE;
+		case S_IFSOCK: return FILESYSTEM_ENTRY_TYPE_SOCKET;
+		default:       assert(false);
+	}
+	return FILESYSTEM_ENTRY_TYPE_FILE;
+}
+
+
+/**
+ * Returns true and sets type if d_type tells the type of a directory entry, false if it has to be stat()ed.
+ */
+static bool filesystem_type_from_dirent(unsigned char d_type, filesystem_entry_type_t * type) {
+	switch(d_type) {
+		case DT_BLK:  *type = FILESYSTEM_ENTRY_TYPE_BLOCK;  return true;
+		case DT_CHR:  *type = FILESYSTEM_ENTRY_TYPE_CHAR;   return true;
+		case DT_DIR:  *type = FILESYSTEM_ENTRY_TYPE_DIR;    return true;
+		case DT_FIFO: *type = FILESYSTEM_ENTRY_TYPE_FIFO;   return true;
+		case DT_LNK:  *type = FILESYSTEM_ENTRY_TYPE_LINK;   return true;
+		case DT_REG:  *type = FILESYSTEM_ENTRY_TYPE_FILE;   return true;
+		case DT_SOCK: *type = FILESYSTEM_ENTRY_TYPE_SOCKET; return true;
+		default:      return false; // DT_UNKNOWN, some file systems don't fill in d_type
+	}
+}
+
+
+/**
+ * Fills in the metadata of entry from name relative to the directory dirfd (or an absolute path and AT_FDCWD),
+ * without following symbolic links. Only the fields compared later are requested. The size goes to size, as only
+ * regular files keep it.
+ * Returns -1 on failure (with errno set), 0 otherwise.
+ */
+static int filesystem_stat_entry(int dirfd, const char * name, filesystem_entry_internal_t * entry, off_t * size) {
+	static bool have_statx = true;
+
+	if(have_statx) {
+		struct statx info;
+		int flags = AT_SYMLINK_NOFOLLOW | ((entry->flags & FILESYSTEM_ENTRY_FLAG_NETWORK) ? AT_STATX_DONT_SYNC : AT_STATX_SYNC_AS_STAT);
+		if(statx(dirfd, name, flags, STATX_TYPE | STATX_MODE | STATX_UID | STATX_GID | STATX_MTIME | STATX_CTIME | STATX_INO | STATX_SIZE, &info) == 0) {
+			entry->mode          = info.stx_mode;
+			entry->device        = makedev(info.stx_dev_major, info.stx_dev_minor);
+			entry->inode         = info.stx_ino;
+			entry->uid           = info.stx_uid;
+			entry->gid           = info.stx_gid;
+			entry->mtime.tv_sec  = info.stx_mtime.tv_sec;
+			entry->mtime.tv_nsec = info.stx_mtime.tv_nsec;
+			entry->ctime.tv_sec  = info.stx_ctime.tv_sec;
+			entry->ctime.tv_nsec = info.stx_ctime.tv_nsec;
+			*size                = info.stx_size;
+			goto done;
+		}
+		if(errno != ENOSYS)
+			return -1;
+		have_statx = false; // kernel older than 4.11, benign if threads race on this
+	}
+
+	struct stat info;
+	if(fstatat(dirfd, name, &info, AT_SYMLINK_NOFOLLOW) != 0)
+		return -1;
+	entry->mode   = info.st_mode;
+	entry->device = info.st_dev;
+	entry->inode  = info.st_ino;
+	entry->uid    = info.st_uid;
+	entry->gid    = info.st_gid;
+	entry->mtime  = info.st_mtim;
+	entry->ctime  = info.st_ctim;
+	*size         = info.st_size;
+
+done:
+	entry->flags |= FILESYSTEM_ENTRY_FLAG_STATTED;
+	return 0;
+}
+
+
+/**
+ * Returns the path of entry in buffer if it fits, and in memory to be freed otherwise, so the paths rebuilt to read a
+ * directory or stat an entry don't need the heap.
+ */
+static char * filesystem_entry_path_in(const filesystem_entry_internal_t * entry, char * buffer, size_t size) {
+	size_t length = filesystem_entry_copy_path((const struct filesystem_entry_t *)entry, buffer, size);
+	if(length < size)
+		return buffer;
+
+	char * path = (char *)malloc(length + 1); // 1 for terminating '\0'-byte
+	assert(path != NULL);
+	filesystem_entry_copy_path((const struct filesystem_entry_t *)entry, path, length + 1);
+	return path;
+}
+
+
+/**
+ * Closes the descriptors kept by filesystem_entry_get_parent_fd from depth on.
+ */
+static void filesystem_drop_parent_fds(filesystem_internal_t * fs, size_t depth) {
+	while(fs->parents_count > depth)
+		close(fs->parents[--fs->parents_count].fd);
+}
+
+
+/**
+ * Returns a descriptor of the directory entry is in, so entries are statted and links read on demand relative to
+ * it, without a path walk from the root for each of them. The descriptors of all directories down to the last
+ * one are kept: entries are asked for in path order, so mostly the directory is among them, and otherwise only
+ * the components below the deepest one it has in common are opened, each relative to the one above.
+ * Not to be used during a scan. Returns -1 on failure (with errno set).
+ */
+static int filesystem_entry_get_parent_fd(const filesystem_entry_internal_t * entry) {
+	if(entry->parent == NULL)
+		return AT_FDCWD; // the root, statted as "/"
+
+	filesystem_internal_t * fs    = filesystem_entry_get_filesystem(entry);
+	size_t                  depth = 0; // of the parent, the root being at 0
+	for(const filesystem_entry_internal_t * it = entry->parent; it->parent != NULL; it = it->parent)
+		depth++;
+	if(depth >= fs->parents_allocated) {
+		fs->parents_allocated = 2 * depth + 16;
+		fs->parents           = (filesystem_parent_t *)realloc(fs->parents, fs->parents_allocated * sizeof(filesystem_parent_t));
+		assert(fs->parents != NULL);
+	}
+
+	// the ancestors not kept are noted top down, then the kept ones are compared up to the first match
+	const filesystem_entry_internal_t * it    = entry->parent;
+	size_t                              level = depth + 1;
+	for(; level > fs->parents_count; level--, it = it->parent)
+		fs->parents[level - 1].entry = it;
+	for(; level > 0 && fs->parents[level - 1].entry != it; level--, it = it->parent)
+		fs->parents[level - 1].entry = it;
+	filesystem_drop_parent_fds(fs, level);
+
+	for(; fs->parents_count <= depth; fs->parents_count++) {
+		filesystem_parent_t * parent = &fs->parents[fs->parents_count];
+		if(fs->parents_count == 0)
+			parent->fd = open("/", O_PATH | O_DIRECTORY | O_CLOEXEC);
+		else
+			parent->fd = openat(fs->parents[fs->parents_count - 1].fd, parent->entry->name, O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		if(parent->fd == -1)
+			return -1;
+	}
+	return fs->parents[depth].fd;
+}
+
+
+/**
+ * Stats an entry on first access to its metadata.
+ */
+static void filesystem_entry_ensure_statted(const filesystem_entry_internal_t * entry) {
+	if(entry->flags & FILESYSTEM_ENTRY_FLAG_STATTED)
+		return;
+
+	filesystem_entry_internal_t * priv = (filesystem_entry_internal_t *)entry;
+	int                           fd   = filesystem_entry_get_parent_fd(entry);
+	off_t                         size;
+	if(fd == -1 || filesystem_stat_entry(fd, (entry->parent != NULL ? entry->name : "/"), priv, &size) != 0) {
+		if(errno != ENOENT && errno != ENOTDIR) {
+			perror("lstat");
+			exit(EXIT_FAILURE);
+		}
+		// removed since its directory was read: the metadata stays as it was (zeroed if never read) until the
+		// directory is read again, and must not be compared
+		size         = (priv->type == FILESYSTEM_ENTRY_TYPE_FILE ? priv->data.file.size : 0);
+		priv->flags |= FILESYSTEM_ENTRY_FLAG_STATTED | FILESYSTEM_ENTRY_FLAG_VANISHED;
+	}
+
+	// the type is kept as it was read from the directory, even if the entry was replaced since
+	if(priv->type == FILESYSTEM_ENTRY_TYPE_FILE)
+		priv->data.file.size = (S_ISREG(priv->mode) ? size : 0);
+}
+
+
+static int64_t filesystem_timespec_to_ns(struct timespec ts) {
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static struct timespec filesystem_ns_to_timespec(int64_t ns) {
+	struct timespec ts;
+	ts.tv_sec  = ns / 1000000000;
+	ts.tv_nsec = ns % 1000000000;
+	if(ts.tv_nsec < 0) {
+		ts.tv_sec--;
+		ts.tv_nsec += 1000000000;
+	}
+	return ts;
+}
+
+
+/**
+ * Takes the children of a directory from the snapshot if its device, inode, mtime and ctime, just statted, are the
+ * recorded ones: adding, removing or renaming a child changes the times of the directory, changing a child doesn't.
+ * So the children are statted on first access like read ones, unless the snapshot is trusted, in which case their
+ * recorded metadata and link targets are taken as well. Names and targets point into the mapping.
+ * Returns false if the directory has to be read.
+ */
+static bool filesystem_entry_reuse_snapshot(const filesystem_internal_t * fs, filesystem_entry_internal_t * entry, bool network) {
+	uint32_t index = entry->data.dir.snapshot;
+	if(index == FILESYSTEM_SNAPSHOT_NONE)
+		return false;
+
+	const filesystem_snapshot_directory_t * directory = &fs->snapshot_directories[index];
+	if(directory->device != entry->device || directory->inode != entry->inode ||
+	   directory->mtime != filesystem_timespec_to_ns(entry->mtime) || directory->ctime != filesystem_timespec_to_ns(entry->ctime))
+		return false;
+
+	// lookups rely on the children being sorted
+	const filesystem_snapshot_entry_t * records = &fs->snapshot_entries[directory->first_child];
+	for(uint32_t i = 1; i < directory->children_count; i++) {
+		if(strcmp(fs->snapshot_names + records[i - 1].name, fs->snapshot_names + records[i].name) >= 0)
+			return false;
+	}
+
+	filesystem_entry_internal_t * children = NULL;
+	if(directory->children_count > 0)
+		children = filesystem_entry_alloc_children(entry, directory->children_count, 0);
+	for(uint32_t i = 0; i < directory->children_count; i++) {
+		const filesystem_snapshot_entry_t * record = &records[i];
+		filesystem_entry_internal_t *       child  = &children[i];
+		memset(child, 0, sizeof(filesystem_entry_internal_t));
+		child->parent = entry;
+		child->name   = fs->snapshot_names + record->name;
+		child->type   = record->type;
+		child->flags  = (network ? FILESYSTEM_ENTRY_FLAG_NETWORK : 0) | (entry->flags & FILESYSTEM_ENTRY_FLAG_OWNED);
+
+		if(fs->snapshot_trusted && (record->flags & FILESYSTEM_ENTRY_FLAG_STATTED)) {
+			child->device = record->device;
+			child->inode  = record->inode;
+			child->mode   = record->mode;
+			child->uid    = record->uid;
+			child->gid    = record->gid;
+			child->mtime  = filesystem_ns_to_timespec(record->mtime);
+			child->ctime  = filesystem_ns_to_timespec(record->ctime);
+			child->flags |= FILESYSTEM_ENTRY_FLAG_STATTED;
+			if(child->type == FILESYSTEM_ENTRY_TYPE_FILE)
+				child->data.file.size = record->size;
+		}
+
+		if(child->type == FILESYSTEM_ENTRY_TYPE_DIR)
+			child->data.dir.snapshot = record->directory;
+		else if(child->type == FILESYSTEM_ENTRY_TYPE_LINK && fs->snapshot_trusted && record->target != FILESYSTEM_SNAPSHOT_NONE) {
+			child->data.link.target = (char *)fs->snapshot_names + record->target;
+			child->flags           &= ~FILESYSTEM_ENTRY_FLAG_OWNED; // the target is in the mapping
+		}
+	}
+
+	entry->data.dir.children       = children;
+	entry->data.dir.children_count = directory->children_count;
+	entry->flags                  |= FILESYSTEM_ENTRY_FLAG_EVALUATED | FILESYSTEM_ENTRY_FLAG_REUSED;
+	return true;
+}
+
+
+/**
+ * Finds the records of the subdirectories of a directory that had to be read by merging its sorted children with
+ * the recorded ones, so their children can still be taken from the snapshot.
+ */
+static void filesystem_entry_link_snapshot(const filesystem_internal_t * fs, const filesystem_entry_internal_t * entry, filesystem_entry_internal_t * children, size_t children_count) {
+	uint32_t index = entry->data.dir.snapshot;
+	if(index == FILESYSTEM_SNAPSHOT_NONE)
+		return;
+
+	const filesystem_snapshot_directory_t * directory = &fs->snapshot_directories[index];
+	const filesystem_snapshot_entry_t *     records   = &fs->snapshot_entries[directory->first_child];
+	size_t                                  i         = 0,
+	                                        j         = 0;
+	while(i < children_count && j < directory->children_count) {
+		int cmp = strcmp(children[i].name, fs->snapshot_names + records[j].name);
+		if(cmp < 0)
+			i++;
+		else if(cmp > 0)
+			j++;
+		else {
+			if(children[i].type == FILESYSTEM_ENTRY_TYPE_DIR && records[j].type == FILESYSTEM_ENTRY_TYPE_DIR)
+				children[i].data.dir.snapshot = records[j].directory;
+			i++;
+			j++;
+		}
+	}
+}
+
+
 static void filesystem_entry_expand(filesystem_entry_internal_t * entry) {
-	if(entry->type != FILESYSTEM_ENTRY_TYPE_DIR || entry->data.dir.children_evaluated)
+	if(entry->type != FILESYSTEM_ENTRY_TYPE_DIR || (entry->flags & FILESYSTEM_ENTRY_FLAG_EVALUATED))
 		return;
 
-	char * path = filesystem_entry_get_path((struct filesystem_entry_t *)entry);
+	char   buffer[PATH_MAX];
+	char * path = filesystem_entry_path_in(entry, buffer, sizeof(buffer));
 
-	DIR * dirp = opendir(path);
+	// all children are looked up relative to the directory, without a path walk from the root for each of them
+	int   fd   = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	DIR * dirp = (fd != -1 ? fdopendir(fd) : NULL);
 	if(dirp == NULL) {
 		if(errno == EACCES) {
 			fprintf(stderr, "error: permission denied `%s'\n", path);
+			if(fd != -1)
+				close(fd);
+			if(path != buffer)
+				free(path);
+			return;
+		}
+		else if(errno == ENOENT || errno == ENOTDIR) {
+			// removed or replaced since its parent was read
+			entry->data.dir.children       = NULL;
+			entry->data.dir.children_count = 0;
+			entry->flags                  |= FILESYSTEM_ENTRY_FLAG_EVALUATED;
+			if(fd != -1)
+				close(fd);
+			if(path != buffer)
+				free(path);
 			return;
 		}
 		else {
@@ -206,12 +883,33 @@ static void filesystem_entry_expand(filesystem_entry_internal_t * entry) {
 			exit(EXIT_FAILURE);
 		}
 	}
+	bool network = filesystem_is_network(fd);
+
+	// with a snapshot, the times of the directory itself tell whether its children can be taken from there; they
+	// are read before the children, so a change while reading shows up on the next run
+	filesystem_internal_t * fs = filesystem_entry_get_filesystem(entry);
+	if(fs->snapshot_enabled) {
+		off_t size;
+		if(filesystem_stat_entry(fd, ".", entry, &size) != 0) {
+			perror("lstat");
+			exit(EXIT_FAILURE);
+		}
+		if(filesystem_entry_reuse_snapshot(fs, entry, network)) {
+			closedir(dirp);
+			if(path != buffer)
+				free(path);
+			return;
+		}
+	}
 
-	// pre-allocate some memory for the child entries
-	size_t children_allocated = 16;
-	entry->data.dir.children       = (filesystem_entry_internal_t **)malloc(children_allocated * sizeof(filesystem_entry_internal_t *));
-	entry->data.dir.children_count = 0;
-	assert(entry->data.dir.children != NULL);
+	// the children are collected in scratch memory first, and copied to the arena in one piece once sorted
+	size_t                        children_allocated = 16,
+	                              children_count     = 0,
+	                              names_allocated    = 256,
+	                              names_size         = 0;
+	filesystem_entry_internal_t * children           = (filesystem_entry_internal_t *)malloc(children_allocated * sizeof(filesystem_entry_internal_t));
+	char *                        names              = (char *)malloc(names_allocated);
+	assert(children != NULL && names != NULL);
 
 	while(true) {
 		errno = 0;
@@ -224,79 +922,563 @@ static void filesystem_entry_expand(filesystem_entry_internal_t * entry) {
 		if(strcmp(dp->d_name, ".") == 0 || strcmp(dp->d_name, "..") == 0)
 			continue;
 
-		char * childpath;
-		int result = asprintf(&childpath, "%s/%s", path, dp->d_name);
-		assert(result != -1);
-
-		struct stat info;
-		result = lstat(childpath, &info);
-		if(result != 0) {
-			perror("lstat");
-			exit(EXIT_FAILURE);
+		if(children_count == children_allocated) {
+			children_allocated *= 2;
+			children = (filesystem_entry_internal_t *)realloc(children, children_allocated * sizeof(filesystem_entry_internal_t));
+			assert(children != NULL);
+		}
+		size_t length = strlen(dp->d_name) + 1; // 1 for terminating '\0'-byte
+		while(names_size + length > names_allocated) {
+			names_allocated *= 2;
+			names = (char *)realloc(names, names_allocated);
+			assert(names != NULL);
 		}
+		memcpy(names + names_size, dp->d_name, length);
 
-		filesystem_entry_internal_t * child = (filesystem_entry_internal_t *)malloc(sizeof(filesystem_entry_internal_t));
+		filesystem_entry_internal_t * child = &children[children_count++];
+		memset(child, 0, sizeof(filesystem_entry_internal_t));
 		child->parent = entry;
-		// child->prev & child->next will be set further down, after sorting is done
-		switch(info.st_mode & S_IFMT) {
-			case S_IFBLK:  child->type = FILESYSTEM_ENTRY_TYPE_BLOCK;  break;
-			case S_IFCHR:  child->type = FILESYSTEM_ENTRY_TYPE_CHAR;   break;
-			case S_IFDIR:  child->type = FILESYSTEM_ENTRY_TYPE_DIR;    break;
-			case S_IFIFO:  child->type = FILESYSTEM_ENTRY_TYPE_FIFO;   break;
-			case S_IFLNK:  child->type = FILESYSTEM_ENTRY_TYPE_LINK;   break;
-			case S_IFREG:  child->type = FILESYSTEM_ENTRY_TYPE_FILE;   break;
-			case S_IFSOCK: child->type = FILESYSTEM_ENTRY_TYPE_SOCKET; break;
-			default:       assert(false);                              break;
-		}
-		child->name      = strdup(dp->d_name);
-		child->mode      = info.st_mode;
-		child->uid       = info.st_uid;
-		child->gid       = info.st_gid;
-		child->mtime     = info.st_mtime;
-		child->user_data = NULL;
+		child->name   = (const char *)(uintptr_t)names_size; // an offset until names stops moving
+		child->flags  = (network ? FILESYSTEM_ENTRY_FLAG_NETWORK : 0) | (entry->flags & FILESYSTEM_ENTRY_FLAG_OWNED);
+		names_size   += length;
+
+		// metadata is only read when asked for, unless the file system doesn't tell the type
+		filesystem_entry_type_t type;
+		if(filesystem_type_from_dirent(dp->d_type, &type))
+			child->type = type;
+		else {
+			off_t size;
+			if(filesystem_stat_entry(fd, dp->d_name, child, &size) != 0) {
+				perror("lstat");
+				exit(EXIT_FAILURE);
+			}
+			child->type = filesystem_type_from_mode(child->mode);
+			if(child->type == FILESYSTEM_ENTRY_TYPE_FILE)
+				child->data.file.size = size;
+		}
+		// directories start out unevaluated and links without target, both by the memset above
 		if(child->type == FILESYSTEM_ENTRY_TYPE_DIR)
-			child->data.dir.children_evaluated = false;
-		else if(child->type == FILESYSTEM_ENTRY_TYPE_FILE)
-			child->data.file.size = info.st_size;
-		else if(child->type == FILESYSTEM_ENTRY_TYPE_LINK)
-			child->data.link.target = readlink_malloc(childpath, info.st_size);
+			child->data.dir.snapshot = FILESYSTEM_SNAPSHOT_NONE;
+	}
 
-		if(entry->data.dir.children_count == children_allocated) {
-			children_allocated *= 2;
-			entry->data.dir.children = (filesystem_entry_internal_t **)realloc(entry->data.dir.children, children_allocated * sizeof(filesystem_entry_internal_t *));
-			assert(entry->data.dir.children != NULL);
+	closedir(dirp); // closes fd as well
+
+	// sort all children by name to allow for binary search
+	for(size_t i = 0; i < children_count; i++)
+		children[i].name = names + (uintptr_t)children[i].name;
+	qsort(children, children_count, sizeof(filesystem_entry_internal_t), (int (*)(const void *, const void *))compare_entries);
+	if(fs->snapshot_enabled)
+		filesystem_entry_link_snapshot(fs, entry, children, children_count);
+
+	if(children_count > 0) {
+		entry->data.dir.children = filesystem_entry_alloc_children(entry, children_count, names_size);
+		char * stored_names = (char *)(entry->data.dir.children + children_count);
+		memcpy(stored_names, names, names_size);
+		for(size_t i = 0; i < children_count; i++)
+			children[i].name = stored_names + (children[i].name - names);
+		memcpy(entry->data.dir.children, children, children_count * sizeof(filesystem_entry_internal_t));
+	}
+	else
+		entry->data.dir.children = NULL;
+	assert(children_count <= UINT32_MAX);
+	entry->data.dir.children_count = children_count;
+	entry->flags |= FILESYSTEM_ENTRY_FLAG_EVALUATED;
+
+	free(names);
+	free(children);
+	if(path != buffer)
+		free(path);
+}
+
+
+/**
+ * Directories waiting to be expanded by one scan thread. The owner pushes and pops at the tail, idle threads steal
+ * from the head, so a thief takes the oldest and usually largest subtree.
+ */
+typedef struct {
+	pthread_mutex_t                mutex;
+	filesystem_entry_internal_t ** entries;
+	size_t                         head;
+	size_t                         tail;
+	size_t                         allocated;
+} filesystem_deque_t;
+
+
+typedef struct {
+	filesystem_deque_t * deques;
+	size_t               threads_count;
+	filesystem_fn_skip   fn;
+	void *               user_data;
+
+	pthread_mutex_t      mutex;
+	pthread_cond_t       work_available;
+	size_t               pending;    // directories queued or being expanded; the scan is done when this drops to 0
+	size_t               generation; // bumped whenever directories are queued, so idle threads don't miss them
+} filesystem_scan_t;
+
+
+typedef struct {
+	filesystem_scan_t * scan;
+	size_t              index;
+} filesystem_scan_thread_t;
+
+
+static void filesystem_deque_push(filesystem_deque_t * deque, filesystem_entry_internal_t * entry) {
+	pthread_mutex_lock(&deque->mutex);
+	if(deque->tail == deque->allocated) {
+		// reclaim the space of stolen entries before growing
+		memmove(deque->entries, deque->entries + deque->head, (deque->tail - deque->head) * sizeof(filesystem_entry_internal_t *));
+		deque->tail -= deque->head;
+		deque->head  = 0;
+		if(deque->tail == deque->allocated) {
+			deque->allocated *= 2;
+			deque->entries    = (filesystem_entry_internal_t **)realloc(deque->entries, deque->allocated * sizeof(filesystem_entry_internal_t *));
+			assert(deque->entries != NULL);
 		}
-		assert(entry->data.dir.children_count < children_allocated);
-		entry->data.dir.children[entry->data.dir.children_count] = child;
-		entry->data.dir.children_count++;
+	}
+	deque->entries[deque->tail++] = entry;
+	pthread_mutex_unlock(&deque->mutex);
+}
+
+
+static filesystem_entry_internal_t * filesystem_deque_take(filesystem_deque_t * deque, bool steal) {
+	filesystem_entry_internal_t * entry = NULL;
+	pthread_mutex_lock(&deque->mutex);
+	if(deque->head < deque->tail)
+		entry = (steal ? deque->entries[deque->head++] : deque->entries[--deque->tail]);
+	pthread_mutex_unlock(&deque->mutex);
+	return entry;
+}
+
+
+static void * filesystem_scan_thread(void * arg) {
+	filesystem_scan_thread_t * thread = (filesystem_scan_thread_t *)arg;
+	filesystem_scan_t *        scan   = thread->scan;
+	filesystem_deque_t *       own    = &scan->deques[thread->index];
 
-		free(childpath);
+	while(true) {
+		pthread_mutex_lock(&scan->mutex);
+		size_t generation = scan->generation;
+		pthread_mutex_unlock(&scan->mutex);
+
+		// own work first, then steal from the others
+		filesystem_entry_internal_t * entry = filesystem_deque_take(own, false);
+		for(size_t i = 1; entry == NULL && i < scan->threads_count; i++)
+			entry = filesystem_deque_take(&scan->deques[(thread->index + i) % scan->threads_count], true);
+
+		if(entry == NULL) {
+			pthread_mutex_lock(&scan->mutex);
+			if(scan->pending == 0) {
+				pthread_mutex_unlock(&scan->mutex);
+				break;
+			}
+			if(scan->generation == generation)
+				pthread_cond_wait(&scan->work_available, &scan->mutex);
+			pthread_mutex_unlock(&scan->mutex);
+			continue;
+		}
+
+		filesystem_entry_expand(entry);
+
+		size_t queued = 0;
+		if(entry->flags & FILESYSTEM_ENTRY_FLAG_EVALUATED) {
+			for(uint32_t i = 0; i < entry->data.dir.children_count; i++) {
+				filesystem_entry_internal_t * child = &entry->data.dir.children[i];
+				if(child->type != FILESYSTEM_ENTRY_TYPE_DIR)
+					continue;
+				if(scan->fn != NULL && scan->fn((struct filesystem_entry_t *)child, scan->user_data))
+					continue;
+				filesystem_deque_push(own, child);
+				queued++;
+			}
+		}
+
+		pthread_mutex_lock(&scan->mutex);
+		scan->pending += queued;
+		scan->pending--;
+		if(queued > 0) {
+			scan->generation++;
+			pthread_cond_broadcast(&scan->work_available);
+		}
+		else if(scan->pending == 0)
+			pthread_cond_broadcast(&scan->work_available);
+		pthread_mutex_unlock(&scan->mutex);
 	}
 
-	// shrink the allocated memory to free up some space
-	if(entry->data.dir.children_count == 0) {
-		free(entry->data.dir.children);
-		entry->data.dir.children = NULL;
+	return NULL;
+}
+
+
+void filesystem_scan(struct filesystem_t * handle, size_t threads, filesystem_fn_skip fn, void * user_data) {
+	filesystem_internal_t * priv = (filesystem_internal_t *)handle;
+	if(threads == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = (cpus > 0 ? cpus : 1);
+	}
+
+	filesystem_scan_t scan;
+	scan.deques        = (filesystem_deque_t *)malloc(threads * sizeof(filesystem_deque_t));
+	scan.threads_count = threads;
+	scan.fn            = fn;
+	scan.user_data     = user_data;
+	scan.pending       = 1; // the root
+	scan.generation    = 0;
+	pthread_mutex_init(&scan.mutex, NULL);
+	pthread_cond_init(&scan.work_available, NULL);
+	assert(scan.deques != NULL);
+	for(size_t i = 0; i < threads; i++) {
+		pthread_mutex_init(&scan.deques[i].mutex, NULL);
+		scan.deques[i].allocated = 64;
+		scan.deques[i].entries   = (filesystem_entry_internal_t **)malloc(scan.deques[i].allocated * sizeof(filesystem_entry_internal_t *));
+		scan.deques[i].head      = 0;
+		scan.deques[i].tail      = 0;
+		assert(scan.deques[i].entries != NULL);
+	}
+	filesystem_deque_push(&scan.deques[0], &priv->root);
+
+	pthread_t *                tids        = (pthread_t *)malloc(threads * sizeof(pthread_t));
+	filesystem_scan_thread_t * thread_args = (filesystem_scan_thread_t *)malloc(threads * sizeof(filesystem_scan_thread_t));
+	assert(tids != NULL && thread_args != NULL);
+	for(size_t i = 0; i < threads; i++) {
+		thread_args[i].scan  = &scan;
+		thread_args[i].index = i;
+		if(pthread_create(&tids[i], NULL, filesystem_scan_thread, &thread_args[i]) != 0) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+	for(size_t i = 0; i < threads; i++)
+		pthread_join(tids[i], NULL);
+
+	for(size_t i = 0; i < threads; i++) {
+		pthread_mutex_destroy(&scan.deques[i].mutex);
+		free(scan.deques[i].entries);
+	}
+	pthread_cond_destroy(&scan.work_available);
+	pthread_mutex_destroy(&scan.mutex);
+	free(thread_args);
+	free(tids);
+	free(scan.deques);
+}
+
+
+void filesystem_entry_invalidate(struct filesystem_entry_t * entry) {
+	filesystem_entry_internal_t * priv = (filesystem_entry_internal_t *)entry;
+	filesystem_internal_t *       fs   = filesystem_entry_get_filesystem(priv);
+	filesystem_drop_parent_fds(fs, 0);
+	priv->flags &= ~(FILESYSTEM_ENTRY_FLAG_STATTED | FILESYSTEM_ENTRY_FLAG_VANISHED);
+	if(priv->type == FILESYSTEM_ENTRY_TYPE_LINK) {
+		filesystem_entry_release(priv);
+		priv->flags |= FILESYSTEM_ENTRY_FLAG_OWNED;
+		fs->owned    = true;
+	}
+}
+
+
+void filesystem_entry_forget(struct filesystem_entry_t * entry) {
+	filesystem_entry_internal_t * priv = (filesystem_entry_internal_t *)entry;
+	filesystem_internal_t *       fs   = filesystem_entry_get_filesystem(priv);
+	filesystem_entry_invalidate(entry);
+	if(priv->type != FILESYSTEM_ENTRY_TYPE_DIR)
+		return;
+
+	filesystem_entry_release(priv);
+	priv->data.dir.snapshot = FILESYSTEM_SNAPSHOT_NONE;
+	if(priv->parent == NULL) {
+		// nothing refers to the arena any more, the tree is read into a new one
+		filesystem_free_arena(fs);
+		priv->flags &= ~FILESYSTEM_ENTRY_FLAG_OWNED;
+		fs->owned    = false;
 	}
 	else {
-		entry->data.dir.children = (filesystem_entry_internal_t **)realloc(entry->data.dir.children, entry->data.dir.children_count * sizeof(filesystem_entry_internal_t *));
-		assert(entry->data.dir.children != NULL);
+		priv->flags |= FILESYSTEM_ENTRY_FLAG_OWNED;
+		fs->owned    = true;
 	}
+}
 
-	// sort all children by name to allow for binary search
-	qsort(entry->data.dir.children, entry->data.dir.children_count, sizeof(filesystem_entry_internal_t *), (int (*)(const void *, const void *))compare_entries);
 
-	// establish sibling links between all children
-	for(size_t i = 0; i < entry->data.dir.children_count; i++) {
-		entry->data.dir.children[i]->prev = (i == 0                                  ? NULL : entry->data.dir.children[i - 1]);
-		entry->data.dir.children[i]->next = (i == entry->data.dir.children_count - 1 ? NULL : entry->data.dir.children[i + 1]);
+void filesystem_entry_refresh(struct filesystem_entry_t * entry) {
+	filesystem_entry_internal_t * priv = (filesystem_entry_internal_t *)entry;
+	if(priv->type != FILESYSTEM_ENTRY_TYPE_DIR || !(priv->flags & FILESYSTEM_ENTRY_FLAG_EVALUATED))
+		return; // read on first access anyway
+
+	// the old children are only released once the nodes that stay have been taken over
+	filesystem_internal_t *       fs           = filesystem_entry_get_filesystem(priv);
+	filesystem_entry_internal_t * old_children = priv->data.dir.children;
+	uint32_t                      old_count    = priv->data.dir.children_count;
+	bool                          old_owned    = (priv->flags & FILESYSTEM_ENTRY_FLAG_OWNED);
+	filesystem_entry_invalidate(entry);
+	priv->data.dir.children       = NULL;
+	priv->data.dir.children_count = 0;
+	priv->data.dir.snapshot       = FILESYSTEM_SNAPSHOT_NONE;
+	priv->flags                   = (priv->flags & ~(FILESYSTEM_ENTRY_FLAG_EVALUATED | FILESYSTEM_ENTRY_FLAG_REUSED)) | FILESYSTEM_ENTRY_FLAG_OWNED;
+	fs->owned                     = true;
+	filesystem_entry_expand(priv);
+
+	// children with the same name and type as before keep their node, and with it their subtree and tracked flag;
+	// the name is the new copy, as the old one goes with the old children
+	filesystem_entry_internal_t * children = priv->data.dir.children;
+	uint32_t                      i        = 0,
+	                              j        = 0;
+	while((priv->flags & FILESYSTEM_ENTRY_FLAG_EVALUATED) && i < priv->data.dir.children_count && j < old_count) {
+		int cmp = strcmp(children[i].name, old_children[j].name);
+		if(cmp < 0)
+			i++;
+		else if(cmp > 0)
+			j++;
+		else {
+			if(children[i].type == old_children[j].type) {
+				const char * name = children[i].name;
+				children[i]      = old_children[j];
+				children[i].name = name;
+				if(children[i].type == FILESYSTEM_ENTRY_TYPE_DIR && (children[i].flags & FILESYSTEM_ENTRY_FLAG_EVALUATED)) {
+					for(uint32_t k = 0; k < children[i].data.dir.children_count; k++)
+						children[i].data.dir.children[k].parent = &children[i];
+				}
+				// what the node owns has moved, so releasing the old one leaves it alone
+				memset(&old_children[j].data, 0, sizeof(old_children[j].data));
+				old_children[j].flags &= ~FILESYSTEM_ENTRY_FLAG_EVALUATED;
+			}
+			i++;
+			j++;
+		}
+	}
+
+	for(uint32_t k = 0; k < old_count; k++)
+		filesystem_entry_release(&old_children[k]);
+	if(old_owned)
+		free(old_children);
+}
+
+
+/**
+ * Checks that every index and offset of a mapped snapshot is in bounds, and that the children of a directory come
+ * after the entry it is recorded for, which rules out cycles.
+ */
+static bool filesystem_snapshot_is_valid(const void * map, size_t size) {
+	const filesystem_snapshot_header_t * header = (const filesystem_snapshot_header_t *)map;
+	if(size < sizeof(filesystem_snapshot_header_t) || memcmp(header->magic, FILESYSTEM_SNAPSHOT_MAGIC, sizeof(FILESYSTEM_SNAPSHOT_MAGIC)) != 0)
+		return false;
+
+	uint64_t records_size = (uint64_t)header->directories_count * sizeof(filesystem_snapshot_directory_t) +
+	                        (uint64_t)header->entries_count * sizeof(filesystem_snapshot_entry_t);
+	if(header->names_size > size || sizeof(filesystem_snapshot_header_t) + records_size + header->names_size != size)
+		return false;
+
+	const filesystem_snapshot_directory_t * directories = (const filesystem_snapshot_directory_t *)(header + 1);
+	const filesystem_snapshot_entry_t *     entries     = (const filesystem_snapshot_entry_t *)(directories + header->directories_count);
+	const char *                            names       = (const char *)(entries + header->entries_count);
+	if(header->entries_count == 0 || header->names_size == 0 || names[header->names_size - 1] != '\0')
+		return false;
+
+	for(uint32_t i = 0; i < header->directories_count; i++) {
+		if((uint64_t)directories[i].first_child + directories[i].children_count > header->entries_count)
+			return false;
+	}
+	for(uint32_t i = 0; i < header->entries_count; i++) {
+		const filesystem_snapshot_entry_t * entry = &entries[i];
+		if(entry->name >= header->names_size || entry->type > FILESYSTEM_ENTRY_TYPE_SOCKET)
+			return false;
+		if(entry->target != FILESYSTEM_SNAPSHOT_NONE && entry->target >= header->names_size)
+			return false;
+		if(entry->directory != FILESYSTEM_SNAPSHOT_NONE) {
+			if(entry->type != FILESYSTEM_ENTRY_TYPE_DIR || entry->directory >= header->directories_count)
+				return false;
+			const filesystem_snapshot_directory_t * directory = &directories[entry->directory];
+			if(directory->children_count > 0 && directory->first_child <= i)
+				return false;
+		}
+	}
+	return true;
+}
+
+
+void filesystem_load_snapshot(struct filesystem_t * handle, const char * path, bool trusted) {
+	filesystem_internal_t * priv = (filesystem_internal_t *)handle;
+	assert(!(priv->root.flags & FILESYSTEM_ENTRY_FLAG_EVALUATED));
+
+	priv->snapshot_enabled = true;
+	priv->snapshot_trusted = trusted;
+	clock_gettime(CLOCK_REALTIME, &priv->snapshot_started);
+
+	// without a (valid) snapshot every directory is read, and its times recorded for the next run
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd == -1)
+		return;
+	struct stat info;
+	void *      map = MAP_FAILED;
+	if(fstat(fd, &info) == 0 && info.st_size > 0)
+		map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+		return;
+	if(!filesystem_snapshot_is_valid(map, info.st_size)) {
+		munmap(map, info.st_size);
+		return;
+	}
+
+	const filesystem_snapshot_header_t * header = (const filesystem_snapshot_header_t *)map;
+	priv->snapshot               = map;
+	priv->snapshot_size          = info.st_size;
+	priv->snapshot_directories   = (const filesystem_snapshot_directory_t *)(header + 1);
+	priv->snapshot_entries       = (const filesystem_snapshot_entry_t *)(priv->snapshot_directories + header->directories_count);
+	priv->snapshot_names         = (const char *)(priv->snapshot_entries + header->entries_count);
+	priv->root.data.dir.snapshot = priv->snapshot_entries[0].directory;
+}
+
+
+/**
+ * Appends a string to the names of a snapshot being saved.
+ * Returns its offset, or FILESYSTEM_SNAPSHOT_NONE if the names grew too large.
+ */
+static uint32_t filesystem_snapshot_add_name(char ** names, size_t * names_size, size_t * names_allocated, const char * name) {
+	size_t length = strlen(name) + 1; // 1 for terminating '\0'-byte
+	if(*names_size + length >= FILESYSTEM_SNAPSHOT_NONE)
+		return FILESYSTEM_SNAPSHOT_NONE;
+	while(*names_size + length > *names_allocated) {
+		*names_allocated *= 2;
+		*names = (char *)realloc(*names, *names_allocated);
+		assert(*names != NULL);
+	}
+	memcpy(*names + *names_size, name, length);
+	*names_size += length;
+	return *names_size - length;
+}
+
+
+int filesystem_save_snapshot(struct filesystem_t * handle, const char * path) {
+	filesystem_internal_t * priv = (filesystem_internal_t *)handle;
+
+	// entries are recorded breadth first, which keeps the children of each directory contiguous; nodes holds the
+	// entry behind each record
+	size_t                                nodes_allocated       = 1024,
+	                                      nodes_count           = 1,
+	                                      directories_allocated = 256,
+	                                      directories_count     = 0,
+	                                      names_allocated       = 4096,
+	                                      names_size            = 0;
+	const filesystem_entry_internal_t **  nodes                 = (const filesystem_entry_internal_t **)malloc(nodes_allocated * sizeof(filesystem_entry_internal_t *));
+	filesystem_snapshot_entry_t *         entries               = (filesystem_snapshot_entry_t *)malloc(nodes_allocated * sizeof(filesystem_snapshot_entry_t));
+	filesystem_snapshot_directory_t *     directories           = (filesystem_snapshot_directory_t *)malloc(directories_allocated * sizeof(filesystem_snapshot_directory_t));
+	char *                                names                 = (char *)malloc(names_allocated);
+	assert(nodes != NULL && entries != NULL && directories != NULL && names != NULL);
+	nodes[0] = &priv->root;
+
+	// a directory changed in the second the run started may change again without its times moving on, like a racily
+	// clean file in git; its record is kept for its subdirectories, but never matches
+	int64_t racy = filesystem_timespec_to_ns(priv->snapshot_started) / 1000000000 * 1000000000;
+
+	bool ok = true;
+	for(size_t i = 0; ok && i < nodes_count; i++) {
+		const filesystem_entry_internal_t * node  = nodes[i];
+		filesystem_snapshot_entry_t *       entry = &entries[i];
+		memset(entry, 0, sizeof(filesystem_snapshot_entry_t));
+		entry->name      = filesystem_snapshot_add_name(&names, &names_size, &names_allocated, node->name);
+		entry->target    = FILESYSTEM_SNAPSHOT_NONE;
+		entry->directory = FILESYSTEM_SNAPSHOT_NONE;
+		entry->type      = node->type;
+		ok               = (entry->name != FILESYSTEM_SNAPSHOT_NONE);
+
+		if(node->flags & FILESYSTEM_ENTRY_FLAG_STATTED) {
+			entry->device = node->device;
+			entry->inode  = node->inode;
+			entry->mtime  = filesystem_timespec_to_ns(node->mtime);
+			entry->ctime  = filesystem_timespec_to_ns(node->ctime);
+			entry->mode   = node->mode;
+			entry->uid    = node->uid;
+			entry->gid    = node->gid;
+			entry->flags  = FILESYSTEM_ENTRY_FLAG_STATTED;
+			if(node->type == FILESYSTEM_ENTRY_TYPE_FILE)
+				entry->size = node->data.file.size;
+		}
+
+		if(node->type == FILESYSTEM_ENTRY_TYPE_LINK && node->data.link.target != NULL) {
+			entry->target = filesystem_snapshot_add_name(&names, &names_size, &names_allocated, node->data.link.target);
+			ok            = ok && (entry->target != FILESYSTEM_SNAPSHOT_NONE);
+		}
+
+		// only directories that were read and statted while reading have a record
+		uint32_t flags = FILESYSTEM_ENTRY_FLAG_STATTED | FILESYSTEM_ENTRY_FLAG_EVALUATED;
+		if(node->type == FILESYSTEM_ENTRY_TYPE_DIR && (node->flags & flags) == flags) {
+			if(directories_count == directories_allocated) {
+				directories_allocated *= 2;
+				directories = (filesystem_snapshot_directory_t *)realloc(directories, directories_allocated * sizeof(filesystem_snapshot_directory_t));
+				assert(directories != NULL);
+			}
+			filesystem_snapshot_directory_t * directory = &directories[directories_count];
+			directory->device         = node->device;
+			directory->inode          = node->inode;
+			directory->mtime          = entry->mtime;
+			directory->ctime          = entry->ctime;
+			directory->first_child    = nodes_count;
+			directory->children_count = node->data.dir.children_count;
+			if(directory->mtime >= racy || directory->ctime >= racy)
+				directory->mtime = directory->ctime = 0;
+			entry->directory = directories_count++;
+
+			while(nodes_count + node->data.dir.children_count > nodes_allocated) {
+				nodes_allocated *= 2;
+				nodes   = (const filesystem_entry_internal_t **)realloc(nodes, nodes_allocated * sizeof(filesystem_entry_internal_t *));
+				entries = (filesystem_snapshot_entry_t *)realloc(entries, nodes_allocated * sizeof(filesystem_snapshot_entry_t));
+				assert(nodes != NULL && entries != NULL);
+			}
+			for(uint32_t j = 0; j < node->data.dir.children_count; j++)
+				nodes[nodes_count++] = &node->data.dir.children[j];
+			ok = ok && (nodes_count < FILESYSTEM_SNAPSHOT_NONE);
+		}
+	}
+	free(nodes);
+	if(!ok) {
+		free(entries);
+		free(directories);
+		free(names);
+		errno = EOVERFLOW;
+		return -1;
 	}
 
-	entry->data.dir.children_evaluated = true;
+	// make sure the snapshot directory exists
+	char * parent = strdup(path);
+	assert(parent != NULL);
+	int result = mkdir(dirname(parent), 0755);
+	free(parent);
+
+	char * temp_path = NULL;
+	FILE * fp        = NULL;
+	bool   saved     = false;
+	if(result == 0 || errno == EEXIST) {
+		result = asprintf(&temp_path, "%s.tmp", path);
+		assert(result != -1);
+		fp = fopen(temp_path, "w");
+	}
 
-	closedir(dirp);
+	if(fp != NULL) {
+		filesystem_snapshot_header_t header;
+		memcpy(header.magic, FILESYSTEM_SNAPSHOT_MAGIC, sizeof(FILESYSTEM_SNAPSHOT_MAGIC));
+		header.directories_count = directories_count;
+		header.entries_count     = nodes_count;
+		header.names_size        = names_size;
+
+		ok = (fwrite(&header, sizeof(header), 1, fp) == 1 &&
+		      fwrite(directories, sizeof(filesystem_snapshot_directory_t), directories_count, fp) == directories_count &&
+		      fwrite(entries, sizeof(filesystem_snapshot_entry_t), nodes_count, fp) == nodes_count &&
+		      fwrite(names, 1, names_size, fp) == names_size);
+		if(fclose(fp) != 0)
+			ok = false;
+		saved = (ok && rename(temp_path, path) == 0);
+		if(!saved) {
+			int error = errno;
+			unlink(temp_path);
+			errno = error;
+		}
+	}
 
-	free(path);
+	int error = errno;
+	free(temp_path);
+	free(entries);
+	free(directories);
+	free(names);
+	errno = error;
+	return (saved ? 0 : -1);
 }
 
 
@@ -342,30 +1524,44 @@ bool filesystem_entry_is_socket(const struct filesystem_entry_t * entry) {
 
 
 char * filesystem_entry_get_path(const struct filesystem_entry_t * entry) {
-	if(filesystem_entry_is_root(entry))
-		return strdup("/");
+	size_t length = filesystem_entry_copy_path(entry, NULL, 0);
+	char * str    = (char *)malloc(length + 1); // 1 for '\0'-byte
+	assert(str != NULL);
+	filesystem_entry_copy_path(entry, str, length + 1);
+	return str;
+}
 
-	alpm_list_t * parts  = NULL;
-	size_t        length = 0;
-	while(entry != NULL && !filesystem_entry_is_root(entry)) {
-		const char * name = filesystem_entry_get_name(entry);
-		length += strlen(name) + 1; // 1 for each '/' delimiter
-		parts = alpm_list_add(parts, (void *)name);
-		entry = (const struct filesystem_entry_t *)filesystem_entry_get_parent((struct filesystem_entry_t *)entry);
+
+size_t filesystem_entry_copy_path(const struct filesystem_entry_t * entry, char * buffer, size_t size) {
+	const filesystem_entry_internal_t * priv = (const filesystem_entry_internal_t *)entry;
+	if(priv->parent == NULL) {
+		if(size >= 2)
+			memcpy(buffer, "/", 2);
+		else if(size > 0)
+			buffer[0] = '\0';
+		return 1;
 	}
 
-	char * str = (char *)malloc(length + 1); // 1 for '\0'-byte
-	size_t pos = 0;
-	for(alpm_list_t * it = alpm_list_last(parts); it != NULL; it = alpm_list_previous(it)) {
-		assert(pos + 1 + strlen((const char *)it->data) <= length);
-		str[pos] = '/';
-		strcpy(str + pos + 1, (const char *)it->data);
-		pos += 1 + strlen((const char *)it->data);
+	size_t length = 0;
+	for(const filesystem_entry_internal_t * it = priv; it->parent != NULL; it = it->parent)
+		length += strlen(it->name) + 1; // 1 for each '/' delimiter
+	if(length >= size) {
+		if(size > 0)
+			buffer[0] = '\0';
+		return length;
 	}
-	assert(pos == length);
-	str[length] = '\0';
 
-	return str;
+	// the components are known from the last one up, so the path is filled in from its end
+	size_t pos = length;
+	buffer[pos] = '\0';
+	for(const filesystem_entry_internal_t * it = priv; it->parent != NULL; it = it->parent) {
+		size_t name_length = strlen(it->name);
+		pos -= name_length;
+		memcpy(buffer + pos, it->name, name_length);
+		buffer[--pos] = '/';
+	}
+	assert(pos == 0);
+	return length;
 }
 
 
@@ -375,46 +1571,117 @@ const char * filesystem_entry_get_name(const struct filesystem_entry_t * entry)
 }
 
 
+dev_t filesystem_entry_get_device(const struct filesystem_entry_t * entry) {
+	const filesystem_entry_internal_t * priv = (const filesystem_entry_internal_t *)entry;
+	filesystem_entry_ensure_statted(priv);
+	return priv->device;
+}
+
+
+ino_t filesystem_entry_get_inode(const struct filesystem_entry_t * entry) {
+	const filesystem_entry_internal_t * priv = (const filesystem_entry_internal_t *)entry;
+	filesystem_entry_ensure_statted(priv);
+	return priv->inode;
+}
+
+
 mode_t filesystem_entry_get_mode(const struct filesystem_entry_t * entry) {
 	const filesystem_entry_internal_t * priv = (const filesystem_entry_internal_t *)entry;
+	filesystem_entry_ensure_statted(priv);
 	return priv->mode;
 }
 
 
 uid_t filesystem_entry_get_uid(const struct filesystem_entry_t * entry) {
 	const filesystem_entry_internal_t * priv = (const filesystem_entry_internal_t *)entry;
+	filesystem_entry_ensure_statted(priv);
 	return priv->uid;
 }
 
 
 gid_t filesystem_entry_get_gid(const struct filesystem_entry_t * entry) {
 	const filesystem_entry_internal_t * priv = (const filesystem_entry_internal_t *)entry;
+	filesystem_entry_ensure_statted(priv);
 	return priv->gid;
 }
 
 
 time_t filesystem_entry_get_mtime(const struct filesystem_entry_t * entry) {
 	const filesystem_entry_internal_t * priv = (const filesystem_entry_internal_t *)entry;
+	filesystem_entry_ensure_statted(priv);
+	return priv->mtime.tv_sec;
+}
+
+
+struct timespec filesystem_entry_get_mtimespec(const struct filesystem_entry_t * entry) {
+	const filesystem_entry_internal_t * priv = (const filesystem_entry_internal_t *)entry;
+	filesystem_entry_ensure_statted(priv);
 	return priv->mtime;
 }
 
 
-void * filesystem_entry_get_user_data(struct filesystem_entry_t * entry) {
+struct timespec filesystem_entry_get_ctimespec(const struct filesystem_entry_t * entry) {
+	const filesystem_entry_internal_t * priv = (const filesystem_entry_internal_t *)entry;
+	filesystem_entry_ensure_statted(priv);
+	return priv->ctime;
+}
+
+
+bool filesystem_entry_has_vanished(const struct filesystem_entry_t * entry) {
+	const filesystem_entry_internal_t * priv = (const filesystem_entry_internal_t *)entry;
+	filesystem_entry_ensure_statted(priv);
+	return (priv->flags & FILESYSTEM_ENTRY_FLAG_VANISHED);
+}
+
+
+bool filesystem_entry_is_tracked(const struct filesystem_entry_t * entry) {
+	const filesystem_entry_internal_t * priv = (const filesystem_entry_internal_t *)entry;
+	return (priv->flags & FILESYSTEM_ENTRY_FLAG_TRACKED);
+}
+
+
+void filesystem_entry_set_tracked(struct filesystem_entry_t * entry) {
 	filesystem_entry_internal_t * priv = (filesystem_entry_internal_t *)entry;
-	return priv->user_data;
+	priv->flags |= FILESYSTEM_ENTRY_FLAG_TRACKED;
 }
 
 
-void filesystem_entry_set_user_data(struct filesystem_entry_t * entry, void * user_data) {
+void filesystem_entry_clear_tracked(struct filesystem_entry_t * entry) {
 	filesystem_entry_internal_t * priv = (filesystem_entry_internal_t *)entry;
-	priv->user_data = user_data;
+	priv->flags &= ~FILESYSTEM_ENTRY_FLAG_TRACKED;
+	if(priv->type == FILESYSTEM_ENTRY_TYPE_DIR && (priv->flags & FILESYSTEM_ENTRY_FLAG_EVALUATED)) {
+		for(uint32_t i = 0; i < priv->data.dir.children_count; i++)
+			filesystem_entry_clear_tracked((struct filesystem_entry_t *)&priv->data.dir.children[i]);
+	}
 }
 
 
 const char * filesystem_symbolic_link_get_target(const struct filesystem_entry_t * entry) {
 	const filesystem_entry_internal_t * priv = (const filesystem_entry_internal_t *)entry;
-	if(priv->type == FILESYSTEM_ENTRY_TYPE_LINK)
+	if(priv->type == FILESYSTEM_ENTRY_TYPE_LINK) {
+		if(priv->data.link.target == NULL) {
+			int    fd     = filesystem_entry_get_parent_fd(priv);
+			char * target;
+			if(fd != -1)
+				target = readlinkat_malloc(fd, priv->name, 0);
+			else {
+				// the directory is gone or can't be opened, which the path reports
+				char   buffer[PATH_MAX];
+				char * path = filesystem_entry_path_in(priv, buffer, sizeof(buffer));
+				target = readlinkat_malloc(AT_FDCWD, path, 0);
+				if(path != buffer)
+					free(path);
+			}
+			if(priv->flags & FILESYSTEM_ENTRY_FLAG_OWNED)
+				((filesystem_entry_internal_t *)priv)->data.link.target = target;
+			else {
+				size_t length = strlen(target) + 1; // 1 for terminating '\0'-byte
+				((filesystem_entry_internal_t *)priv)->data.link.target = (char *)memcpy(filesystem_entry_alloc(priv, length), target, length);
+				free(target);
+			}
+		}
 		return priv->data.link.target;
+	}
 	else
 		return "";
 }
@@ -422,8 +1689,10 @@ const char * filesystem_symbolic_link_get_target(const struct filesystem_entry_t
 
 off_t filesystem_regular_file_get_size(const struct filesystem_entry_t * entry) {
 	const filesystem_entry_internal_t * priv = (const filesystem_entry_internal_t *)entry;
-	if(priv->type == FILESYSTEM_ENTRY_TYPE_FILE)
+	if(priv->type == FILESYSTEM_ENTRY_TYPE_FILE) {
+		filesystem_entry_ensure_statted(priv);
 		return priv->data.file.size;
+	}
 	else
 		return 0;
 }
@@ -437,13 +1706,13 @@ bool filesystem_entry_is_root(const struct filesystem_entry_t * entry) {
 
 bool filesystem_entry_has_prev(const struct filesystem_entry_t * entry) {
 	const filesystem_entry_internal_t * priv = (const filesystem_entry_internal_t *)entry;
-	return (priv->prev == NULL);
+	return (priv->parent != NULL && priv != priv->parent->data.dir.children);
 }
 
 
 bool filesystem_entry_has_next(const struct filesystem_entry_t * entry) {
 	const filesystem_entry_internal_t * priv = (const filesystem_entry_internal_t *)entry;
-	return (priv->next == NULL);
+	return (priv->parent != NULL && priv + 1 != priv->parent->data.dir.children + priv->parent->data.dir.children_count);
 }
 
 
@@ -451,7 +1720,7 @@ bool filesystem_entry_has_children(struct filesystem_entry_t * entry) {
 	filesystem_entry_internal_t * priv = (filesystem_entry_internal_t *)entry;
 	if(priv->type == FILESYSTEM_ENTRY_TYPE_DIR) {
 		filesystem_entry_expand(priv);
-		if(!priv->data.dir.children_evaluated)
+		if(!(priv->flags & FILESYSTEM_ENTRY_FLAG_EVALUATED))
 			return false;
 		return (priv->data.dir.children_count > 0);
 	}
@@ -467,13 +1736,13 @@ struct filesystem_entry_t * filesystem_entry_get_parent(struct filesystem_entry_
 
 struct filesystem_entry_t * filesystem_entry_get_prev(struct filesystem_entry_t * entry) {
 	filesystem_entry_internal_t * priv = (filesystem_entry_internal_t *)entry;
-	return (struct filesystem_entry_t *)priv->prev;
+	return (filesystem_entry_has_prev(entry) ? (struct filesystem_entry_t *)(priv - 1) : NULL);
 }
 
 
 struct filesystem_entry_t * filesystem_entry_get_next(struct filesystem_entry_t * entry) {
 	filesystem_entry_internal_t * priv = (filesystem_entry_internal_t *)entry;
-	return (struct filesystem_entry_t *)priv->next;
+	return (filesystem_entry_has_next(entry) ? (struct filesystem_entry_t *)(priv + 1) : NULL);
 }
 
 
@@ -481,38 +1750,137 @@ struct filesystem_entry_t * filesystem_entry_get_first_child(struct filesystem_e
 	filesystem_entry_internal_t * priv = (filesystem_entry_internal_t *)entry;
 	if(priv->type == FILESYSTEM_ENTRY_TYPE_DIR) {
 		filesystem_entry_expand(priv);
-		if(!priv->data.dir.children_evaluated)
+		if(!(priv->flags & FILESYSTEM_ENTRY_FLAG_EVALUATED))
 			return NULL;
 		if(priv->data.dir.children_count != 0)
-			return (struct filesystem_entry_t *)priv->data.dir.children[0];
+			return (struct filesystem_entry_t *)&priv->data.dir.children[0];
 	}
 	return NULL;
 }
 
 
-struct filesystem_entry_t * filesystem_entry_get_child_by_name(struct filesystem_entry_t * entry, const char * name) {
-	filesystem_entry_internal_t * priv = (filesystem_entry_internal_t *)entry;
+/**
+ * Compares the first length bytes of name, which doesn't have to be terminated, with the name of an entry.
+ */
+static int filesystem_entry_compare_name(const char * name, size_t length, const filesystem_entry_internal_t * entry) {
+	int cmp = strncmp(name, entry->name, length);
+	if(cmp == 0 && entry->name[length] != '\0')
+		cmp = -1; // name is a prefix of the entry's name
+	return cmp;
+}
 
-	if(priv->type != FILESYSTEM_ENTRY_TYPE_DIR)
+
+/**
+ * Looks up the child named by the first length bytes of name, which doesn't have to be terminated.
+ * hint is a child of entry (or NULL) the lookup starts from: names past it are found by galloping forward, so a
+ * sorted stream of lookups merges with the sorted children in linear time instead of a binary search each.
+ */
+static filesystem_entry_internal_t * filesystem_entry_find_child(filesystem_entry_internal_t * entry, const char * name, size_t length, const filesystem_entry_internal_t * hint) {
+	if(entry->type != FILESYSTEM_ENTRY_TYPE_DIR)
 		return NULL;
 
-	filesystem_entry_expand(priv);
-	if(!priv->data.dir.children_evaluated)
+	filesystem_entry_expand(entry);
+	if(!(entry->flags & FILESYSTEM_ENTRY_FLAG_EVALUATED))
 		return NULL;
 
+	filesystem_entry_internal_t * children = entry->data.dir.children;
+	uint32_t                      left     = 0,
+	                              right    = entry->data.dir.children_count;
+	if(hint != NULL && hint->parent == entry) {
+		uint32_t position = hint - children;
+		int      cmp      = filesystem_entry_compare_name(name, length, hint);
+		if(cmp == 0)
+			return &children[position];
+		else if(cmp < 0)
+			right = position; // out of order, search everything before the hint
+		else {
+			// gallop: double the step until the name is passed, then search the last step
+			uint32_t step = 1;
+			left = position + 1;
+			while(step < right - left && filesystem_entry_compare_name(name, length, &children[left + step - 1]) > 0) {
+				left += step;
+				step *= 2;
+			}
+			if(step < right - left)
+				right = left + step;
+		}
+	}
+
 	// binary search
-	size_t left  = 0,
-	       right = priv->data.dir.children_count;
 	while(left < right) {
-		size_t mid = (left + right) / 2;
-		int    cmp = strcmp(name, priv->data.dir.children[mid]->name);
+		uint32_t mid = left + (right - left) / 2;
+		int      cmp = filesystem_entry_compare_name(name, length, &children[mid]);
 		if(cmp < 0)
 			right = mid;
 		else if(cmp > 0)
 			left = mid + 1;
 		else
-			return (struct filesystem_entry_t *)priv->data.dir.children[mid];
+			return &children[mid];
 	}
 
 	return NULL;
 }
+
+
+struct filesystem_entry_t * filesystem_entry_get_child_by_name(struct filesystem_entry_t * entry, const char * name) {
+	return (struct filesystem_entry_t *)filesystem_entry_find_child((filesystem_entry_internal_t *)entry, name, strlen(name), NULL);
+}
+
+
+typedef struct {
+	char *              path; // of the entry being visited, grows to the deepest path of the walk
+	size_t              allocated;
+	filesystem_fn_visit fn;
+	void *              user_data;
+} filesystem_walk_t;
+
+
+/**
+ * Visits the children of entry, whose path is the first length bytes of the walk's path.
+ */
+static void filesystem_walk_children(filesystem_walk_t * walk, filesystem_entry_internal_t * entry, size_t length) {
+	filesystem_entry_expand(entry);
+	if(!(entry->flags & FILESYSTEM_ENTRY_FLAG_EVALUATED))
+		return;
+
+	for(uint32_t i = 0; i < entry->data.dir.children_count; i++) {
+		filesystem_entry_internal_t * child        = &entry->data.dir.children[i];
+		size_t                        name_length  = strlen(child->name),
+		                              child_length = length + 1 + name_length; // 1 for '/' delimiter
+		if(child_length + 1 > walk->allocated) {
+			while(child_length + 1 > walk->allocated)
+				walk->allocated *= 2;
+			walk->path = (char *)realloc(walk->path, walk->allocated);
+			assert(walk->path != NULL);
+		}
+		walk->path[length] = '/';
+		memcpy(walk->path + length + 1, child->name, name_length + 1); // 1 for terminating '\0'-byte
+
+		if(walk->fn((struct filesystem_entry_t *)child, walk->path, walk->user_data) && child->type == FILESYSTEM_ENTRY_TYPE_DIR)
+			filesystem_walk_children(walk, child, child_length);
+	}
+}
+
+
+void filesystem_walk(struct filesystem_entry_t * entry, filesystem_fn_visit fn, void * user_data) {
+	filesystem_walk_t walk;
+	walk.allocated = PATH_MAX;
+	walk.path      = (char *)malloc(walk.allocated);
+	walk.fn        = fn;
+	walk.user_data = user_data;
+	assert(walk.path != NULL);
+
+	// the root is "/", but its children are "/name", not "//name"
+	size_t length = filesystem_entry_copy_path(entry, walk.path, walk.allocated);
+	if(length >= walk.allocated) {
+		walk.allocated = length + 1;
+		walk.path      = (char *)realloc(walk.path, walk.allocated);
+		assert(walk.path != NULL);
+		filesystem_entry_copy_path(entry, walk.path, walk.allocated);
+	}
+	if(filesystem_entry_is_root(entry))
+		length = 0;
+
+	filesystem_walk_children(&walk, (filesystem_entry_internal_t *)entry, length);
+	free(walk.path);
+}
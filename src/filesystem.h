@@ -4,6 +4,7 @@
 
 #include <stdbool.h>
 #include <sys/types.h>
+#include <time.h>
 
 #include "list.h"
 
@@ -15,16 +16,50 @@ extern "C" {
 
 struct filesystem_t;
 struct filesystem_entry_t;
+struct filesystem_cursor_t;
 
 
-typedef void (*filesystem_fn_free)(void *); /* user_data deallocation callback */
+typedef bool (*filesystem_fn_skip)(struct filesystem_entry_t * entry, void * user_data); /* true: don't scan this directory */
+typedef bool (*filesystem_fn_visit)(struct filesystem_entry_t * entry, const char * path, void * user_data); /* true: descend into this directory */
 
 
 struct filesystem_t * filesystem_open();
-void                  filesystem_close(struct filesystem_t * handle, filesystem_fn_free fn);
+void                  filesystem_close(struct filesystem_t * handle);
+
+/* eagerly expands the whole tree on a work-stealing pool of threads (one per cpu if threads is 0);
+ * directories for which fn returns true are left to be expanded lazily on first access */
+void                  filesystem_scan(struct filesystem_t * handle, size_t threads, filesystem_fn_skip fn, void * user_data);
+
+/* entries are only stat()ed and links only read when their metadata or target is asked for;
+ * these count the expanded entries for which that never happened */
+size_t                filesystem_get_stats_avoided    (struct filesystem_t * handle);
+size_t                filesystem_get_readlinks_avoided(struct filesystem_t * handle);
+
+/* keeps the tree for the next run in a snapshot file, loaded right after opening: a directory whose device, inode,
+ * mtime and ctime are the recorded ones takes its children from there instead of being read; their metadata is
+ * still statted on first access, unless trusted, in which case the recorded one is taken as well and changes to
+ * files in unchanged directories go unnoticed. A missing or invalid snapshot is an empty one */
+void                  filesystem_load_snapshot         (struct filesystem_t * handle, const char * path, bool trusted);
+int                   filesystem_save_snapshot         (struct filesystem_t * handle, const char * path);
+size_t                filesystem_get_directories_reused(struct filesystem_t * handle);
+
+/* for keeping a tree up to date while entries change, never during a scan: invalidate has the metadata and link
+ * target read again on next access, forget the children as well; refresh reads the children of a directory again,
+ * keeping the nodes of those whose name and type are unchanged. Forget and refresh replace the children of entry,
+ * so pointers to them and cursors have to be dropped. What is read again is freed once replaced, and forgetting
+ * the root frees the whole tree, so the memory of a tree kept up to date stays bounded */
+void                  filesystem_entry_invalidate(struct filesystem_entry_t * entry);
+void                  filesystem_entry_forget    (struct filesystem_entry_t * entry);
+void                  filesystem_entry_refresh   (struct filesystem_entry_t * entry);
 
 struct filesystem_entry_t * filesystem_get_path(struct filesystem_t * handle, const char * path);
 
+/* resolves paths like filesystem_get_path, but starting from the deepest directory the path has in common with
+ * the previous one and without allocating, which suits sorted paths like those of an mtree file */
+struct filesystem_cursor_t * filesystem_cursor_create (struct filesystem_t * handle);
+void                         filesystem_cursor_destroy(struct filesystem_cursor_t * handle);
+struct filesystem_entry_t *  filesystem_cursor_resolve(struct filesystem_cursor_t * handle, const char * path);
+
 bool filesystem_entry_is_block_device (const struct filesystem_entry_t * entry);
 bool filesystem_entry_is_char_device  (const struct filesystem_entry_t * entry);
 bool filesystem_entry_is_directory    (const struct filesystem_entry_t * entry);
@@ -33,16 +68,23 @@ bool filesystem_entry_is_regular_file (const struct filesystem_entry_t * entry);
 bool filesystem_entry_is_symbolic_link(const struct filesystem_entry_t * entry);
 bool filesystem_entry_is_socket       (const struct filesystem_entry_t * entry);
 
-char *       filesystem_entry_get_path          (const struct filesystem_entry_t * entry);
-const char * filesystem_entry_get_name          (const struct filesystem_entry_t * entry);
-mode_t       filesystem_entry_get_mode          (const struct filesystem_entry_t * entry);
-uid_t        filesystem_entry_get_uid           (const struct filesystem_entry_t * entry);
-gid_t        filesystem_entry_get_gid           (const struct filesystem_entry_t * entry);
-time_t       filesystem_entry_get_mtime         (const struct filesystem_entry_t * entry);
-void *       filesystem_entry_get_user_data     (struct filesystem_entry_t * entry);
-void         filesystem_entry_set_user_data     (struct filesystem_entry_t * entry, void * user_data);
-const char * filesystem_symbolic_link_get_target(const struct filesystem_entry_t * entry);
-off_t        filesystem_regular_file_get_size   (const struct filesystem_entry_t * entry);
+char *          filesystem_entry_get_path          (const struct filesystem_entry_t * entry);
+size_t          filesystem_entry_copy_path         (const struct filesystem_entry_t * entry, char * buffer, size_t size); /* like snprintf, but empty if truncated */
+const char *    filesystem_entry_get_name          (const struct filesystem_entry_t * entry);
+dev_t           filesystem_entry_get_device        (const struct filesystem_entry_t * entry);
+ino_t           filesystem_entry_get_inode         (const struct filesystem_entry_t * entry);
+mode_t          filesystem_entry_get_mode          (const struct filesystem_entry_t * entry);
+uid_t           filesystem_entry_get_uid           (const struct filesystem_entry_t * entry);
+gid_t           filesystem_entry_get_gid           (const struct filesystem_entry_t * entry);
+time_t          filesystem_entry_get_mtime         (const struct filesystem_entry_t * entry);
+struct timespec filesystem_entry_get_mtimespec     (const struct filesystem_entry_t * entry);
+struct timespec filesystem_entry_get_ctimespec     (const struct filesystem_entry_t * entry);
+bool            filesystem_entry_has_vanished      (const struct filesystem_entry_t * entry); /* removed since its directory was read, its metadata is not to be compared */
+bool            filesystem_entry_is_tracked        (const struct filesystem_entry_t * entry);
+void            filesystem_entry_set_tracked       (struct filesystem_entry_t * entry);
+void            filesystem_entry_clear_tracked     (struct filesystem_entry_t * entry); /* of entry and everything below it that has been read */
+const char *    filesystem_symbolic_link_get_target(const struct filesystem_entry_t * entry);
+off_t           filesystem_regular_file_get_size   (const struct filesystem_entry_t * entry);
 
 bool                        filesystem_entry_is_root          (const struct filesystem_entry_t * entry);
 bool                        filesystem_entry_has_prev         (const struct filesystem_entry_t * entry);
@@ -54,6 +96,11 @@ struct filesystem_entry_t * filesystem_entry_get_next         (struct filesystem
 struct filesystem_entry_t * filesystem_entry_get_first_child  (struct filesystem_entry_t * entry);
 struct filesystem_entry_t * filesystem_entry_get_child_by_name(struct filesystem_entry_t * entry, const char * name);
 
+/* visits every entry below entry depth-first and sorted by name, descending into the directories fn returns true
+ * for, which are only read then. The path passed to fn is kept in a single buffer for the whole walk, which
+ * components are appended to and cut from on the way, so it is only valid during the call */
+void                        filesystem_walk                   (struct filesystem_entry_t * entry, filesystem_fn_visit fn, void * user_data);
+
 
 #ifdef __cplusplus
 }
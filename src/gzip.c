@@ -1,38 +1,229 @@
 #include "gzip.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <zlib.h>
+#ifdef HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+
+#define GZIP_MEMBER_MIN_SIZE   18   // header, empty deflate stream and trailer
+#define GZIP_DEFLATE_MAX_RATIO 1032
+
+
+typedef enum {
+	GZIP_INFLATE_DONE,
+	GZIP_INFLATE_SHORT, // the output did not fit
+	GZIP_INFLATE_FAILED
+} gzip_inflate_t;
+
+
+/**
+ * Returns whether data starts like a gzip member; anything else is taken as is, like gzread does.
+ */
+static bool gzip_is_member(const unsigned char * data, size_t size) {
+	return (size >= 2 && data[0] == 0x1f && data[1] == 0x8b);
+}
+
+
+/**
+ * Returns the size data presumably decompresses to: the ISIZE trailer of the last member, which is the
+ * uncompressed size of that member modulo 4 GiB. It is only a hint, as nothing guarantees a file has a single
+ * member, and all of them would have to be inflated to know better. A corrupt trailer is bounded by the best
+ * ratio deflate can reach.
+ */
+static size_t gzip_get_size_hint(const unsigned char * data, size_t size) {
+	if(!gzip_is_member(data, size))
+		return size;
+	if(size < GZIP_MEMBER_MIN_SIZE)
+		return 0;
+	const unsigned char * trailer = data + size - 4;
+	size_t                hint    = (size_t)trailer[0] | (size_t)trailer[1] << 8 | (size_t)trailer[2] << 16 | (size_t)trailer[3] << 24;
+	return (hint / GZIP_DEFLATE_MAX_RATIO < size ? hint : size * GZIP_DEFLATE_MAX_RATIO);
+}
+
+
+/**
+ * Inflates all members of data into out with zlib, in a single call per member.
+ */
+static gzip_inflate_t gzip_inflate_zlib(const unsigned char * data, size_t size, char * out, size_t out_size, size_t * out_actual) {
+	if(size > UINT_MAX || out_size > UINT_MAX)
+		return GZIP_INFLATE_FAILED;
+
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	if(inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK)
+		return GZIP_INFLATE_FAILED;
+	stream.next_in   = (Bytef *)data;
+	stream.avail_in  = size;
+	stream.next_out  = (Bytef *)out;
+	stream.avail_out = out_size;
+
+	// further members follow one another; trailing garbage is ignored, like gzread does
+	int status;
+	while((status = inflate(&stream, Z_FINISH)) == Z_STREAM_END && gzip_is_member(stream.next_in, stream.avail_in))
+		inflateReset(&stream);
+
+	gzip_inflate_t result = GZIP_INFLATE_FAILED;
+	if(status == Z_STREAM_END)
+		result = GZIP_INFLATE_DONE;
+	else if((status == Z_OK || status == Z_BUF_ERROR) && stream.avail_out == 0)
+		result = GZIP_INFLATE_SHORT;
+	*out_actual = out_size - stream.avail_out;
+	inflateEnd(&stream);
+	return result;
+}
+
+
+/**
+ * Inflates the whole of data into out in one go with the fastest backend available, or copies it if it is not
+ * compressed at all.
+ */
+static gzip_inflate_t gzip_inflate(const unsigned char * data, size_t size, char * out, size_t out_size, size_t * out_actual) {
+	if(!gzip_is_member(data, size)) {
+		*out_actual = (size < out_size ? size : out_size);
+		memcpy(out, data, *out_actual);
+		return (size <= out_size ? GZIP_INFLATE_DONE : GZIP_INFLATE_SHORT);
+	}
+
+#ifdef HAVE_LIBDEFLATE
+	struct libdeflate_decompressor * decompressor = libdeflate_alloc_decompressor();
+	if(decompressor == NULL)
+		return GZIP_INFLATE_FAILED;
+	size_t                 actual_in;
+	enum libdeflate_result result = libdeflate_gzip_decompress_ex(decompressor, data, size, out, out_size, &actual_in, out_actual);
+	libdeflate_free_decompressor(decompressor);
+	if(result == LIBDEFLATE_INSUFFICIENT_SPACE)
+		return GZIP_INFLATE_SHORT;
+	if(result != LIBDEFLATE_SUCCESS)
+		return GZIP_INFLATE_FAILED;
+	if(actual_in == size)
+		return GZIP_INFLATE_DONE;
+	// libdeflate stops after the first member, zlib handles the rare rest
+#endif
+	return gzip_inflate_zlib(data, size, out, out_size, out_actual);
+}
+
+
+/**
+ * Reads up to size bytes from fd into a new buffer; sets actual to the number read.
+ * returns NULL on failure
+ */
+static unsigned char * gzip_read_fd(int fd, size_t size, size_t * actual) {
+	unsigned char * data = (unsigned char *)malloc(size > 0 ? size : 1);
+	if(data == NULL)
+		return NULL;
+
+	*actual = 0;
+	while(*actual < size) {
+		ssize_t bytes_read = read(fd, data + *actual, size - *actual);
+		if(bytes_read == 0)
+			break;
+		if(bytes_read == -1) {
+			if(errno == EINTR)
+				continue;
+			free(data);
+			return NULL;
+		}
+		*actual += bytes_read;
+	}
+	return data;
+}
 
 
 int read_gzip_file(const char * file_path, char ** buffer, unsigned int * allocated) {
-	gzFile file = gzopen(file_path, "r");
-	if(file == NULL)
+	int fd = open(file_path, O_RDONLY | O_CLOEXEC);
+	if(fd == -1)
+		return -1;
+	struct stat     info;
+	size_t          size;
+	unsigned char * data = NULL;
+	if(fstat(fd, &info) == 0)
+		data = gzip_read_fd(fd, info.st_size, &size);
+	close(fd);
+	if(data == NULL)
 		return -1;
 
-	unsigned int position = 0;
-	while(1) {
-		unsigned int allowed_bytes = *allocated - position;
-		int bytes_read = gzread(file, *buffer + position, allowed_bytes);
-		if(bytes_read == allowed_bytes) {
-			position   += bytes_read;
-			*allocated += 1024;
-			*buffer     = (char *)realloc(*buffer, *allocated);
-			if(*buffer == NULL) {
-				gzclose(file);
-				return -1;
-			}
+	// the buffer is enlarged once to the announced size, and only keeps growing if that was wrong
+	size_t         needed = gzip_get_size_hint(data, size) + 1,
+	               actual = 0;
+	gzip_inflate_t result = GZIP_INFLATE_FAILED;
+	while(needed <= (size_t)INT_MAX + 1) {
+		if(*allocated < needed) {
+			char * enlarged = (char *)realloc(*buffer, needed);
+			if(enlarged == NULL)
+				break;
+			*buffer    = enlarged;
+			*allocated = needed;
 		}
-		else if(bytes_read >= 0 && bytes_read < allowed_bytes && gzeof(file)) {
-			position += bytes_read;
-			(*buffer)[position] = '\0';
+		result = gzip_inflate(data, size, *buffer, *allocated - 1, &actual);
+		if(result != GZIP_INFLATE_SHORT)
 			break;
+		needed = 2 * (size_t)*allocated;
+	}
+	free(data);
+
+	if(result != GZIP_INFLATE_DONE)
+		return -1;
+	(*buffer)[actual] = '\0';
+	return actual;
+}
+
+
+int read_gzip_file_chunked(const char * file_path, size_t chunk_size, gzip_fn_chunk fn, void * user_data) {
+	int fd = open(file_path, O_RDONLY | O_CLOEXEC);
+	if(fd == -1)
+		return -1;
+	struct stat info;
+	char *      chunk = NULL;
+	if(fstat(fd, &info) != 0 || (chunk = (char *)malloc(chunk_size)) == NULL) {
+		close(fd);
+		return -1;
+	}
+
+	// a file that fits into a single chunk is inflated in one go, nothing else has to stream
+	if((size_t)info.st_size <= chunk_size) {
+		size_t          size,
+		                actual;
+		gzip_inflate_t  result = GZIP_INFLATE_FAILED;
+		unsigned char * data   = gzip_read_fd(fd, info.st_size, &size);
+		if(data != NULL) {
+			result = (gzip_get_size_hint(data, size) <= chunk_size ? gzip_inflate(data, size, chunk, chunk_size, &actual) : GZIP_INFLATE_SHORT);
+			free(data);
 		}
-		else {
-			gzclose(file);
-			return -1;
+
+		if(result == GZIP_INFLATE_DONE && actual > 0)
+			fn(chunk, actual, user_data);
+		// nothing was handed over yet if the hint was wrong, so the stream can start over
+		if(result != GZIP_INFLATE_SHORT || lseek(fd, 0, SEEK_SET) == -1) {
+			close(fd);
+			free(chunk);
+			return (result == GZIP_INFLATE_DONE ? 0 : -1);
 		}
 	}
 
+	gzFile file = gzdopen(fd, "r");
+	if(file == NULL) {
+		close(fd);
+		free(chunk);
+		return -1;
+	}
+
+	int bytes_read;
+	while((bytes_read = gzread(file, chunk, chunk_size)) > 0)
+		fn(chunk, bytes_read, user_data);
+
+	// a truncated file ends like a complete one, but leaves an error behind
+	int error = Z_OK;
+	gzerror(file, &error);
 	gzclose(file);
-	return position;
+	free(chunk);
+	return (bytes_read == 0 && error == Z_OK ? 0 : -1);
 }
@@ -2,6 +2,9 @@
 #define INCLUDE_GZIP_H
 
 
+#include <stddef.h>
+
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -9,6 +12,8 @@ extern "C" {
 
 /**
  * Reads the contents of a gzip-compressed file into buffer; enlarges buffer on demand; returns resulting size
+ * The buffer is enlarged at most once for the size recorded in the gzip trailer, and the file is inflated in one
+ * call, by libdeflate if built with HAVE_LIBDEFLATE, by zlib otherwise.
  *
  * file_path = path to the gzip file including possible extensions
  * buffer    = pointer to the buffer region; can be modified with realloc; data will also be null-terminated!
@@ -17,6 +22,22 @@ extern "C" {
  */
 int read_gzip_file(const char * file_path, char ** buffer, unsigned int * allocated);
 
+/**
+ * Callback function type for handing over a chunk of decompressed data.
+ */
+typedef void (*gzip_fn_chunk)(const char * data, size_t size, void * user_data);
+
+/**
+ * Decompresses a gzip-compressed file chunk by chunk, handing every chunk over via fn as soon as it is inflated,
+ * so the file never has to fit into memory as a whole. A file that fits into a single chunk is inflated in one
+ * call like by read_gzip_file.
+ *
+ * file_path  = path to the gzip file including possible extensions
+ * chunk_size = maximum size of a chunk
+ * returns -1 on failure (chunks may have been handed over before), 0 otherwise
+ */
+int read_gzip_file_chunked(const char * file_path, size_t chunk_size, gzip_fn_chunk fn, void * user_data);
+
 
 #ifdef __cplusplus
 }
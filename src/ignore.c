@@ -0,0 +1,191 @@
+#define _GNU_SOURCE
+#include "ignore.h"
+
+#include <assert.h>
+#include <fnmatch.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/**
+ * A node stands for one component of one or more patterns; its children for the components that follow.
+ * Paths and patterns are split at every '/', so absolute ones start with an empty component; the root stands for
+ * the position in front of the first component.
+ */
+typedef struct ignore_node_t {
+	char *                  component;
+	bool                    terminal;        // a pattern ends here
+	bool                    all_children;    // a pattern ends with a "*" child of this node
+	struct ignore_node_t ** literals;        // children without wildcards, sorted by component
+	size_t                  literals_count;
+	struct ignore_node_t ** wildcards;       // children with wildcards, matched with fnmatch
+	size_t                  wildcards_count;
+} ignore_node_t;
+
+
+typedef struct {
+	ignore_node_t * root;
+} ignore_internal_t;
+
+
+static ignore_node_t * ignore_node_create(const char * component, size_t length) {
+	ignore_node_t * node = (ignore_node_t *)calloc(1, sizeof(ignore_node_t));
+	assert(node != NULL);
+	node->component = strndup(component, length);
+	assert(node->component != NULL);
+	return node;
+}
+
+
+static void ignore_node_destroy(ignore_node_t * node) {
+	for(size_t i = 0; i < node->literals_count; i++)
+		ignore_node_destroy(node->literals[i]);
+	for(size_t i = 0; i < node->wildcards_count; i++)
+		ignore_node_destroy(node->wildcards[i]);
+	free(node->literals);
+	free(node->wildcards);
+	free(node->component);
+	free(node);
+}
+
+
+/**
+ * Compares the first length bytes of name, which doesn't have to be terminated, with a component.
+ */
+static int ignore_compare(const char * name, size_t length, const char * component) {
+	int cmp = strncmp(name, component, length);
+	if(cmp == 0 && component[length] != '\0')
+		cmp = -1; // name is a prefix of the component
+	return cmp;
+}
+
+
+/**
+ * Returns the position of the literal child named by the first length bytes of name, or where it would have to be
+ * inserted; found tells which one it is.
+ */
+static size_t ignore_node_find_literal(const ignore_node_t * node, const char * name, size_t length, bool * found) {
+	size_t left  = 0,
+	       right = node->literals_count;
+	while(left < right) {
+		size_t mid = left + (right - left) / 2;
+		int    cmp = ignore_compare(name, length, node->literals[mid]->component);
+		if(cmp < 0)
+			right = mid;
+		else if(cmp > 0)
+			left = mid + 1;
+		else {
+			*found = true;
+			return mid;
+		}
+	}
+	*found = false;
+	return left;
+}
+
+
+static ignore_node_t * ignore_node_add_child(ignore_node_t * node, const char * component, size_t length) {
+	// anything fnmatch treats specially makes a component a wildcard, including escapes
+	if(strcspn(component, "*?[\\") < length) {
+		for(size_t i = 0; i < node->wildcards_count; i++) {
+			if(ignore_compare(component, length, node->wildcards[i]->component) == 0)
+				return node->wildcards[i];
+		}
+		node->wildcards = (ignore_node_t **)realloc(node->wildcards, (node->wildcards_count + 1) * sizeof(ignore_node_t *));
+		assert(node->wildcards != NULL);
+		node->wildcards[node->wildcards_count] = ignore_node_create(component, length);
+		return node->wildcards[node->wildcards_count++];
+	}
+
+	bool   found;
+	size_t position = ignore_node_find_literal(node, component, length, &found);
+	if(found)
+		return node->literals[position];
+
+	node->literals = (ignore_node_t **)realloc(node->literals, (node->literals_count + 1) * sizeof(ignore_node_t *));
+	assert(node->literals != NULL);
+	memmove(node->literals + position + 1, node->literals + position, (node->literals_count - position) * sizeof(ignore_node_t *));
+	node->literals[position] = ignore_node_create(component, length);
+	node->literals_count++;
+	return node->literals[position];
+}
+
+
+struct ignore_t * ignore_create() {
+	ignore_internal_t * priv = (ignore_internal_t *)malloc(sizeof(ignore_internal_t));
+	if(priv == NULL)
+		return NULL;
+	priv->root = ignore_node_create("", 0);
+	return (struct ignore_t *)priv;
+}
+
+
+void ignore_destroy(struct ignore_t * handle) {
+	ignore_internal_t * priv = (ignore_internal_t *)handle;
+	ignore_node_destroy(priv->root);
+	free(priv);
+}
+
+
+void ignore_add(struct ignore_t * handle, const char * pattern) {
+	ignore_internal_t * priv = (ignore_internal_t *)handle;
+
+	ignore_node_t * node   = priv->root,
+	              * parent = NULL;
+	const char *    left   = pattern;
+	while(true) {
+		const char * right = strchrnul(left, '/');
+		parent = node;
+		node   = ignore_node_add_child(node, left, right - left);
+		if(*right == '\0')
+			break;
+		left = right + 1; // skip '/'
+	}
+
+	node->terminal = true;
+	if(strcmp(node->component, "*") == 0)
+		parent->all_children = true;
+}
+
+
+/**
+ * Matches the path starting at the component name against the children of node, which matched the component
+ * before it. name is NULL once all components have been matched.
+ */
+static ignore_match_t ignore_node_match(const ignore_node_t * node, const char * name) {
+	if(node->terminal)
+		return IGNORE_MATCH_PATH;
+	if(name == NULL)
+		return (node->all_children ? IGNORE_MATCH_CHILDREN : IGNORE_MATCH_NONE);
+
+	const char *   end    = strchrnul(name, '/');
+	const char *   next   = (*end == '/' ? end + 1 : NULL);
+	size_t         length = end - name;
+	ignore_match_t result = IGNORE_MATCH_NONE;
+
+	bool   found;
+	size_t position = ignore_node_find_literal(node, name, length, &found);
+	if(found)
+		result = ignore_node_match(node->literals[position], next);
+
+	if(result != IGNORE_MATCH_PATH && node->wildcards_count > 0) {
+		char component[length + 1];
+		memcpy(component, name, length);
+		component[length] = '\0';
+		for(size_t i = 0; i < node->wildcards_count && result != IGNORE_MATCH_PATH; i++) {
+			if(fnmatch(node->wildcards[i]->component, component, FNM_PATHNAME) == 0) {
+				ignore_match_t match = ignore_node_match(node->wildcards[i], next);
+				if(match > result)
+					result = match;
+			}
+		}
+	}
+
+	return result;
+}
+
+
+ignore_match_t ignore_match(const struct ignore_t * handle, const char * path) {
+	const ignore_internal_t * priv = (const ignore_internal_t *)handle;
+	return ignore_node_match(priv->root, path);
+}
@@ -0,0 +1,56 @@
+#ifndef INCLUDE_IGNORE_H
+#define INCLUDE_IGNORE_H
+
+
+#include <stdbool.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * Opaque handle of a set of ignore patterns, compiled into a trie of path components.
+ * A pattern matches like fnmatch() with FNM_PATHNAME | FNM_LEADING_DIR: wildcards don't match '/', so every
+ * component of a pattern is matched against one component of the path, and a pattern matching the leading
+ * components of a path ignores everything below them as well.
+ * Matching takes time proportional to the length of the path, not the number of patterns; literal components
+ * are looked up by binary search, only components with wildcards are tried one by one.
+ * A compiled set is read-only and may be matched from several threads at once.
+ */
+struct ignore_t;
+
+typedef enum {
+	IGNORE_MATCH_NONE,
+	IGNORE_MATCH_CHILDREN, // the path isn't ignored, but every entry below it is (a pattern like "/proc/*")
+	IGNORE_MATCH_PATH      // the path and every entry below it is ignored
+} ignore_match_t;
+
+/**
+ * Creates an empty set. Returns NULL on failure.
+ */
+struct ignore_t * ignore_create();
+
+/**
+ * Releases the handle.
+ */
+void ignore_destroy(struct ignore_t * handle);
+
+/**
+ * Adds a pattern to the set.
+ */
+void ignore_add(struct ignore_t * handle, const char * pattern);
+
+/**
+ * Matches a path without trailing '/' against all patterns of the set.
+ */
+ignore_match_t ignore_match(const struct ignore_t * handle, const char * path);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
@@ -3,20 +3,35 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
-#include <fnmatch.h>
+#include <errno.h>
 #include <getopt.h>
+#include <libgen.h>
+#include <limits.h>
+#include <mntent.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 
 #include <alpm.h>
 
+#include "cache.h"
 #include "filesystem.h"
 #include "gzip.h"
-#include "md5.h"
+#include "ignore.h"
 #include "mtree.h"
+#include "sha256.h"
 #include "string.h"
+#include "verify.h"
+#include "watch.h"
 
 
 static const char * default_root      = "/";
 static const char * default_db_path   = "/var/lib/pacman/";
+static const char * default_cache     = "/var/cache/arch-diff/digests";
 static const char * default_ignores[] = {
 	"/dev/*",
 	"/etc/ssl/certs/*",
@@ -41,160 +56,262 @@ static const char * skip[] = {
 };
 
 
+typedef enum {
+	DIGEST_MODE_AUTO,   // sha256 if the cpu has sha extensions, md5 otherwise
+	DIGEST_MODE_MD5,
+	DIGEST_MODE_SHA256
+} digest_mode_t;
+
+
 typedef struct {
-	const char *  root_path;
-	const char *  db_path;
-	bool          ignore_md5;
-	bool          ignore_mode;
-	bool          ignore_uid;
-	bool          ignore_gid;
-	alpm_list_t * ignore_patterns;
+	const char *      root_path;
+	const char *      db_path;
+	const char *      cache_path;
+	bool              cache_explicit; // given via --cache rather than the default
+	const char *      snapshot_path;
+	const char *      daemon_path;
+	bool              ignore_md5;
+	bool              ignore_mode;
+	bool              ignore_uid;
+	bool              ignore_gid;
+	bool              trust_mtime;
+	bool              cache_neutral;
+	bool              eager_scan;
+	bool              trust_snapshot;
+	digest_mode_t     digest;
+	struct ignore_t * ignores;
+	size_t            jobs;
+	verify_order_t    schedule;
+
+	// entries are reported to output, or kept in verdict by the daemon, which notes their content check in job
+	FILE *            output;
+	char **           verdict;
+	size_t *          job;
 
 	// color output
-	const char *  RED;
-	const char *  GREEN;
-	const char *  YELLOW;
-	const char *  RESET;
+	const char *      RED;
+	const char *      GREEN;
+	const char *      YELLOW;
+	const char *      RESET;
 } options_t;
 
 
-static void list_untracked_files(struct filesystem_entry_t * parent, size_t * counter, options_t * opts) {
-	if(filesystem_entry_has_children(parent)) {
-		struct filesystem_entry_t * child = filesystem_entry_get_first_child(parent);
-		while(child != NULL) {
-			if(filesystem_entry_get_user_data(child) == NULL) {
-				char * path = filesystem_entry_get_path(child);
-
-				bool ignore = false;
-				for(alpm_list_t * it = opts->ignore_patterns; it != NULL; it = alpm_list_next(it)) {
-					const char * pattern = (const char *)it->data;
-					if(fnmatch(pattern, path, FNM_PATHNAME | FNM_LEADING_DIR) == 0) {
-						ignore = true;
-						break;
-					}
-				}
-
-				if(!ignore) {
-					if(counter != NULL)
-						(*counter)++;
-					printf("%s[untracked]%s %s%s\n", opts->GREEN, opts->RESET, path, filesystem_entry_is_directory(child) ? "/" : "");
-				}
-
-				free(path);
-			}
-			else
-				list_untracked_files(child, counter, opts);
+static bool is_ignored(const char * path, options_t * opts) {
+	return (ignore_match(opts->ignores, path) == IGNORE_MATCH_PATH);
+}
 
-			child = filesystem_entry_get_next(child);
-		}
-	}
+
+/**
+ * Writes the cache back, if it was used at all. Users other than root usually can't create the default cache
+ * directory, which is only worth a warning if the cache was asked for explicitly or its directory exists.
+ */
+static void save_cache(struct cache_t * cache, options_t * opts) {
+	if(cache == NULL || cache_get_hits(cache) + cache_get_misses(cache) == 0 || cache_save(cache) == 0)
+		return;
+
+	int         error     = errno;
+	char *      directory = strdup(opts->cache_path);
+	struct stat info;
+	assert(directory != NULL);
+	if(opts->cache_explicit || stat(dirname(directory), &info) == 0)
+		fprintf(stderr, "warning: unable to write cache `%s': %s\n", opts->cache_path, strerror(error));
+	free(directory);
 }
 
 
-static const char * filesystem_entry_get_type_string(struct filesystem_entry_t * entry) {
-	     if(filesystem_entry_is_regular_file (entry)) return "file";
-	else if(filesystem_entry_is_directory    (entry)) return "dir";
-	else if(filesystem_entry_is_symbolic_link(entry)) return "link";
-	else if(filesystem_entry_is_fifo         (entry)) return "fifo";
-	else if(filesystem_entry_is_block_device (entry)) return "block";
-	else if(filesystem_entry_is_char_device  (entry)) return "char";
-	else if(filesystem_entry_is_socket       (entry)) return "socket";
-	else                                              return "unknown";
+/**
+ * Keeps the eager scan out of ignored directories like /proc, and out of directories all children of which are
+ * ignored; they are still expanded on demand.
+ */
+static bool skip_ignored_directory(struct filesystem_entry_t * entry, void * user_data) {
+	char   buffer[PATH_MAX];
+	size_t length = filesystem_entry_copy_path(entry, buffer, sizeof(buffer));
+	char * path   = (length < sizeof(buffer) ? buffer : filesystem_entry_get_path(entry));
+	bool   result = (ignore_match(((options_t *)user_data)->ignores, path) != IGNORE_MATCH_NONE);
+	if(path != buffer)
+		free(path);
+	return result;
 }
 
 
-static int md5sum(const char * path, char * result) {
-	MD5_CTX ctx;
-	MD5_Init(&ctx);
+typedef struct {
+	size_t *    counter;
+	options_t * opts;
+} untracked_walk_t;
 
-	FILE * fp = fopen(path, "r");
-	if(fp == NULL) {
-		perror("file open");
-		return -1;
+
+/**
+ * Lists an untracked entry, or descends into a tracked directory.
+ */
+static bool list_untracked_file(struct filesystem_entry_t * entry, const char * path, void * user_data) {
+	untracked_walk_t * walk = (untracked_walk_t *)user_data;
+	options_t *        opts = walk->opts;
+
+	// don't even read directories whose contents are ignored as a whole
+	if(filesystem_entry_is_tracked(entry))
+		return (filesystem_entry_is_directory(entry) && ignore_match(opts->ignores, path) == IGNORE_MATCH_NONE);
+
+	if(!is_ignored(path, opts)) {
+		if(walk->counter != NULL)
+			(*walk->counter)++;
+		fprintf(opts->output, "%s[untracked]%s %s%s\n", opts->GREEN, opts->RESET, path, filesystem_entry_is_directory(entry) ? "/" : "");
 	}
+	return false;
+}
 
-	while(!feof(fp)) {
-		char buffer[4096];
-		int result = fread(buffer, 1, sizeof(buffer), fp);
-		if(result == 0)
-			break;
-		MD5_Update(&ctx, buffer, result);
+
+static void list_untracked_files(struct filesystem_entry_t * parent, size_t * counter, options_t * opts) {
+	// don't even read directories whose contents are ignored as a whole
+	if(filesystem_entry_is_directory(parent)) {
+		char *         path  = filesystem_entry_get_path(parent);
+		ignore_match_t match = ignore_match(opts->ignores, path);
+		free(path);
+		if(match != IGNORE_MATCH_NONE)
+			return;
 	}
 
-	fclose(fp);
+	untracked_walk_t walk = { counter, opts };
+	filesystem_walk(parent, list_untracked_file, &walk);
+}
 
-	unsigned char checksum[16];
-	MD5_Final(checksum, &ctx);
 
-	for(int i = 0; i < 16; i++)
-		sprintf(result + 2 * i, "%02x", checksum[i]);
-	result[32] = '\0';
+static mtree_type_t filesystem_entry_get_type(struct filesystem_entry_t * entry) {
+	     if(filesystem_entry_is_regular_file (entry)) return MTREE_TYPE_FILE;
+	else if(filesystem_entry_is_directory    (entry)) return MTREE_TYPE_DIR;
+	else if(filesystem_entry_is_symbolic_link(entry)) return MTREE_TYPE_LINK;
+	else if(filesystem_entry_is_fifo         (entry)) return MTREE_TYPE_FIFO;
+	else if(filesystem_entry_is_block_device (entry)) return MTREE_TYPE_BLOCK;
+	else if(filesystem_entry_is_char_device  (entry)) return MTREE_TYPE_CHAR;
+	else if(filesystem_entry_is_socket       (entry)) return MTREE_TYPE_SOCKET;
+	else                                              return MTREE_TYPE_UNKNOWN;
+}
 
-	return 0;
+
+/**
+ * Reports that what of the entry at path is actual instead of expected.
+ */
+static void report_modified(const char * path, const char * what, const char * expected, const char * actual, options_t * opts) {
+	if(opts->verdict != NULL) {
+		free(*opts->verdict);
+		if(asprintf(opts->verdict, "[modified]  %s %s != %s: %s", what, expected, actual, path) == -1)
+			*opts->verdict = NULL;
+	}
+	else
+		fprintf(opts->output, "%s[modified]%s  %s %s != %s: %s\n", opts->YELLOW, opts->RESET, what, expected, actual, path);
 }
 
 
-static bool perform_diff(const char * path, struct mtree_entry_t * db_entry, struct filesystem_entry_t * fs_entry, options_t * opts) {
-	const char * db_type = mtree_entry_get_keyword(db_entry, MTREE_KEYWORD_TYPE);
-	const char * fs_type = filesystem_entry_get_type_string(fs_entry);
-	if(strcmp(db_type, fs_type) != 0) {
-		printf("%s[modified]%s  type %s != %s: %s\n", opts->YELLOW, opts->RESET, db_type, fs_type, path);
+/**
+ * Reports that the value of a numeric keyword differs from actual, formatted with format.
+ */
+static void report_modified_keyword(const char * path, struct mtree_entry_t * db_entry, mtree_keyword_t keyword, const char * format, unsigned long long actual, options_t * opts) {
+	char expected_string[MTREE_KEYWORD_FORMAT_SIZE],
+	     actual_string[MTREE_KEYWORD_FORMAT_SIZE];
+	snprintf(actual_string, sizeof(actual_string), format, actual);
+	report_modified(path, mtree_keyword_to_string(keyword), mtree_entry_format_keyword(db_entry, keyword, expected_string, sizeof(expected_string)), actual_string, opts);
+}
+
+
+static void report_digest_mismatch(const char * path, verify_digest_t digest, const char * expected, const char * actual, size_t job, void * user_data) {
+	report_modified(path, verify_digest_to_string(digest), expected, actual, (options_t *)user_data);
+}
+
+
+/**
+ * Picks the digest to verify an entry with, based on the digest mode and the keywords available in the entry.
+ * Returns false if the entry has no usable digest at all.
+ */
+static bool select_digest(struct mtree_entry_t * db_entry, options_t * opts, verify_digest_t * digest, const unsigned char ** expected) {
+	const unsigned char * md5    = mtree_entry_get_digest(db_entry, MTREE_KEYWORD_MD5DIGEST),
+	                    * sha256 = mtree_entry_get_digest(db_entry, MTREE_KEYWORD_SHA256DIGEST);
+
+	bool prefer_sha256 = (opts->digest == DIGEST_MODE_SHA256 || (opts->digest == DIGEST_MODE_AUTO && sha256_accelerated()));
+	if(sha256 != NULL && (prefer_sha256 || md5 == NULL)) {
+		*digest   = VERIFY_DIGEST_SHA256;
+		*expected = sha256;
+		return true;
+	}
+	if(md5 != NULL) {
+		*digest   = VERIFY_DIGEST_MD5;
+		*expected = md5;
+		return true;
+	}
+	return false;
+}
+
+
+/**
+ * Compares the metadata of an entry and queues its contents for verification. A keyword missing from the entry
+ * never matches. Values are only formatted to be reported.
+ * Returns true if a modification was found right away; content mismatches are reported later via verify_collect.
+ */
+static bool perform_diff(const char * path, struct mtree_entry_t * db_entry, struct filesystem_entry_t * fs_entry, struct verify_t * verifier, options_t * opts) {
+	mtree_type_t db_type = mtree_entry_get_type(db_entry),
+	             fs_type = filesystem_entry_get_type(fs_entry);
+	if(db_type == MTREE_TYPE_UNKNOWN || db_type != fs_type) {
+		report_modified(path, "type", mtree_entry_has_keyword(db_entry, MTREE_KEYWORD_TYPE) ? mtree_type_to_string(db_type) : "", mtree_type_to_string(fs_type), opts);
 		return true;
 	}
 
 	if(!opts->ignore_mode) {
-		const char * db_mode = mtree_entry_get_keyword(db_entry, MTREE_KEYWORD_MODE);
-		char         fs_mode[64];
-		snprintf(fs_mode, sizeof(fs_mode), "%o", filesystem_entry_get_mode(fs_entry) & 07777);
-		if(strcmp(db_mode, fs_mode) != 0) {
-			printf("%s[modified]%s  mode %s != %s: %s\n", opts->YELLOW, opts->RESET, db_mode, fs_mode, path);
+		mode_t fs_mode = filesystem_entry_get_mode(fs_entry) & 07777;
+		if(!mtree_entry_has_keyword(db_entry, MTREE_KEYWORD_MODE) || mtree_entry_get_mode(db_entry) != fs_mode) {
+			report_modified_keyword(path, db_entry, MTREE_KEYWORD_MODE, "%llo", fs_mode, opts);
 			return true;
 		}
 	}
 
 	if(!opts->ignore_uid) {
-		const char * db_uid = mtree_entry_get_keyword(db_entry, MTREE_KEYWORD_UID);
-		char         fs_uid[64];
-		snprintf(fs_uid, sizeof(fs_uid), "%u", filesystem_entry_get_uid(fs_entry));
-		if(strcmp(db_uid, fs_uid) != 0) {
-			printf("%s[modified]%s  uid %s != %s: %s\n", opts->YELLOW, opts->RESET, db_uid, fs_uid, path);
+		uid_t fs_uid = filesystem_entry_get_uid(fs_entry);
+		if(!mtree_entry_has_keyword(db_entry, MTREE_KEYWORD_UID) || mtree_entry_get_uid(db_entry) != fs_uid) {
+			report_modified_keyword(path, db_entry, MTREE_KEYWORD_UID, "%llu", fs_uid, opts);
 			return true;
 		}
 	}
 
 	if(!opts->ignore_gid) {
-		const char * db_gid = mtree_entry_get_keyword(db_entry, MTREE_KEYWORD_GID);
-		char         fs_gid[64];
-		snprintf(fs_gid, sizeof(fs_gid), "%u", filesystem_entry_get_gid(fs_entry));
-		if(strcmp(db_gid, fs_gid) != 0) {
-			printf("%s[modified]%s  gid %s != %s: %s\n", opts->YELLOW, opts->RESET, db_gid, fs_gid, path);
+		gid_t fs_gid = filesystem_entry_get_gid(fs_entry);
+		if(!mtree_entry_has_keyword(db_entry, MTREE_KEYWORD_GID) || mtree_entry_get_gid(db_entry) != fs_gid) {
+			report_modified_keyword(path, db_entry, MTREE_KEYWORD_GID, "%llu", fs_gid, opts);
 			return true;
 		}
 	}
 
 	if(filesystem_entry_is_regular_file(fs_entry)) {
-		const char * db_size = mtree_entry_get_keyword(db_entry, MTREE_KEYWORD_SIZE);
-		char         fs_size[64];
-		snprintf(fs_size, sizeof(fs_size), "%jd", (intmax_t)filesystem_regular_file_get_size(fs_entry));
-		if(strcmp(db_size, fs_size) != 0) {
-			printf("%s[modified]%s  size %s != %s: %s\n", opts->YELLOW, opts->RESET, db_size, fs_size, path);
+		off_t fs_size = filesystem_regular_file_get_size(fs_entry);
+		if(!mtree_entry_has_keyword(db_entry, MTREE_KEYWORD_SIZE) || mtree_entry_get_size(db_entry) != fs_size) {
+			report_modified_keyword(path, db_entry, MTREE_KEYWORD_SIZE, "%llu", fs_size, opts);
 			return true;
 		}
 
-		if(!opts->ignore_md5) {
-			const char * db_md5checksum = mtree_entry_get_keyword(db_entry, MTREE_KEYWORD_MD5DIGEST);
-			char         fs_md5checksum[33];
-			if(md5sum(path, fs_md5checksum) == 0 && strcmp(db_md5checksum, fs_md5checksum) != 0) {
-				printf("%s[modified]%s  md5 %s != %s: %s\n", opts->YELLOW, opts->RESET, db_md5checksum, fs_md5checksum, path);
-				return true;
-			}
+		struct timespec mtime = filesystem_entry_get_mtimespec(fs_entry),
+		                ctime = filesystem_entry_get_ctimespec(fs_entry),
+		                db_mtime;
+
+		// size, mode and owner match; with an unchanged mtime as well, the contents are taken for granted
+		if(opts->trust_mtime && mtree_entry_get_time(db_entry, &db_mtime) && db_mtime.tv_sec == mtime.tv_sec && db_mtime.tv_nsec == mtime.tv_nsec)
+			return false;
+
+		verify_digest_t       digest;
+		const unsigned char * expected;
+		if(!opts->ignore_md5 && select_digest(db_entry, opts, &digest, &expected)) {
+			cache_key_t key;
+			memset(&key, 0, sizeof(key));
+			key.device = filesystem_entry_get_device(fs_entry);
+			key.inode  = filesystem_entry_get_inode(fs_entry);
+			key.size   = fs_size;
+			key.mtime  = (int64_t)mtime.tv_sec * 1000000000 + mtime.tv_nsec;
+			key.ctime  = (int64_t)ctime.tv_sec * 1000000000 + ctime.tv_nsec;
+			size_t job = verify_submit(verifier, path, &key, digest, expected);
+			if(opts->job != NULL)
+				*opts->job = job;
 		}
 	}
 	else if(filesystem_entry_is_symbolic_link(fs_entry)) {
-		const char * db_link = mtree_entry_get_keyword(db_entry, MTREE_KEYWORD_LINK);
+		const char * db_link = mtree_entry_get_link(db_entry);
 		const char * fs_link = filesystem_symbolic_link_get_target(fs_entry);
-		if(strcmp(db_link, fs_link) != 0) {
-			printf("%s[modified]%s  link %s != %s: %s\n", opts->YELLOW, opts->RESET, db_link, fs_link, path);
+		if(!mtree_entry_has_keyword(db_entry, MTREE_KEYWORD_LINK) || strcmp(db_link, fs_link) != 0) {
+			report_modified(path, "link", db_link, fs_link, opts);
 			return true;
 		}
 	}
@@ -203,16 +320,880 @@ static bool perform_diff(const char * path, struct mtree_entry_t * db_entry, str
 }
 
 
+/**
+ * Size of the chunks mtree files are decompressed and parsed in. Large enough for nearly all mtree files to be
+ * inflated in one go, only the largest ones are streamed.
+ */
+#define MTREE_CHUNK_SIZE (1024 * 1024)
+
+
+static void feed_mtree_parser(const char * data, size_t size, void * user_data) {
+	mtree_parser_feed((struct mtree_parser_t *)user_data, data, size);
+}
+
+
+/**
+ * Streams the mtree file of a package through parser, which hands over every entry as soon as it is parsed, while
+ * the rest of the file is still being decompressed. Returns false if the package has no mtree file.
+ */
+static bool read_package_entries(alpm_pkg_t * pkg, options_t * opts, struct mtree_parser_t * parser) {
+	// for now i don't know a better way to locate the mtree file than to use a hardcoded location
+	char * mtree_filepath;
+	asprintf(&mtree_filepath, "%slocal/%s-%s/mtree", opts->db_path, alpm_pkg_get_name(pkg), alpm_pkg_get_version(pkg));
+
+	// the mtree files, if existant, is gzipped
+	int status = read_gzip_file_chunked(mtree_filepath, MTREE_CHUNK_SIZE, feed_mtree_parser, parser);
+	free(mtree_filepath);
+	if(status != 0) {
+		mtree_parser_discard(parser);
+		fprintf(stderr, "error: Package `%s-%s' does not have an mtree file. This happens for very old packages. Please update or rebuild this package and try again.\n", alpm_pkg_get_name(pkg), alpm_pkg_get_version(pkg));
+		return false;
+	}
+	mtree_parser_finish(parser);
+	return true;
+}
+
+
+/**
+ * State of a regular run, shared by the entries of all packages.
+ */
+typedef struct {
+	struct filesystem_cursor_t * cursor;
+	struct verify_t *            verifier;
+	options_t *                  opts;
+	size_t *                     counter_tracked;
+	size_t *                     counter_missing;
+	size_t *                     counter_modified;
+} diff_run_t;
+
+
+/**
+ * Compares an entry with the file system as soon as it is parsed, and releases it.
+ */
+static void diff_entry(struct mtree_entry_t * db_entry, void * user_data) {
+	diff_run_t * run      = (diff_run_t *)user_data;
+	options_t *  opts     = run->opts;
+	const char * filepath = mtree_entry_get_filepath(db_entry);
+
+	// ignored paths aren't looked up, so ignored trees are never read
+	if(string_vector_contains(skip, filepath) || is_ignored(filepath, opts)) {
+		mtree_entry_destroy(db_entry);
+		return;
+	}
+
+	struct filesystem_entry_t * fs_entry = filesystem_cursor_resolve(run->cursor, filepath);
+	if(fs_entry == NULL || filesystem_entry_has_vanished(fs_entry)) {
+		printf("%s[missing]%s   %s\n", opts->RED, opts->RESET, filepath);
+		(*run->counter_missing)++;
+		if(fs_entry != NULL)
+			filesystem_entry_set_tracked(fs_entry); // not untracked either
+	}
+	else {
+		// mark the filesystem entry as 'tracked'
+		if(!filesystem_entry_is_tracked(fs_entry)) {
+			(*run->counter_tracked)++;
+			filesystem_entry_set_tracked(fs_entry);
+		}
+
+		if(perform_diff(filepath, db_entry, fs_entry, run->verifier, opts))
+			(*run->counter_modified)++;
+	}
+	mtree_entry_destroy(db_entry);
+}
+
+
+/**
+ * An mtree entry kept by the daemon, with what the last comparison reported for it.
+ */
+typedef struct {
+	struct mtree_entry_t * db_entry;
+	char *                 verdict; // a report line, NULL if the entry matches the file system
+	size_t                 job;     // its latest content check, DAEMON_NO_JOB if none was submitted
+} daemon_entry_t;
+
+
+#define DAEMON_NO_JOB SIZE_MAX
+
+
+/**
+ * The diff as written to clients, built once per state and shared by the clients it is still written to.
+ */
+typedef struct {
+	char * data;
+	size_t size;
+	size_t references;
+} daemon_report_t;
+
+
+/**
+ * A client the diff is written to as its socket takes it, so a client that doesn't read holds up nobody.
+ */
+typedef struct {
+	int               fd;
+	daemon_report_t * report;
+	size_t            written;
+	time_t            accepted;
+} daemon_client_t;
+
+
+typedef struct {
+	char * path;
+	bool   moved; // created, removed or renamed, so its directory has to be read again
+} daemon_change_t;
+
+
+/**
+ * The daemon keeps the entries of all packages sorted by path, so the entries a change touches are found by
+ * binary search: the entry at its path and, if it moved, the contiguous range of entries below it.
+ */
+typedef struct {
+	options_t *           opts;
+	alpm_handle_t *       handle;
+	char *                db_path;  // resolved, as events report it
+	struct filesystem_t * filesystem;
+	struct verify_t *     verifier;
+	daemon_entry_t *      entries;
+	size_t                entries_count;
+	size_t                entries_allocated;
+	daemon_change_t *     changes;  // since the last update
+	size_t                changes_count;
+	size_t                changes_allocated;
+	bool                  overflow; // changes were lost
+	bool                  reload;   // the database changed, its packages have to be read again
+	bool                  verifying; // jobs were submitted since the verifier was last reset
+	struct cache_t *      cache;
+	time_t                cache_saved;
+	daemon_report_t *     report;   // of the current state, NULL once it changed
+	daemon_client_t *     clients;
+	size_t                clients_count;
+	size_t                clients_allocated;
+} daemon_t;
+
+
+static int compare_daemon_entries(const daemon_entry_t * a, const daemon_entry_t * b) {
+	return strcmp(mtree_entry_get_filepath(a->db_entry), mtree_entry_get_filepath(b->db_entry));
+}
+
+
+/**
+ * Keeps an entry of a package, unless it is skipped or ignored.
+ */
+static void daemon_add_entry(struct mtree_entry_t * db_entry, void * user_data) {
+	daemon_t *   daemon   = (daemon_t *)user_data;
+	const char * filepath = mtree_entry_get_filepath(db_entry);
+	if(string_vector_contains(skip, filepath) || is_ignored(filepath, daemon->opts)) {
+		mtree_entry_destroy(db_entry);
+		return;
+	}
+
+	if(daemon->entries_count == daemon->entries_allocated) {
+		daemon->entries_allocated = (daemon->entries_allocated > 0 ? daemon->entries_allocated * 2 : 4096);
+		daemon->entries           = (daemon_entry_t *)realloc(daemon->entries, daemon->entries_allocated * sizeof(daemon_entry_t));
+		assert(daemon->entries != NULL);
+	}
+	daemon->entries[daemon->entries_count].db_entry = db_entry;
+	daemon->entries[daemon->entries_count].verdict  = NULL;
+	daemon->entries[daemon->entries_count].job      = DAEMON_NO_JOB;
+	daemon->entries_count++;
+}
+
+
+/**
+ * Replaces the entries with those of all packages currently installed, sorted by path.
+ */
+static void daemon_load_entries(daemon_t * daemon) {
+	for(size_t i = 0; i < daemon->entries_count; i++) {
+		free(daemon->entries[i].verdict);
+		mtree_entry_destroy(daemon->entries[i].db_entry);
+	}
+	daemon->entries_count = 0;
+
+	struct mtree_parser_t * parser = mtree_parser_create(daemon_add_entry, daemon);
+	assert(parser != NULL);
+	for(alpm_list_t * it = alpm_db_get_pkgcache(alpm_get_localdb(daemon->handle)); it != NULL; it = alpm_list_next(it))
+		read_package_entries(it->data, daemon->opts, parser);
+	mtree_parser_destroy(parser);
+	qsort(daemon->entries, daemon->entries_count, sizeof(daemon_entry_t), (int (*)(const void *, const void *))compare_daemon_entries);
+}
+
+
+/**
+ * Reads the database again, with a new handle as libalpm keeps the packages of a handle once read. The old
+ * entries are kept if the database can't be opened.
+ */
+static bool daemon_reload(daemon_t * daemon) {
+	alpm_errno_t    err;
+	alpm_handle_t * handle = alpm_initialize(daemon->opts->root_path, daemon->opts->db_path, &err);
+	if(handle == NULL) {
+		fprintf(stderr, "warning: unable to reload the database: %s\n", alpm_strerror(err));
+		return false;
+	}
+	alpm_release(daemon->handle);
+	daemon->handle = handle;
+	daemon_load_entries(daemon);
+	printf("%zu entries, reloaded\n", daemon->entries_count);
+	fflush(stdout);
+	return true;
+}
+
+
+static volatile sig_atomic_t daemon_stopped = 0;
+
+
+static void daemon_stop(int signal) {
+	daemon_stopped = 1;
+}
+
+
+static int compare_daemon_changes(const daemon_change_t * a, const daemon_change_t * b) {
+	return strcmp(a->path, b->path);
+}
+
+
+/**
+ * Returns the index of the first entry whose path doesn't sort before path.
+ */
+static size_t daemon_lower_bound(const daemon_t * daemon, const char * path) {
+	size_t left  = 0,
+	       right = daemon->entries_count;
+	while(left < right) {
+		size_t mid = left + (right - left) / 2;
+		if(strcmp(mtree_entry_get_filepath(daemon->entries[mid].db_entry), path) < 0)
+			left = mid + 1;
+		else
+			right = mid;
+	}
+	return left;
+}
+
+
+static bool daemon_has_entry(const daemon_t * daemon, const char * path) {
+	size_t index = daemon_lower_bound(daemon, path);
+	return (index < daemon->entries_count && strcmp(mtree_entry_get_filepath(daemon->entries[index].db_entry), path) == 0);
+}
+
+
+/**
+ * Compares an entry with the file system entry at its path, which is NULL if there is none; content mismatches
+ * are filled in via daemon_report_digest_mismatch once collected.
+ */
+static void daemon_diff_entry(daemon_t * daemon, daemon_entry_t * entry, struct filesystem_entry_t * fs_entry) {
+	const char * path = mtree_entry_get_filepath(entry->db_entry);
+	free(entry->verdict);
+	entry->verdict = NULL;
+	entry->job     = DAEMON_NO_JOB;
+
+	if(fs_entry != NULL)
+		filesystem_entry_set_tracked(fs_entry);
+	if(fs_entry == NULL || filesystem_entry_has_vanished(fs_entry)) {
+		if(asprintf(&entry->verdict, "[missing]   %s", path) == -1)
+			entry->verdict = NULL;
+		return;
+	}
+
+	daemon->opts->verdict = &entry->verdict;
+	daemon->opts->job     = &entry->job;
+	perform_diff(path, entry->db_entry, fs_entry, daemon->verifier, daemon->opts);
+	daemon->opts->verdict = NULL;
+	daemon->opts->job     = NULL;
+	daemon->verifying    |= (entry->job != DAEMON_NO_JOB);
+}
+
+
+/**
+ * Fills in a content mismatch, unless the entry has been compared again since the check was submitted, which makes
+ * the result stale.
+ */
+static void daemon_report_digest_mismatch(const char * path, verify_digest_t digest, const char * expected, const char * actual, size_t job, void * user_data) {
+	daemon_t * daemon = (daemon_t *)user_data;
+
+	for(size_t i = daemon_lower_bound(daemon, path); i < daemon->entries_count; i++) {
+		daemon_entry_t * entry = &daemon->entries[i];
+		if(strcmp(mtree_entry_get_filepath(entry->db_entry), path) != 0)
+			break;
+		if(entry->job == job) {
+			daemon->opts->verdict = &entry->verdict;
+			report_modified(path, verify_digest_to_string(digest), expected, actual, daemon->opts);
+			daemon->opts->verdict = NULL;
+			break;
+		}
+	}
+}
+
+
+/**
+ * Interval in seconds the cache is saved at, at most, while the daemon runs.
+ */
+#define DAEMON_CACHE_INTERVAL 300
+
+
+static void daemon_release_report(daemon_report_t * report) {
+	if(--report->references > 0)
+		return;
+	free(report->data);
+	free(report);
+}
+
+
+/**
+ * Drops the diff built for clients, as the state changed; clients it is still written to keep their copy.
+ */
+static void daemon_invalidate_report(daemon_t * daemon) {
+	if(daemon->report == NULL)
+		return;
+	daemon_release_report(daemon->report);
+	daemon->report = NULL;
+}
+
+
+/**
+ * Reports the mismatches of the content checks finished so far, or of all of them if wait is true. Once none is
+ * pending, the memo of the verifier is dropped, so files are hashed again when they change again, and the cache
+ * is saved from time to time.
+ */
+static void daemon_collect(daemon_t * daemon, bool wait) {
+	if(!daemon->verifying)
+		return;
+	verify_release(daemon->verifier);
+	if(verify_collect(daemon->verifier, wait, daemon_report_digest_mismatch, daemon) > 0)
+		daemon_invalidate_report(daemon);
+	if(verify_get_pending(daemon->verifier) > 0)
+		return;
+	verify_reset(daemon->verifier);
+	daemon->verifying = false;
+
+	time_t now = time(NULL);
+	if(now - daemon->cache_saved >= DAEMON_CACHE_INTERVAL) {
+		save_cache(daemon->cache, daemon->opts);
+		daemon->cache_saved = now;
+	}
+}
+
+
+/**
+ * Compares all entries with the file system, as a regular run does; content checks are collected by the caller.
+ * Paths no package owns any more, since the packages were read again, are untracked again.
+ */
+static void daemon_diff_all(daemon_t * daemon) {
+	filesystem_entry_clear_tracked(filesystem_get_path(daemon->filesystem, "/"));
+	struct filesystem_cursor_t * cursor = filesystem_cursor_create(daemon->filesystem);
+	assert(cursor != NULL);
+	for(size_t i = 0; i < daemon->entries_count; i++) {
+		daemon_entry_t * entry = &daemon->entries[i];
+		daemon_diff_entry(daemon, entry, filesystem_cursor_resolve(cursor, mtree_entry_get_filepath(entry->db_entry)));
+	}
+	filesystem_cursor_destroy(cursor);
+}
+
+
+static void daemon_on_event(watch_event_t event, const char * path, void * user_data) {
+	daemon_t * daemon = (daemon_t *)user_data;
+	if(event == WATCH_EVENT_OVERFLOW) {
+		daemon->overflow = true;
+		return;
+	}
+
+	if(daemon->changes_count == daemon->changes_allocated) {
+		daemon->changes_allocated = (daemon->changes_allocated > 0 ? daemon->changes_allocated * 2 : 64);
+		daemon->changes           = (daemon_change_t *)realloc(daemon->changes, daemon->changes_allocated * sizeof(daemon_change_t));
+		assert(daemon->changes != NULL);
+	}
+	daemon->changes[daemon->changes_count].path  = strdup(path);
+	daemon->changes[daemon->changes_count].moved = (event == WATCH_EVENT_MOVED);
+	assert(daemon->changes[daemon->changes_count].path != NULL);
+	daemon->changes_count++;
+}
+
+
+/**
+ * Brings the tree up to date with a change and compares the entries it touches again.
+ */
+static void daemon_apply_change(daemon_t * daemon, const char * path, bool moved) {
+	if(is_ignored(path, daemon->opts))
+		return;
+
+	char * parent_path = strdup(path);
+	char * slash       = strrchr(parent_path, '/');
+	assert(slash != NULL);
+	if(slash == parent_path)
+		slash[1] = '\0'; // a child of the root
+	else
+		slash[0] = '\0';
+
+	char * prefix;
+	if(asprintf(&prefix, "%s/", path) == -1)
+		prefix = NULL;
+	assert(prefix != NULL);
+	size_t prefix_length = strlen(prefix);
+	size_t first         = daemon_lower_bound(daemon, path),
+	       first_below   = daemon_lower_bound(daemon, prefix);
+	bool   tracked       = (first < daemon->entries_count && strcmp(mtree_entry_get_filepath(daemon->entries[first].db_entry), path) == 0),
+	       tracked_below = (moved && first_below < daemon->entries_count && strncmp(mtree_entry_get_filepath(daemon->entries[first_below].db_entry), prefix, prefix_length) == 0);
+
+	// untracked entries are only listed by name, and only those in tracked directories, so the rest of the file
+	// system isn't read for nothing
+	bool parent_tracked = (strcmp(parent_path, "/") == 0 || daemon_has_entry(daemon, parent_path));
+	if(!tracked && !tracked_below && !(moved && parent_tracked)) {
+		free(prefix);
+		free(parent_path);
+		return;
+	}
+
+	struct filesystem_entry_t * fs_entry;
+	if(moved) {
+		// the entry may be a different one now, with different children
+		struct filesystem_entry_t * parent = filesystem_get_path(daemon->filesystem, parent_path);
+		if(parent != NULL)
+			filesystem_entry_refresh(parent);
+		fs_entry = filesystem_get_path(daemon->filesystem, path);
+		if(fs_entry != NULL)
+			filesystem_entry_forget(fs_entry);
+	}
+	else {
+		fs_entry = filesystem_get_path(daemon->filesystem, path);
+		if(fs_entry != NULL)
+			filesystem_entry_invalidate(fs_entry);
+	}
+
+	for(size_t i = first; tracked && i < daemon->entries_count && strcmp(mtree_entry_get_filepath(daemon->entries[i].db_entry), path) == 0; i++)
+		daemon_diff_entry(daemon, &daemon->entries[i], fs_entry);
+
+	if(tracked_below) {
+		struct filesystem_cursor_t * cursor = filesystem_cursor_create(daemon->filesystem);
+		assert(cursor != NULL);
+		for(size_t i = first_below; i < daemon->entries_count; i++) {
+			const char * entry_path = mtree_entry_get_filepath(daemon->entries[i].db_entry);
+			if(strncmp(entry_path, prefix, prefix_length) != 0)
+				break;
+			daemon_diff_entry(daemon, &daemon->entries[i], filesystem_cursor_resolve(cursor, entry_path));
+		}
+		filesystem_cursor_destroy(cursor);
+	}
+
+	free(prefix);
+	free(parent_path);
+}
+
+
+/**
+ * Returns whether path is in the database, which pacman changes as it installs, upgrades or removes packages.
+ */
+static bool daemon_is_database_path(const daemon_t * daemon, const char * path) {
+	size_t length = strlen(daemon->db_path);
+	while(length > 1 && daemon->db_path[length - 1] == '/')
+		length--;
+	return (strncmp(path, daemon->db_path, length) == 0 && (path[length] == '\0' || path[length] == '/'));
+}
+
+
+/**
+ * Returns whether pacman holds the lock of the database, so it is in the middle of a transaction.
+ */
+static bool daemon_is_database_locked(const daemon_t * daemon) {
+	char * lock_path;
+	if(asprintf(&lock_path, "%s/db.lck", daemon->db_path) == -1)
+		lock_path = NULL;
+	assert(lock_path != NULL);
+	bool locked = (access(lock_path, F_OK) == 0);
+	free(lock_path);
+	return locked;
+}
+
+
+/**
+ * Applies the changes collected since the last update, each path once, and submits the content checks they take.
+ * Packages are read again after a change to the database, once pacman is done with it.
+ */
+static void daemon_update(daemon_t * daemon) {
+	daemon_invalidate_report(daemon);
+
+	if(daemon->overflow)
+		daemon->reload = true; // the database may have changed as well
+	for(size_t i = 0; i < daemon->changes_count && !daemon->reload; i++)
+		daemon->reload = daemon_is_database_path(daemon, daemon->changes[i].path);
+
+	// pacman removes its lock at the end of a transaction, which is a change to the database again
+	bool reloaded = false;
+	if(daemon->reload && !daemon_is_database_locked(daemon)) {
+		reloaded       = daemon_reload(daemon);
+		daemon->reload = false;
+	}
+
+	if(daemon->overflow) {
+		// start over from the mtree entries kept in memory
+		filesystem_entry_forget(filesystem_get_path(daemon->filesystem, "/"));
+		daemon_diff_all(daemon);
+		daemon->overflow = false;
+	}
+	else {
+		qsort(daemon->changes, daemon->changes_count, sizeof(daemon_change_t), (int (*)(const void *, const void *))compare_daemon_changes);
+		for(size_t i = 0; i < daemon->changes_count; i++) {
+			bool moved = daemon->changes[i].moved;
+			while(i + 1 < daemon->changes_count && strcmp(daemon->changes[i].path, daemon->changes[i + 1].path) == 0)
+				moved |= daemon->changes[++i].moved;
+			daemon_apply_change(daemon, daemon->changes[i].path, moved);
+		}
+		// the tree is up to date now, but all entries may have changed with the packages
+		if(reloaded)
+			daemon_diff_all(daemon);
+	}
+
+	for(size_t i = 0; i < daemon->changes_count; i++)
+		free(daemon->changes[i].path);
+	daemon->changes_count = 0;
+}
+
+
+/**
+ * Writes the current diff in the format of a regular run into a buffer, to be written to clients from.
+ */
+static daemon_report_t * daemon_build_report(daemon_t * daemon) {
+	daemon_report_t * report = (daemon_report_t *)malloc(sizeof(daemon_report_t));
+	assert(report != NULL);
+	report->data       = NULL;
+	report->size       = 0;
+	report->references = 1;
+	FILE * output = open_memstream(&report->data, &report->size);
+	assert(output != NULL);
+
+	size_t counter_tracked_files   = 0,
+	       counter_untracked_files = 0,
+	       counter_missing_files   = 0,
+	       counter_modified_files  = 0;
+	for(size_t i = 0; i < daemon->entries_count; i++) {
+		const daemon_entry_t * entry   = &daemon->entries[i];
+		bool                   missing = (entry->verdict != NULL && strncmp(entry->verdict, "[missing]", 9) == 0);
+		if(!missing && (i == 0 || compare_daemon_entries(&daemon->entries[i - 1], entry) != 0))
+			counter_tracked_files++;
+		if(entry->verdict == NULL)
+			continue;
+		fprintf(output, "%s\n", entry->verdict);
+		if(missing)
+			counter_missing_files++;
+		else
+			counter_modified_files++;
+	}
+
+	daemon->opts->output = output;
+	list_untracked_files(filesystem_get_path(daemon->filesystem, "/"), &counter_untracked_files, daemon->opts);
+	daemon->opts->output = stdout;
+
+	fprintf(output, "%8zu tracked\n",   counter_tracked_files);
+	fprintf(output, "%8zu untracked\n", counter_untracked_files);
+	fprintf(output, "%8zu missing\n",   counter_missing_files);
+	fprintf(output, "%8zu modified\n",  counter_modified_files);
+	if(fclose(output) != 0) {
+		perror("open_memstream");
+		exit(EXIT_FAILURE);
+	}
+	return report;
+}
+
+
+/**
+ * Seconds a client gets to read the diff before it is dropped.
+ */
+#define DAEMON_CLIENT_TIMEOUT 5
+
+
+/**
+ * Milliseconds between looking for finished content checks while there are any pending.
+ */
+#define DAEMON_COLLECT_INTERVAL 20
+
+
+/**
+ * Writes as much of the diff to a client as its socket takes. Returns false once the client is done with, either
+ * as it got everything or as writing failed, and true if the rest has to wait until the socket is writable again.
+ */
+static bool daemon_write_client(daemon_client_t * client) {
+	while(client->written < client->report->size) {
+		ssize_t result = write(client->fd, client->report->data + client->written, client->report->size - client->written);
+		if(result == -1) {
+			if(errno == EINTR)
+				continue;
+			return (errno == EAGAIN || errno == EWOULDBLOCK);
+		}
+		client->written += (size_t)result;
+	}
+	return false;
+}
+
+
+static void daemon_drop_client(daemon_t * daemon, size_t index) {
+	close(daemon->clients[index].fd);
+	daemon_release_report(daemon->clients[index].report);
+	daemon->clients[index] = daemon->clients[--daemon->clients_count];
+}
+
+
+/**
+ * Starts writing the current diff to a newly connected client, whose socket is non-blocking; the diff is only
+ * built if the state changed since the last client.
+ */
+static void daemon_serve(daemon_t * daemon, int fd) {
+	if(daemon->report == NULL)
+		daemon->report = daemon_build_report(daemon);
+
+	if(daemon->clients_count == daemon->clients_allocated) {
+		daemon->clients_allocated = (daemon->clients_allocated > 0 ? daemon->clients_allocated * 2 : 4);
+		daemon->clients           = (daemon_client_t *)realloc(daemon->clients, daemon->clients_allocated * sizeof(daemon_client_t));
+		assert(daemon->clients != NULL);
+	}
+	daemon_client_t * client = &daemon->clients[daemon->clients_count++];
+	client->fd       = fd;
+	client->report   = daemon->report;
+	client->written  = 0;
+	client->accepted = time(NULL);
+	client->report->references++;
+
+	if(!daemon_write_client(client))
+		daemon_drop_client(daemon, daemon->clients_count - 1);
+}
+
+
+/**
+ * Watches every mounted file system that isn't ignored as a whole. Pseudo file systems can't be watched, which
+ * is fine as no package installs files there; any other file system left unwatched is warned about, as changes
+ * on it go unnoticed. Returns -1 if the root file system can't be watched (with errno set), 0 otherwise.
+ */
+static int daemon_watch_mounts(struct watch_t * watch, options_t * opts) {
+	FILE * mounts = setmntent("/proc/self/mounts", "r");
+	if(mounts == NULL) {
+		perror("setmntent");
+		exit(EXIT_FAILURE);
+	}
+
+	bool            root_watched = false;
+	int             root_error   = ENOENT;
+	struct mntent * mount;
+	while((mount = getmntent(mounts)) != NULL) {
+		bool root = (strcmp(mount->mnt_dir, "/") == 0);
+		if(ignore_match(opts->ignores, mount->mnt_dir) != IGNORE_MATCH_NONE)
+			continue;
+		if(watch_add(watch, mount->mnt_dir) == 0) {
+			root_watched |= root;
+			continue;
+		}
+
+		if(root)
+			root_error = errno;
+		else if(errno == EXDEV)
+			fprintf(stderr, "warning: unable to watch `%s', fanotify can't watch file systems of subvolumes as a whole: changes are not noticed there\n", mount->mnt_dir);
+		else if(errno != ENODEV && errno != EOPNOTSUPP)
+			fprintf(stderr, "warning: unable to watch `%s', changes are not noticed there: %s\n", mount->mnt_dir, strerror(errno));
+	}
+	endmntent(mounts);
+
+	if(!root_watched) {
+		errno = root_error;
+		return -1;
+	}
+	return 0;
+}
+
+
+static int daemon_listen(const char * path) {
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(address.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(address.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd == -1)
+		return -1;
+	unlink(path); // left over from a previous run
+
+	// the diff tells a lot about the system, so it is for root only
+	mode_t mask = umask(0077);
+	int    result = bind(fd, (struct sockaddr *)&address, sizeof(address));
+	umask(mask);
+	if(result != 0 || listen(fd, 16) != 0) {
+		int error = errno;
+		close(fd);
+		errno = error;
+		return -1;
+	}
+	return fd;
+}
+
+
+/**
+ * Compares all packages with the file system once, then keeps the result up to date from fanotify events and
+ * writes it to every client connecting to the socket at opts->daemon_path, until SIGINT or SIGTERM. handle is
+ * replaced whenever the database is read again. Returns the exit status.
+ */
+static int run_daemon(alpm_handle_t ** handle, struct filesystem_t * filesystem, struct verify_t * verifier, struct cache_t * cache, options_t * opts) {
+	// watch before the first comparison, so nothing changing during it goes unnoticed
+	struct watch_t * watch = watch_create();
+	if(watch == NULL) {
+		fprintf(stderr, "error: unable to watch the file system: %s\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+	if(daemon_watch_mounts(watch, opts) != 0) {
+		fprintf(stderr, "error: unable to watch the root file system: %s\n", strerror(errno));
+		watch_destroy(watch);
+		return EXIT_FAILURE;
+	}
+	if(watch_add(watch, opts->db_path) != 0)
+		fprintf(stderr, "warning: unable to watch `%s', packages are not read again once changed: %s\n", opts->db_path, strerror(errno));
+
+	int server = daemon_listen(opts->daemon_path);
+	if(server == -1) {
+		fprintf(stderr, "error: unable to listen on `%s': %s\n", opts->daemon_path, strerror(errno));
+		watch_destroy(watch);
+		return EXIT_FAILURE;
+	}
+
+	// reports go to clients, which don't get colors
+	opts->RED    = "";
+	opts->GREEN  = "";
+	opts->YELLOW = "";
+	opts->RESET  = "";
+
+	daemon_t daemon;
+	memset(&daemon, 0, sizeof(daemon));
+	daemon.opts        = opts;
+	daemon.handle      = *handle;
+	daemon.db_path     = realpath(opts->db_path, NULL);
+	daemon.filesystem  = filesystem;
+	daemon.verifier    = verifier;
+	daemon.cache       = cache;
+	daemon.cache_saved = time(NULL);
+	if(daemon.db_path == NULL)
+		daemon.db_path = strdup(opts->db_path);
+	assert(daemon.db_path != NULL);
+
+	// keep the entries of all packages
+	daemon_load_entries(&daemon);
+	daemon_diff_all(&daemon);
+	daemon_collect(&daemon, true);
+
+	// read every directory untracked entries are listed from now, instead of on the first query
+	FILE * null = fopen("/dev/null", "w");
+	if(null != NULL) {
+		opts->output = null;
+		list_untracked_files(filesystem_get_path(filesystem, "/"), NULL, opts);
+		opts->output = stdout;
+		fclose(null);
+	}
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = daemon_stop; // without SA_RESTART, so poll returns
+	sigaction(SIGINT,  &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	printf("%zu entries, listening on %s\n", daemon.entries_count, opts->daemon_path);
+	fflush(stdout);
+
+	// events, content checks and clients are all handled by this thread, which never blocks on any of them
+	int             status        = EXIT_SUCCESS;
+	struct pollfd * fds           = NULL;
+	size_t          fds_allocated = 0;
+	while(!daemon_stopped) {
+		if(fds_allocated < 2 + daemon.clients_count) {
+			fds_allocated = 2 + daemon.clients_allocated;
+			fds           = (struct pollfd *)realloc(fds, fds_allocated * sizeof(struct pollfd));
+			assert(fds != NULL);
+		}
+		fds[0] = (struct pollfd){ watch_get_fd(watch), POLLIN, 0 };
+		fds[1] = (struct pollfd){ server,              POLLIN, 0 };
+		for(size_t i = 0; i < daemon.clients_count; i++)
+			fds[2 + i] = (struct pollfd){ daemon.clients[i].fd, POLLOUT, 0 };
+
+		// workers don't wake the thread up, so finished checks are picked up at an interval
+		int timeout = -1;
+		if(daemon.verifying)
+			timeout = DAEMON_COLLECT_INTERVAL;
+		else if(daemon.clients_count > 0)
+			timeout = DAEMON_CLIENT_TIMEOUT * 1000;
+		int ready = poll(fds, 2 + daemon.clients_count, timeout);
+		if(ready == -1 && errno != EINTR) {
+			perror("poll");
+			status = EXIT_FAILURE;
+			break;
+		}
+
+		if(ready > 0 && (fds[0].revents & POLLIN)) {
+			if(watch_read(watch, daemon_on_event, &daemon) == -1) {
+				perror("fanotify");
+				status = EXIT_FAILURE;
+				break;
+			}
+			daemon_update(&daemon);
+		}
+		daemon_collect(&daemon, false);
+
+		// backwards, as dropping a client moves the last one in its place
+		time_t now = time(NULL);
+		for(size_t i = daemon.clients_count; i-- > 0;) {
+			bool pending = true;
+			if(ready > 0 && fds[2 + i].revents != 0)
+				pending = daemon_write_client(&daemon.clients[i]);
+			if(!pending || now - daemon.clients[i].accepted >= DAEMON_CLIENT_TIMEOUT)
+				daemon_drop_client(&daemon, i);
+		}
+
+		if(ready > 0 && (fds[1].revents & POLLIN)) {
+			int client = accept4(server, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+			if(client != -1)
+				daemon_serve(&daemon, client);
+		}
+	}
+
+	while(daemon.clients_count > 0)
+		daemon_drop_client(&daemon, daemon.clients_count - 1);
+	daemon_invalidate_report(&daemon);
+	free(daemon.clients);
+	free(fds);
+	close(server);
+	unlink(opts->daemon_path);
+	watch_destroy(watch);
+	for(size_t i = 0; i < daemon.entries_count; i++) {
+		free(daemon.entries[i].verdict);
+		mtree_entry_destroy(daemon.entries[i].db_entry);
+	}
+	for(size_t i = 0; i < daemon.changes_count; i++)
+		free(daemon.changes[i].path);
+	free(daemon.changes);
+	free(daemon.entries);
+	free(daemon.db_path);
+	*handle = daemon.handle; // the one reloaded last
+	return status;
+}
+
+
 int main(int argc, char ** argv) {
 	// process command line arguments
 	options_t opts;
 	opts.root_path       = default_root;
 	opts.db_path         = default_db_path;
+	opts.cache_path      = default_cache;
+	opts.cache_explicit  = false;
+	opts.snapshot_path   = NULL;
+	opts.daemon_path     = NULL;
 	opts.ignore_md5      = false;
 	opts.ignore_mode     = false;
 	opts.ignore_uid      = false;
 	opts.ignore_gid      = false;
-	opts.ignore_patterns = NULL;
+	opts.trust_mtime     = false;
+	opts.cache_neutral   = false;
+	opts.eager_scan      = false;
+	opts.trust_snapshot  = false;
+	opts.digest          = DIGEST_MODE_AUTO;
+	opts.ignores         = ignore_create();
+	assert(opts.ignores != NULL);
+	opts.jobs            = 0; // one per cpu
+	opts.schedule        = VERIFY_ORDER_SUBMISSION;
+	opts.output          = stdout;
+	opts.verdict         = NULL;
+	opts.job             = NULL;
 	opts.RED             = "";
 	opts.GREEN           = "";
 	opts.YELLOW          = "";
@@ -222,6 +1203,9 @@ int main(int argc, char ** argv) {
 	bool no_color          = false;
 	bool print_usage       = false;
 	bool print_version     = false;
+	const char * jobs      = NULL;
+	const char * digest    = NULL;
+	const char * schedule  = NULL;
 
 	while(true) {
 		int option_index = 0;
@@ -237,6 +1221,17 @@ int main(int argc, char ** argv) {
 			{ "no-default-ignores", no_argument,       NULL,  8 },
 			{ "help",               no_argument,       NULL,  9 },
 			{ "version",            no_argument,       NULL, 10 },
+			{ "jobs",               required_argument, NULL, 11 },
+			{ "digest",             required_argument, NULL, 12 },
+			{ "cache",              required_argument, NULL, 13 },
+			{ "no-cache",           no_argument,       NULL, 14 },
+			{ "schedule",           required_argument, NULL, 15 },
+			{ "trust-mtime",        no_argument,       NULL, 16 },
+			{ "page-cache-neutral", no_argument,       NULL, 17 },
+			{ "eager-scan",         no_argument,       NULL, 18 },
+			{ "snapshot",           required_argument, NULL, 19 },
+			{ "trust-snapshot",     no_argument,       NULL, 20 },
+			{ "daemon",             required_argument, NULL, 21 },
 			{ 0, 0, 0, 0 }
 		};
 		int c = getopt_long(argc, argv, "", long_options, &option_index);
@@ -250,11 +1245,22 @@ int main(int argc, char ** argv) {
 			case   3: opts.ignore_mode     = true;                                        break; // --ignore-mode
 			case   4: opts.ignore_uid      = true;                                        break; // --ignore-uid
 			case   5: opts.ignore_gid      = true;                                        break; // --ignore-gid
-			case   6: opts.ignore_patterns = alpm_list_add(opts.ignore_patterns, optarg); break; // --ignore
+			case   6: ignore_add(opts.ignores, optarg);                                   break; // --ignore
 			case   7: no_color             = true;                                        break; // --no-color
 			case   8: no_default_ignore    = true;                                        break; // --no-default-ignores
 			case   9: print_usage          = true;                                        break; // --help
 			case  10: print_version        = true;                                        break; // --version
+			case  11: jobs                 = optarg;                                      break; // --jobs
+			case  12: digest               = optarg;                                      break; // --digest
+			case  13: opts.cache_path      = optarg; opts.cache_explicit = true;          break; // --cache
+			case  14: opts.cache_path      = NULL;                                        break; // --no-cache
+			case  15: schedule             = optarg;                                      break; // --schedule
+			case  16: opts.trust_mtime     = true;                                        break; // --trust-mtime
+			case  17: opts.cache_neutral   = true;                                        break; // --page-cache-neutral
+			case  18: opts.eager_scan      = true;                                        break; // --eager-scan
+			case  19: opts.snapshot_path   = optarg;                                      break; // --snapshot
+			case  20: opts.trust_snapshot  = true;                                        break; // --trust-snapshot
+			case  21: opts.daemon_path     = optarg;                                      break; // --daemon
 			case '?': exit(EXIT_FAILURE);
 			default:  break;
 		}
@@ -268,15 +1274,35 @@ int main(int argc, char ** argv) {
 		printf("Perform a full diff between all pacman packages and the file system.\n");
 		printf("\n");
 		printf("Options:\n");
+		printf("  --cache <path>        checksum cache file (default %s)\n", default_cache);
+		printf("  --daemon <socket>     keep running and keep the diff up to date via fanotify,\n");
+		printf("                        writing it to every client connecting to this unix socket\n");
 		printf("  --db <path>           pacman db path (default %s)\n", default_db_path);
+		printf("  --digest <digest>     compare contents via md5, sha256 or auto (default auto:\n");
+		printf("                        sha256 if the cpu supports it natively, md5 otherwise)\n");
+		printf("  --eager-scan          scan the whole file system up front on --jobs threads,\n");
+		printf("                        instead of reading directories as they are needed\n");
 		printf("  --ignore <pattern>    ignore all entries matching this pattern\n");
-		printf("  --ignore-md5          don't compare md5 checksums\n");
+		printf("  --ignore-md5          don't compare checksums\n");
 		printf("  --ignore-mode         don't compare modes\n");
 		printf("  --ignore-gid          don't compare gids\n");
 		printf("  --ignore-uid          don't compare uids\n");
+		printf("  --jobs <n>            number of parallel hashing threads (default: number of cpus)\n");
+		printf("  --no-cache            don't use the checksum cache\n");
 		printf("  --no-color            disable colors in output\n");
 		printf("  --no-default-ignores  don't ignore anything by default\n");
+		printf("  --page-cache-neutral  drop file contents read for checksums from the page cache\n");
+		printf("                        again, unless they were cached before\n");
 		printf("  --root <path>         installation root (default %s)\n", default_root);
+		printf("  --schedule <order>    hash files in package, inode or extent order (default package);\n");
+		printf("                        inode and extent defer hashing until all packages are read,\n");
+		printf("                        which avoids seeking on rotational disks\n");
+		printf("  --snapshot <path>     keep the file system tree in this file, so the next run only\n");
+		printf("                        reads directories whose mtime or ctime changed since\n");
+		printf("  --trust-mtime         don't compare checksums of files whose mtime matches the package\n");
+		printf("  --trust-snapshot      take metadata of files in unchanged directories from the\n");
+		printf("                        snapshot instead of statting them; files changed in place\n");
+		printf("                        go unnoticed\n");
 		printf("  --help                display this help and exit\n");
 		printf("  --version             output version information and exit\n");
 		printf("\n");
@@ -291,6 +1317,35 @@ int main(int argc, char ** argv) {
 		exit(EXIT_SUCCESS);
 	}
 
+	if(jobs != NULL) {
+		char * end;
+		opts.jobs = strtoul(jobs, &end, 10);
+		if(*jobs == '\0' || *end != '\0' || opts.jobs == 0) {
+			fprintf(stderr, "error: invalid number of jobs `%s'\n", jobs);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if(digest != NULL) {
+		     if(strcmp(digest, "auto")   == 0) opts.digest = DIGEST_MODE_AUTO;
+		else if(strcmp(digest, "md5")    == 0) opts.digest = DIGEST_MODE_MD5;
+		else if(strcmp(digest, "sha256") == 0) opts.digest = DIGEST_MODE_SHA256;
+		else {
+			fprintf(stderr, "error: unknown digest `%s'\n", digest);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if(schedule != NULL) {
+		     if(strcmp(schedule, "package") == 0) opts.schedule = VERIFY_ORDER_SUBMISSION;
+		else if(strcmp(schedule, "inode")   == 0) opts.schedule = VERIFY_ORDER_INODE;
+		else if(strcmp(schedule, "extent")  == 0) opts.schedule = VERIFY_ORDER_EXTENT;
+		else {
+			fprintf(stderr, "error: unknown schedule `%s'\n", schedule);
+			exit(EXIT_FAILURE);
+		}
+	}
+
 	if(isatty(fileno(stdout)) && !no_color) {
 		opts.RED    = "\x1b[31m";
 		opts.GREEN  = "\x1b[32m";
@@ -300,7 +1355,7 @@ int main(int argc, char ** argv) {
 
 	if(!no_default_ignore) {
 		for(size_t i = 0; i < sizeof(default_ignores) / sizeof(default_ignores[0]); i++)
-			opts.ignore_patterns = alpm_list_add(opts.ignore_patterns, (void *)default_ignores[i]);
+			ignore_add(opts.ignores, default_ignores[i]);
 	}
 
 	// collect some stats
@@ -321,78 +1376,88 @@ int main(int argc, char ** argv) {
 	alpm_db_t * local_db = alpm_get_localdb(handle);
 	assert(local_db != NULL);
 
-	// initialize the filesystem handle
-	struct filesystem_t * filesystem = filesystem_open();
+	// initialize the filesystem handle, mtree paths are sorted so lookups go through a cursor
+	struct filesystem_t *        filesystem = filesystem_open();
+	struct filesystem_cursor_t * cursor     = filesystem_cursor_create(filesystem);
+	assert(cursor != NULL);
+	if(opts.snapshot_path != NULL)
+		filesystem_load_snapshot(filesystem, opts.snapshot_path, opts.trust_snapshot);
+	if(opts.eager_scan)
+		filesystem_scan(filesystem, opts.jobs, skip_ignored_directory, &opts);
 
-	// create an initial buffer that will be re-used for all mtree files
-	// it will grow on demand
-	unsigned int allocated = 4096;
-	char *       buffer    = (char *)malloc(allocated);
+	// start the hashing threads, file contents are verified in the background
+	struct cache_t * cache = NULL;
+	if(opts.cache_path != NULL) {
+		cache = cache_open(opts.cache_path);
+		assert(cache != NULL);
+	}
+	struct verify_t * verifier = verify_create(opts.jobs, opts.schedule, opts.cache_neutral, cache);
+	assert(verifier != NULL);
 
-	// process the mtree files for all installed packages
-	for(alpm_list_t * it = alpm_db_get_pkgcache(local_db); it != NULL; it = alpm_list_next(it)) {
-		alpm_pkg_t * pkg = it->data;
+	if(opts.daemon_path != NULL) {
+		filesystem_cursor_destroy(cursor);
+		int status = run_daemon(&handle, filesystem, verifier, cache, &opts);
+		verify_destroy(verifier);
+		save_cache(cache, &opts);
+		filesystem_close(filesystem);
+		ignore_destroy(opts.ignores);
+		alpm_release(handle);
+		if(cache != NULL)
+			cache_close(cache);
+		return status;
+	}
 
-		// for now i don't know a better way to locate the mtree file than to use a hardcoded location
-		char * mtree_filepath;
-		asprintf(&mtree_filepath, "%slocal/%s-%s/mtree", opts.db_path, alpm_pkg_get_name(pkg), alpm_pkg_get_version(pkg));
+	// entries are compared as they are parsed, while the rest of their mtree file is still being decompressed
+	diff_run_t run = { cursor, verifier, &opts, &counter_tracked_files, &counter_missing_files, &counter_modified_files };
+	struct mtree_parser_t * parser = mtree_parser_create(diff_entry, &run);
+	assert(parser != NULL);
 
-		// the mtree files, if existant, is gzipped
-		int size = read_gzip_file(mtree_filepath, &buffer, &allocated);
-		if(size < 0) {
-			fprintf(stderr, "error: Package `%s-%s' does not have an mtree file. This happens for very old packages. Please update or rebuild this package and try again.\n", alpm_pkg_get_name(pkg), alpm_pkg_get_version(pkg));
+	// process the mtree files for all installed packages
+	for(alpm_list_t * it = alpm_db_get_pkgcache(local_db); it != NULL; it = alpm_list_next(it)) {
+		if(!read_package_entries(it->data, &opts, parser))
 			continue;
-		}
-
-		// get a list of all entries from the mtree file
-		alpm_list_t * entries = mtree_parse(buffer);
-		assert(entries != NULL);
-
-		for(alpm_list_t * it_entry = entries; it_entry != NULL; it_entry = alpm_list_next(it_entry)) {
-			// TODO compare all entries with the filesystem
-			struct mtree_entry_t * db_entry = it_entry->data;
-			assert(db_entry != NULL);
-
-			const char * filepath = mtree_entry_get_filepath(db_entry);
-			if(string_vector_contains(skip, filepath))
-				continue;
 
-			struct filesystem_entry_t * fs_entry = filesystem_get_path(filesystem, filepath);
-			if(fs_entry == NULL) {
-				printf("%s[missing]%s   %s\n", opts.RED, opts.RESET, filepath);
-				counter_missing_files++;
-				continue;
-			}
+		// report the content checks that are already finished
+		counter_modified_files += verify_collect(verifier, false, report_digest_mismatch, &opts);
+	}
+	mtree_parser_destroy(parser);
 
-			// mark the filesystem entry as 'tracked'
-			if(filesystem_entry_get_user_data(fs_entry) == NULL) {
-				counter_tracked_files++;
-				filesystem_entry_set_user_data(fs_entry, malloc(1));
-			}
+	// wait for the remaining content checks
+	counter_modified_files += verify_collect(verifier, true, report_digest_mismatch, &opts);
+	size_t counter_duplicate_files = verify_get_duplicates(verifier);
+	verify_destroy(verifier);
 
-			if(perform_diff(filepath, db_entry, fs_entry, &opts))
-				counter_modified_files++;
-		}
-
-		// cleanup
-		alpm_list_free_inner(entries, (alpm_list_fn_free)mtree_entry_destroy);
-		alpm_list_free(entries);
-		free(mtree_filepath);
-	}
+	save_cache(cache, &opts);
 
 	// all tracked files have been marked, so we can list all unmarked files as untracked
 	struct filesystem_entry_t * entry = filesystem_get_path(filesystem, "/");
 	list_untracked_files(entry, &counter_untracked_files, &opts);
 
+	if(opts.snapshot_path != NULL && filesystem_save_snapshot(filesystem, opts.snapshot_path) != 0)
+		fprintf(stderr, "warning: unable to write snapshot `%s': %s\n", opts.snapshot_path, strerror(errno));
+
 	// print some stats
 	printf("%8zu tracked\n",   counter_tracked_files);
 	printf("%8zu untracked\n", counter_untracked_files);
 	printf("%8zu missing\n",   counter_missing_files);
 	printf("%8zu modified\n",  counter_modified_files);
+	printf("%8zu duplicate reads avoided\n", counter_duplicate_files);
+	printf("%8zu stat calls avoided\n",      filesystem_get_stats_avoided(filesystem));
+	printf("%8zu readlink calls avoided\n",  filesystem_get_readlinks_avoided(filesystem));
+	if(opts.snapshot_path != NULL)
+		printf("%8zu directories reused\n", filesystem_get_directories_reused(filesystem));
+	if(cache != NULL) {
+		printf("%8zu cache hits\n",   cache_get_hits(cache));
+		printf("%8zu cache misses\n", cache_get_misses(cache));
+	}
 
 	// release all handles
-	filesystem_close(filesystem, free);
+	filesystem_cursor_destroy(cursor);
+	filesystem_close(filesystem);
+	ignore_destroy(opts.ignores);
 	alpm_release(handle);
+	if(cache != NULL)
+		cache_close(cache);
 
 	return 0;
 }
@@ -0,0 +1,379 @@
+#include "md5_mb.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include "md5.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MD5_MB_X86
+#endif
+
+
+/**
+ * Kernel function type: processes one 64-byte block per lane, lanes with a NULL block are left untouched.
+ */
+typedef void (*md5_mb_fn_kernel)(md5_mb_t * ctx, const unsigned char * const * blocks);
+
+static md5_mb_fn_kernel md5_mb_kernel       = NULL;
+static size_t           md5_mb_kernel_lanes = 0;
+
+
+/**
+ * All 64 md5 steps, written against the vector macros V_ADD, V_SET1, V_ROTL, V_F, V_G, V_H and V_I.
+ * X is the transposed message: X[i] holds word i of every lane.
+ */
+#define MD5_MB_STEP(f, a, b, c, d, x, t, s) \
+	(a) = V_ADD((a), V_ADD(f((b), (c), (d)), V_ADD(X[(x)], V_SET1((int)(t))))); \
+	(a) = V_ADD(V_ROTL((a), (s)), (b));
+
+#define MD5_MB_STEPS \
+	MD5_MB_STEP(V_F, a, b, c, d,  0, 0xd76aa478,  7) \
+	MD5_MB_STEP(V_F, d, a, b, c,  1, 0xe8c7b756, 12) \
+	MD5_MB_STEP(V_F, c, d, a, b,  2, 0x242070db, 17) \
+	MD5_MB_STEP(V_F, b, c, d, a,  3, 0xc1bdceee, 22) \
+	MD5_MB_STEP(V_F, a, b, c, d,  4, 0xf57c0faf,  7) \
+	MD5_MB_STEP(V_F, d, a, b, c,  5, 0x4787c62a, 12) \
+	MD5_MB_STEP(V_F, c, d, a, b,  6, 0xa8304613, 17) \
+	MD5_MB_STEP(V_F, b, c, d, a,  7, 0xfd469501, 22) \
+	MD5_MB_STEP(V_F, a, b, c, d,  8, 0x698098d8,  7) \
+	MD5_MB_STEP(V_F, d, a, b, c,  9, 0x8b44f7af, 12) \
+	MD5_MB_STEP(V_F, c, d, a, b, 10, 0xffff5bb1, 17) \
+	MD5_MB_STEP(V_F, b, c, d, a, 11, 0x895cd7be, 22) \
+	MD5_MB_STEP(V_F, a, b, c, d, 12, 0x6b901122,  7) \
+	MD5_MB_STEP(V_F, d, a, b, c, 13, 0xfd987193, 12) \
+	MD5_MB_STEP(V_F, c, d, a, b, 14, 0xa679438e, 17) \
+	MD5_MB_STEP(V_F, b, c, d, a, 15, 0x49b40821, 22) \
+	MD5_MB_STEP(V_G, a, b, c, d,  1, 0xf61e2562,  5) \
+	MD5_MB_STEP(V_G, d, a, b, c,  6, 0xc040b340,  9) \
+	MD5_MB_STEP(V_G, c, d, a, b, 11, 0x265e5a51, 14) \
+	MD5_MB_STEP(V_G, b, c, d, a,  0, 0xe9b6c7aa, 20) \
+	MD5_MB_STEP(V_G, a, b, c, d,  5, 0xd62f105d,  5) \
+	MD5_MB_STEP(V_G, d, a, b, c, 10, 0x02441453,  9) \
+	MD5_MB_STEP(V_G, c, d, a, b, 15, 0xd8a1e681, 14) \
+	MD5_MB_STEP(V_G, b, c, d, a,  4, 0xe7d3fbc8, 20) \
+	MD5_MB_STEP(V_G, a, b, c, d,  9, 0x21e1cde6,  5) \
+	MD5_MB_STEP(V_G, d, a, b, c, 14, 0xc33707d6,  9) \
+	MD5_MB_STEP(V_G, c, d, a, b,  3, 0xf4d50d87, 14) \
+	MD5_MB_STEP(V_G, b, c, d, a,  8, 0x455a14ed, 20) \
+	MD5_MB_STEP(V_G, a, b, c, d, 13, 0xa9e3e905,  5) \
+	MD5_MB_STEP(V_G, d, a, b, c,  2, 0xfcefa3f8,  9) \
+	MD5_MB_STEP(V_G, c, d, a, b,  7, 0x676f02d9, 14) \
+	MD5_MB_STEP(V_G, b, c, d, a, 12, 0x8d2a4c8a, 20) \
+	MD5_MB_STEP(V_H, a, b, c, d,  5, 0xfffa3942,  4) \
+	MD5_MB_STEP(V_H, d, a, b, c,  8, 0x8771f681, 11) \
+	MD5_MB_STEP(V_H, c, d, a, b, 11, 0x6d9d6122, 16) \
+	MD5_MB_STEP(V_H, b, c, d, a, 14, 0xfde5380c, 23) \
+	MD5_MB_STEP(V_H, a, b, c, d,  1, 0xa4beea44,  4) \
+	MD5_MB_STEP(V_H, d, a, b, c,  4, 0x4bdecfa9, 11) \
+	MD5_MB_STEP(V_H, c, d, a, b,  7, 0xf6bb4b60, 16) \
+	MD5_MB_STEP(V_H, b, c, d, a, 10, 0xbebfbc70, 23) \
+	MD5_MB_STEP(V_H, a, b, c, d, 13, 0x289b7ec6,  4) \
+	MD5_MB_STEP(V_H, d, a, b, c,  0, 0xeaa127fa, 11) \
+	MD5_MB_STEP(V_H, c, d, a, b,  3, 0xd4ef3085, 16) \
+	MD5_MB_STEP(V_H, b, c, d, a,  6, 0x04881d05, 23) \
+	MD5_MB_STEP(V_H, a, b, c, d,  9, 0xd9d4d039,  4) \
+	MD5_MB_STEP(V_H, d, a, b, c, 12, 0xe6db99e5, 11) \
+	MD5_MB_STEP(V_H, c, d, a, b, 15, 0x1fa27cf8, 16) \
+	MD5_MB_STEP(V_H, b, c, d, a,  2, 0xc4ac5665, 23) \
+	MD5_MB_STEP(V_I, a, b, c, d,  0, 0xf4292244,  6) \
+	MD5_MB_STEP(V_I, d, a, b, c,  7, 0x432aff97, 10) \
+	MD5_MB_STEP(V_I, c, d, a, b, 14, 0xab9423a7, 15) \
+	MD5_MB_STEP(V_I, b, c, d, a,  5, 0xfc93a039, 21) \
+	MD5_MB_STEP(V_I, a, b, c, d, 12, 0x655b59c3,  6) \
+	MD5_MB_STEP(V_I, d, a, b, c,  3, 0x8f0ccc92, 10) \
+	MD5_MB_STEP(V_I, c, d, a, b, 10, 0xffeff47d, 15) \
+	MD5_MB_STEP(V_I, b, c, d, a,  1, 0x85845dd1, 21) \
+	MD5_MB_STEP(V_I, a, b, c, d,  8, 0x6fa87e4f,  6) \
+	MD5_MB_STEP(V_I, d, a, b, c, 15, 0xfe2ce6e0, 10) \
+	MD5_MB_STEP(V_I, c, d, a, b,  6, 0xa3014314, 15) \
+	MD5_MB_STEP(V_I, b, c, d, a, 13, 0x4e0811a1, 21) \
+	MD5_MB_STEP(V_I, a, b, c, d,  4, 0xf7537e82,  6) \
+	MD5_MB_STEP(V_I, d, a, b, c, 11, 0xbd3af235, 10) \
+	MD5_MB_STEP(V_I, c, d, a, b,  2, 0x2ad7d2bb, 15) \
+	MD5_MB_STEP(V_I, b, c, d, a,  9, 0xeb86d391, 21)
+
+
+/**
+ * Transposes one block per lane into words[i][lane]. Lanes without a block get zeros.
+ */
+static inline void md5_mb_transpose(const unsigned char * const * blocks, size_t lanes, uint32_t words[16][MD5_MB_MAX_LANES]) {
+	for(size_t lane = 0; lane < lanes; lane++) {
+		if(blocks[lane] == NULL) {
+			for(size_t i = 0; i < 16; i++)
+				words[i][lane] = 0;
+			continue;
+		}
+		for(size_t i = 0; i < 16; i++) {
+			const unsigned char * p = blocks[lane] + 4 * i;
+			words[i][lane] = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+		}
+	}
+}
+
+
+#ifdef MD5_MB_X86
+
+#define MD5_MB_KERNEL(name, isa, vector, lanes, load, store) \
+	__attribute__((target(isa))) static void name(md5_mb_t * ctx, const unsigned char * const * blocks) { \
+		uint32_t words[16][MD5_MB_MAX_LANES] __attribute__((aligned(64))); \
+		md5_mb_transpose(blocks, (lanes), words); \
+		vector X[16]; \
+		for(size_t i = 0; i < 16; i++) \
+			X[i] = load(words[i]); \
+		vector a = load(ctx->a), b = load(ctx->b), c = load(ctx->c), d = load(ctx->d); \
+		vector saved_a = a, saved_b = b, saved_c = c, saved_d = d; \
+		MD5_MB_STEPS \
+		a = V_ADD(a, saved_a); \
+		b = V_ADD(b, saved_b); \
+		c = V_ADD(c, saved_c); \
+		d = V_ADD(d, saved_d); \
+		/* lanes without a block keep their previous state */ \
+		uint32_t old_a[MD5_MB_MAX_LANES], old_b[MD5_MB_MAX_LANES], old_c[MD5_MB_MAX_LANES], old_d[MD5_MB_MAX_LANES]; \
+		memcpy(old_a, ctx->a, sizeof(old_a)); \
+		memcpy(old_b, ctx->b, sizeof(old_b)); \
+		memcpy(old_c, ctx->c, sizeof(old_c)); \
+		memcpy(old_d, ctx->d, sizeof(old_d)); \
+		store(ctx->a, a); \
+		store(ctx->b, b); \
+		store(ctx->c, c); \
+		store(ctx->d, d); \
+		for(size_t lane = 0; lane < (lanes); lane++) { \
+			if(blocks[lane] == NULL) { \
+				ctx->a[lane] = old_a[lane]; \
+				ctx->b[lane] = old_b[lane]; \
+				ctx->c[lane] = old_c[lane]; \
+				ctx->d[lane] = old_d[lane]; \
+			} \
+		} \
+	}
+
+
+// SSE2, 4 lanes
+#define V_ADD(x, y)  _mm_add_epi32((x), (y))
+#define V_XOR(x, y)  _mm_xor_si128((x), (y))
+#define V_AND(x, y)  _mm_and_si128((x), (y))
+#define V_OR(x, y)   _mm_or_si128((x), (y))
+#define V_SET1(x)    _mm_set1_epi32(x)
+#define V_ROTL(x, s) V_OR(_mm_slli_epi32((x), (s)), _mm_srli_epi32((x), 32 - (s)))
+#define V_F(x, y, z) V_XOR((z), V_AND((x), V_XOR((y), (z))))
+#define V_G(x, y, z) V_XOR((y), V_AND((z), V_XOR((x), (y))))
+#define V_H(x, y, z) V_XOR(V_XOR((x), (y)), (z))
+#define V_I(x, y, z) V_XOR((y), V_OR((x), V_XOR((z), V_SET1(-1))))
+#define V_LOAD(p)     _mm_load_si128((const __m128i *)(p))
+#define V_STORE(p, x) _mm_store_si128((__m128i *)(p), (x))
+MD5_MB_KERNEL(md5_mb_kernel_sse2, "sse2", __m128i, 4, V_LOAD, V_STORE)
+#undef V_ADD
+#undef V_XOR
+#undef V_AND
+#undef V_OR
+#undef V_SET1
+#undef V_ROTL
+#undef V_LOAD
+#undef V_STORE
+
+// AVX2, 8 lanes
+#define V_ADD(x, y)  _mm256_add_epi32((x), (y))
+#define V_XOR(x, y)  _mm256_xor_si256((x), (y))
+#define V_AND(x, y)  _mm256_and_si256((x), (y))
+#define V_OR(x, y)   _mm256_or_si256((x), (y))
+#define V_SET1(x)    _mm256_set1_epi32(x)
+#define V_ROTL(x, s) V_OR(_mm256_slli_epi32((x), (s)), _mm256_srli_epi32((x), 32 - (s)))
+#define V_LOAD(p)     _mm256_load_si256((const __m256i *)(p))
+#define V_STORE(p, x) _mm256_store_si256((__m256i *)(p), (x))
+MD5_MB_KERNEL(md5_mb_kernel_avx2, "avx2", __m256i, 8, V_LOAD, V_STORE)
+#undef V_ADD
+#undef V_XOR
+#undef V_AND
+#undef V_OR
+#undef V_SET1
+#undef V_ROTL
+#undef V_F
+#undef V_G
+#undef V_H
+#undef V_I
+#undef V_LOAD
+#undef V_STORE
+
+// AVX-512, 16 lanes; uses native rotates and ternary logic for the round functions
+#define V_ADD(x, y)  _mm512_add_epi32((x), (y))
+#define V_SET1(x)    _mm512_set1_epi32(x)
+#define V_ROTL(x, s) _mm512_rol_epi32((x), (s))
+#define V_F(x, y, z) _mm512_ternarylogic_epi32((x), (y), (z), 0xca) // x ? y : z
+#define V_G(x, y, z) _mm512_ternarylogic_epi32((z), (x), (y), 0xca) // z ? x : y
+#define V_H(x, y, z) _mm512_ternarylogic_epi32((x), (y), (z), 0x96) // x ^ y ^ z
+#define V_I(x, y, z) _mm512_ternarylogic_epi32((x), (y), (z), 0x39) // y ^ (x | ~z)
+#define V_LOAD(p)     _mm512_load_si512((const void *)(p))
+#define V_STORE(p, x) _mm512_store_si512((void *)(p), (x))
+MD5_MB_KERNEL(md5_mb_kernel_avx512, "avx512f", __m512i, 16, V_LOAD, V_STORE)
+#undef V_ADD
+#undef V_SET1
+#undef V_ROTL
+#undef V_F
+#undef V_G
+#undef V_H
+#undef V_I
+#undef V_LOAD
+#undef V_STORE
+
+
+__attribute__((constructor)) static void md5_mb_select_kernel() {
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f")) {
+		md5_mb_kernel       = md5_mb_kernel_avx512;
+		md5_mb_kernel_lanes = 16;
+	}
+	else if(__builtin_cpu_supports("avx2")) {
+		md5_mb_kernel       = md5_mb_kernel_avx2;
+		md5_mb_kernel_lanes = 8;
+	}
+	else if(__builtin_cpu_supports("sse2")) {
+		md5_mb_kernel       = md5_mb_kernel_sse2;
+		md5_mb_kernel_lanes = 4;
+	}
+}
+
+#endif
+
+
+size_t md5_mb_lanes() {
+	return md5_mb_kernel_lanes;
+}
+
+
+void md5_mb_init(md5_mb_t * ctx) {
+	memset(ctx, 0, sizeof(md5_mb_t));
+}
+
+
+void md5_mb_start(md5_mb_t * ctx, size_t lane) {
+	assert(lane < md5_mb_kernel_lanes && !ctx->active[lane]);
+	ctx->a[lane]            = 0x67452301;
+	ctx->b[lane]            = 0xefcdab89;
+	ctx->c[lane]            = 0x98badcfe;
+	ctx->d[lane]            = 0x10325476;
+	ctx->active[lane]       = true;
+	ctx->total[lane]        = 0;
+	ctx->data[lane]         = NULL;
+	ctx->data_length[lane]  = 0;
+	ctx->carry_length[lane] = 0;
+}
+
+
+void md5_mb_feed(md5_mb_t * ctx, size_t lane, const void * data, size_t size) {
+	assert(md5_mb_hungry(ctx, lane) && ctx->data_length[lane] == 0);
+	const unsigned char * ptr = (const unsigned char *)data;
+	ctx->total[lane] += size;
+
+	// complete the partial block first
+	if(ctx->carry_length[lane] > 0) {
+		size_t n = 64 - ctx->carry_length[lane];
+		if(n > size)
+			n = size;
+		memcpy(ctx->carry[lane] + ctx->carry_length[lane], ptr, n);
+		ctx->carry_length[lane] += n;
+		ptr  += n;
+		size -= n;
+	}
+
+	ctx->data[lane]        = ptr;
+	ctx->data_length[lane] = size;
+}
+
+
+bool md5_mb_hungry(const md5_mb_t * ctx, size_t lane) {
+	return ctx->active[lane] && ctx->carry_length[lane] < 64 && ctx->data_length[lane] < 64;
+}
+
+
+void md5_mb_run(md5_mb_t * ctx) {
+	size_t lanes = md5_mb_kernel_lanes;
+	while(true) {
+		bool any_active = false,
+		     any_hungry = false;
+		for(size_t lane = 0; lane < lanes; lane++) {
+			any_active |= ctx->active[lane];
+			any_hungry |= md5_mb_hungry(ctx, lane);
+		}
+		if(!any_active || any_hungry)
+			break;
+
+		const unsigned char * blocks[MD5_MB_MAX_LANES];
+		for(size_t lane = 0; lane < lanes; lane++) {
+			if(!ctx->active[lane])
+				blocks[lane] = NULL;
+			else if(ctx->carry_length[lane] == 64)
+				blocks[lane] = ctx->carry[lane];
+			else
+				blocks[lane] = ctx->data[lane];
+		}
+		md5_mb_kernel(ctx, blocks);
+
+		// the blocks are consumed only now, so a lane whose input faults leaves the context as it was
+		for(size_t lane = 0; lane < lanes; lane++) {
+			if(blocks[lane] == NULL)
+				continue;
+			if(blocks[lane] == ctx->carry[lane])
+				ctx->carry_length[lane] = 0;
+			else {
+				ctx->data[lane]        += 64;
+				ctx->data_length[lane] -= 64;
+			}
+		}
+	}
+
+	// move the remainder of every hungry lane into its carry buffer, so the caller may reuse its input buffer
+	for(size_t lane = 0; lane < lanes; lane++) {
+		if(md5_mb_hungry(ctx, lane) && ctx->data_length[lane] > 0) {
+			assert(ctx->carry_length[lane] == 0);
+			memcpy(ctx->carry[lane], ctx->data[lane], ctx->data_length[lane]);
+			ctx->carry_length[lane] = ctx->data_length[lane];
+			ctx->data_length[lane]  = 0;
+		}
+	}
+}
+
+
+void md5_mb_cancel(md5_mb_t * ctx, size_t lane) {
+	ctx->active[lane]       = false;
+	ctx->data_length[lane]  = 0;
+	ctx->carry_length[lane] = 0;
+}
+
+
+void md5_mb_final(unsigned char * result, md5_mb_t * ctx, size_t lane) {
+	assert(md5_mb_hungry(ctx, lane));
+	if(ctx->data_length[lane] > 0) {
+		assert(ctx->carry_length[lane] == 0);
+		memcpy(ctx->carry[lane], ctx->data[lane], ctx->data_length[lane]);
+		ctx->carry_length[lane] = ctx->data_length[lane];
+		ctx->data_length[lane]  = 0;
+	}
+
+	// the last one or two blocks are padded and hashed by the scalar implementation
+	MD5_CTX scalar;
+	uint64_t total = ctx->total[lane];
+#ifdef HAVE_OPENSSL
+	scalar.A   = ctx->a[lane];
+	scalar.B   = ctx->b[lane];
+	scalar.C   = ctx->c[lane];
+	scalar.D   = ctx->d[lane];
+	scalar.Nl  = (uint32_t)(total << 3);
+	scalar.Nh  = (uint32_t)(total >> 29);
+	scalar.num = ctx->carry_length[lane];
+	memcpy(scalar.data, ctx->carry[lane], ctx->carry_length[lane]);
+#else
+	scalar.a  = ctx->a[lane];
+	scalar.b  = ctx->b[lane];
+	scalar.c  = ctx->c[lane];
+	scalar.d  = ctx->d[lane];
+	scalar.lo = total & 0x1fffffff;
+	scalar.hi = total >> 29;
+	memcpy(scalar.buffer, ctx->carry[lane], ctx->carry_length[lane]);
+#endif
+	MD5_Final(result, &scalar);
+
+	ctx->active[lane]       = false;
+	ctx->carry_length[lane] = 0;
+}
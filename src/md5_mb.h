@@ -0,0 +1,89 @@
+#ifndef INCLUDE_MD5_MB_H
+#define INCLUDE_MD5_MB_H
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * Maximum number of lanes of any multi-buffer kernel.
+ */
+#define MD5_MB_MAX_LANES 16
+
+/**
+ * Multi-buffer md5 context. Each lane hashes an independent message; whole blocks of all active lanes are
+ * processed in lockstep by a SIMD kernel (SSE2: 4 lanes, AVX2: 8 lanes, AVX-512: 16 lanes) chosen at runtime.
+ * Treat all fields as private.
+ */
+typedef struct {
+	uint32_t              a[MD5_MB_MAX_LANES] __attribute__((aligned(64))),
+	                      b[MD5_MB_MAX_LANES] __attribute__((aligned(64))),
+	                      c[MD5_MB_MAX_LANES] __attribute__((aligned(64))),
+	                      d[MD5_MB_MAX_LANES] __attribute__((aligned(64)));
+
+	bool                  active[MD5_MB_MAX_LANES];
+	uint64_t              total[MD5_MB_MAX_LANES];        // bytes fed so far
+	const unsigned char * data[MD5_MB_MAX_LANES];         // pending input, not yet consumed
+	size_t                data_length[MD5_MB_MAX_LANES];
+	unsigned char         carry[MD5_MB_MAX_LANES][64];    // partial block left over between two feeds
+	size_t                carry_length[MD5_MB_MAX_LANES];
+} md5_mb_t;
+
+/**
+ * Returns the number of lanes of the kernel selected for this cpu, or 0 if no multi-buffer kernel is available.
+ * In the latter case, fall back to MD5_Init/MD5_Update/MD5_Final.
+ */
+size_t md5_mb_lanes();
+
+/**
+ * Initializes the context; all lanes are inactive afterwards.
+ */
+void md5_mb_init(md5_mb_t * ctx);
+
+/**
+ * Starts a new message on an inactive lane.
+ */
+void md5_mb_start(md5_mb_t * ctx, size_t lane);
+
+/**
+ * Hands the next piece of a message to a hungry lane. The data is not copied and has to stay valid until the
+ * lane is hungry again.
+ */
+void md5_mb_feed(md5_mb_t * ctx, size_t lane, const void * data, size_t size);
+
+/**
+ * Returns true if the lane is active and needs more input before md5_mb_run can process another block.
+ */
+bool md5_mb_hungry(const md5_mb_t * ctx, size_t lane);
+
+/**
+ * Processes whole blocks of all active lanes in lockstep until at least one of them is hungry.
+ * A block is only consumed once it has been read in full, so if reading the input of a lane faults (see
+ * reader_guard), the context stays consistent and that lane can be cancelled.
+ */
+void md5_mb_run(md5_mb_t * ctx);
+
+/**
+ * Deactivates a lane without completing its message, so it can be started over.
+ */
+void md5_mb_cancel(md5_mb_t * ctx, size_t lane);
+
+/**
+ * Completes the message of a hungry lane, writes the 16 byte digest to result and deactivates the lane.
+ */
+void md5_mb_final(unsigned char * result, md5_mb_t * ctx, size_t lane);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
@@ -1,47 +1,78 @@
 #include "mtree.h"
 
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-
-#include "string.h"
+#include <time.h>
 
 
 /**
- * Internal entry struct. If you add more entries, don't forget to adjust the following definitions:
- * - const    MTREE_ENTRY_ALL_KEYWORDS
+ * Parsed keyword values, keywords records which of them are set.
+ * If you add more keywords, don't forget to adjust the following definitions:
  * - function mtree_parse_keyword
  * - function mtree_keyword_to_string
- * - function mtree_entry_get_keyword_pointer
- * - function mtree_entry_create
+ * - function mtree_values_set
+ * - function mtree_values_get_pointer
+ * - function mtree_slot_size and const MTREE_SLOT_ORDER
+ * - function mtree_entry_format_keyword
  * - enum     mtree_keyword_t
  */
 typedef struct {
-	char * filepath;
-	char * time;
-	char * mode;
-	char * size;
-	char * type;
-	char * uid;
-	char * gid;
-	char * link;
-	char * md5digest;
-	char * sha256digest;
+	char *          link;
+	struct timespec time;
+	off_t           size;
+	mode_t          mode;
+	uid_t           uid;
+	gid_t           gid;
+	mtree_type_t    type;
+	unsigned char   md5digest[16];
+	unsigned char   sha256digest[32];
+	unsigned int    keywords; // bit (1 << keyword) is set for every keyword present
+} mtree_values_t;
+
+
+/**
+ * A generation of /set defaults. It is shared by all entries parsed while it was current and never changes once
+ * an entry refers to it: a /set or /unset after that starts a new generation.
+ */
+typedef struct {
+	mtree_values_t values;
+	size_t         references; // entries plus the parser while it is current
+} mtree_defaults_t;
+
+
+/**
+ * Internal entry struct. An entry only stores the keywords set on its own line, packed behind the struct in the
+ * order of MTREE_SLOT_ORDER and followed by the filepath, all in one allocation; every other keyword is looked up
+ * in its defaults.
+ */
+typedef struct {
+	char *             filepath;  // points behind the values
+	mtree_defaults_t * defaults;
+	unsigned int       overrides; // bit (1 << keyword) is set for every keyword stored in values
+	uint64_t           values[];  // 8 byte aligned storage of the overridden values
 } mtree_entry_internal_t;
 
 
+#define MTREE_KEYWORD_BIT(keyword) (1u << (keyword))
+
+
 /**
- * A static list of all supported keywords.
+ * Order of the overridden values behind an entry: those aligned to 8 bytes first, so no slot needs padding.
  */
-static const mtree_keyword_t MTREE_ENTRY_ALL_KEYWORDS[] = {
+static const mtree_keyword_t MTREE_SLOT_ORDER[] = {
 	MTREE_KEYWORD_TIME,
-	MTREE_KEYWORD_MODE,
 	MTREE_KEYWORD_SIZE,
-	MTREE_KEYWORD_TYPE,
+	MTREE_KEYWORD_LINK,
+	MTREE_KEYWORD_MODE,
 	MTREE_KEYWORD_UID,
 	MTREE_KEYWORD_GID,
-	MTREE_KEYWORD_LINK,
+	MTREE_KEYWORD_TYPE,
 	MTREE_KEYWORD_MD5DIGEST,
 	MTREE_KEYWORD_SHA256DIGEST
 };
@@ -93,72 +124,309 @@ const char * mtree_keyword_to_string(mtree_keyword_t keyword) {
 }
 
 
+mtree_type_t mtree_parse_type(const char * type) {
+	     if(!strcmp(type, "file"))   return MTREE_TYPE_FILE;
+	else if(!strcmp(type, "dir"))    return MTREE_TYPE_DIR;
+	else if(!strcmp(type, "link"))   return MTREE_TYPE_LINK;
+	else if(!strcmp(type, "fifo"))   return MTREE_TYPE_FIFO;
+	else if(!strcmp(type, "block"))  return MTREE_TYPE_BLOCK;
+	else if(!strcmp(type, "char"))   return MTREE_TYPE_CHAR;
+	else if(!strcmp(type, "socket")) return MTREE_TYPE_SOCKET;
+	else                             return MTREE_TYPE_UNKNOWN;
+}
+
+
+const char * mtree_type_to_string(mtree_type_t type) {
+	switch(type) {
+		default:                 return "unknown";
+		case MTREE_TYPE_FILE:    return "file";
+		case MTREE_TYPE_DIR:     return "dir";
+		case MTREE_TYPE_LINK:    return "link";
+		case MTREE_TYPE_FIFO:    return "fifo";
+		case MTREE_TYPE_BLOCK:   return "block";
+		case MTREE_TYPE_CHAR:    return "char";
+		case MTREE_TYPE_SOCKET:  return "socket";
+	}
+}
+
+
+/**
+ * Parses a non-negative number in the given base. Returns false unless the whole value is a number.
+ */
+static bool mtree_parse_number(const char * value, int base, unsigned long long * result) {
+	if(!isxdigit(value[0]))
+		return false;
+	char * end;
+	errno   = 0;
+	*result = strtoull(value, &end, base);
+	return (*end == '\0' && errno == 0);
+}
+
+
+/**
+ * Parses a time. The fraction counts nanoseconds, as written by libarchive: "1.5" means 1 s + 5 ns.
+ */
+static bool mtree_parse_time(const char * value, struct timespec * result) {
+	char * end;
+	long long seconds     = strtoll(value, &end, 10);
+	long      nanoseconds = 0;
+	if(end == value)
+		return false;
+	if(*end == '.')
+		nanoseconds = strtol(end + 1, &end, 10);
+	if(*end != '\0' || nanoseconds < 0 || nanoseconds > 999999999)
+		return false;
+
+	result->tv_sec  = seconds;
+	result->tv_nsec = nanoseconds;
+	return true;
+}
+
+
+/**
+ * Decodes a hex string of exactly 2 * size digits into result. Digits and letters are told apart without branches,
+ * which would be mispredicted all the time on random digests.
+ */
+static bool mtree_parse_hex(const char * value, unsigned char * result, size_t size) {
+	if(strnlen(value, 2 * size + 1) != 2 * size)
+		return false;
+
+	unsigned int valid = 1;
+	for(size_t i = 0; i < size; i++) {
+		unsigned char high = value[2 * i],
+		              low  = value[2 * i + 1];
+		valid &= ((unsigned char)(high - '0') < 10) | ((unsigned char)((high | 0x20) - 'a') < 6);
+		valid &= ((unsigned char)(low  - '0') < 10) | ((unsigned char)((low  | 0x20) - 'a') < 6);
+		// '0'-'9' are 0x30-0x39, 'A'-'F' and 'a'-'f' are 0x41-0x46 and 0x61-0x66
+		result[i] = (((high & 0xF) + 9 * (high >> 6)) << 4) | ((low & 0xF) + 9 * (low >> 6));
+	}
+	return valid;
+}
+
+
+static void mtree_format_hex(const unsigned char * digest, size_t size, char * result) {
+	static const char digits[] = "0123456789abcdef";
+	for(size_t i = 0; i < size; i++) {
+		result[2 * i]     = digits[digest[i] >> 4];
+		result[2 * i + 1] = digits[digest[i] & 0xF];
+	}
+	result[2 * size] = '\0';
+}
+
+
+static size_t mtree_slot_size(mtree_keyword_t keyword) {
+	switch(keyword) {
+		case MTREE_KEYWORD_TIME:         return sizeof(struct timespec);
+		case MTREE_KEYWORD_SIZE:         return sizeof(off_t);
+		case MTREE_KEYWORD_LINK:         return sizeof(char *);
+		case MTREE_KEYWORD_MODE:         return sizeof(mode_t);
+		case MTREE_KEYWORD_UID:          return sizeof(uid_t);
+		case MTREE_KEYWORD_GID:          return sizeof(gid_t);
+		case MTREE_KEYWORD_TYPE:         return sizeof(mtree_type_t);
+		case MTREE_KEYWORD_MD5DIGEST:    return 16;
+		case MTREE_KEYWORD_SHA256DIGEST: return 32;
+		default:                         return 0;
+	}
+}
+
+
 /**
  * Helper function to map keywords to their respective struct fields.
  */
-static char ** mtree_entry_get_keyword_pointer(struct mtree_entry_t * entry, mtree_keyword_t keyword) {
-	mtree_entry_internal_t * priv = (mtree_entry_internal_t *)entry;
+static const void * mtree_values_get_pointer(const mtree_values_t * values, mtree_keyword_t keyword) {
 	switch(keyword) {
-		case MTREE_KEYWORD_TIME:         return &priv->time;
-		case MTREE_KEYWORD_MODE:         return &priv->mode;
-		case MTREE_KEYWORD_SIZE:         return &priv->size;
-		case MTREE_KEYWORD_TYPE:         return &priv->type;
-		case MTREE_KEYWORD_UID:          return &priv->uid;
-		case MTREE_KEYWORD_GID:          return &priv->gid;
-		case MTREE_KEYWORD_LINK:         return &priv->link;
-		case MTREE_KEYWORD_MD5DIGEST:    return &priv->md5digest;
-		case MTREE_KEYWORD_SHA256DIGEST: return &priv->sha256digest;
+		case MTREE_KEYWORD_TIME:         return &values->time;
+		case MTREE_KEYWORD_SIZE:         return &values->size;
+		case MTREE_KEYWORD_LINK:         return &values->link;
+		case MTREE_KEYWORD_MODE:         return &values->mode;
+		case MTREE_KEYWORD_UID:          return &values->uid;
+		case MTREE_KEYWORD_GID:          return &values->gid;
+		case MTREE_KEYWORD_TYPE:         return &values->type;
+		case MTREE_KEYWORD_MD5DIGEST:    return values->md5digest;
+		case MTREE_KEYWORD_SHA256DIGEST: return values->sha256digest;
 		default:                         return NULL;
 	}
 }
 
 
+static void mtree_values_unset(mtree_values_t * values, mtree_keyword_t keyword) {
+	if(keyword == MTREE_KEYWORD_LINK && values->link != NULL) {
+		free(values->link);
+		values->link = NULL;
+	}
+	if(keyword != MTREE_KEYWORD_UNKNOWN)
+		values->keywords &= ~MTREE_KEYWORD_BIT(keyword);
+}
+
+
+static void mtree_values_init(mtree_values_t * values) {
+	memset(values, 0, sizeof(mtree_values_t));
+	values->link = NULL;
+}
+
+
+static void mtree_values_clear(mtree_values_t * values) {
+	free(values->link);
+	mtree_values_init(values);
+}
+
+
 /**
- * Const version of mtree_entry_get_keyword_pointer.
+ * Parses and sets the value of a keyword. Returns false and leaves the keyword unset if the value is malformed.
  */
-static const char ** mtree_entry_get_keyword_const_pointer(const struct mtree_entry_t * entry, mtree_keyword_t keyword) {
-	return (const char **)mtree_entry_get_keyword_pointer((struct mtree_entry_t *)entry, keyword);
+static bool mtree_values_set(mtree_values_t * values, mtree_keyword_t keyword, const char * value) {
+	mtree_values_unset(values, keyword);
+
+	// a value is taken only if it converts back to the same number
+	unsigned long long number;
+	bool               valid;
+	switch(keyword) {
+		case MTREE_KEYWORD_TIME:
+			valid = mtree_parse_time(value, &values->time);
+			break;
+		case MTREE_KEYWORD_MODE:
+			valid = (mtree_parse_number(value, 8, &number) && number <= 07777);
+			values->mode = number;
+			break;
+		case MTREE_KEYWORD_SIZE:
+			valid = mtree_parse_number(value, 10, &number);
+			values->size = number;
+			valid = (valid && values->size >= 0 && (unsigned long long)values->size == number);
+			break;
+		case MTREE_KEYWORD_TYPE:
+			values->type = mtree_parse_type(value);
+			valid = (values->type != MTREE_TYPE_UNKNOWN);
+			break;
+		case MTREE_KEYWORD_UID:
+			valid = mtree_parse_number(value, 10, &number);
+			values->uid = number;
+			valid = (valid && values->uid == number);
+			break;
+		case MTREE_KEYWORD_GID:
+			valid = mtree_parse_number(value, 10, &number);
+			values->gid = number;
+			valid = (valid && values->gid == number);
+			break;
+		case MTREE_KEYWORD_LINK:
+			values->link = strdup(value);
+			valid = (values->link != NULL);
+			break;
+		case MTREE_KEYWORD_MD5DIGEST:
+			valid = mtree_parse_hex(value, values->md5digest, sizeof(values->md5digest));
+			break;
+		case MTREE_KEYWORD_SHA256DIGEST:
+			valid = mtree_parse_hex(value, values->sha256digest, sizeof(values->sha256digest));
+			break;
+		default:
+			valid = false;
+			break;
+	}
+
+	if(valid)
+		values->keywords |= MTREE_KEYWORD_BIT(keyword);
+	return valid;
 }
 
 
-struct mtree_entry_t * mtree_entry_create() {
-	mtree_entry_internal_t * entry = (mtree_entry_internal_t *)malloc(sizeof(mtree_entry_internal_t));
-	if(entry == NULL)
-		return NULL;
-	memset(entry, 0, sizeof(mtree_entry_internal_t));
-	entry->time         = NULL;
-	entry->mode         = NULL;
-	entry->size         = NULL;
-	entry->type         = NULL;
-	entry->uid          = NULL;
-	entry->gid          = NULL;
-	entry->link         = NULL;
-	entry->md5digest    = NULL;
-	entry->sha256digest = NULL;
-	return (struct mtree_entry_t *)entry;
+static mtree_defaults_t * mtree_defaults_create() {
+	mtree_defaults_t * defaults = (mtree_defaults_t *)malloc(sizeof(mtree_defaults_t));
+	assert(defaults != NULL);
+	mtree_values_init(&defaults->values);
+	defaults->references = 1;
+	return defaults;
 }
 
 
-struct mtree_entry_t * mtree_entry_clone(const struct mtree_entry_t * entry) {
-	struct mtree_entry_t * clone = mtree_entry_create();
+static void mtree_defaults_release(mtree_defaults_t * defaults) {
+	if(--defaults->references == 0) {
+		mtree_values_clear(&defaults->values);
+		free(defaults);
+	}
+}
+
+
+/**
+ * Returns defaults the parser may modify: the current generation as long as no entry refers to it, a copy otherwise.
+ */
+static mtree_defaults_t * mtree_defaults_make_writable(mtree_defaults_t * defaults) {
+	if(defaults->references == 1)
+		return defaults;
+
+	mtree_defaults_t * copy = mtree_defaults_create();
+	copy->values = defaults->values;
+	if(defaults->values.link != NULL) {
+		copy->values.link = strdup(defaults->values.link);
+		assert(copy->values.link != NULL);
+	}
+	mtree_defaults_release(defaults);
+	return copy;
+}
 
-	if(mtree_entry_has_filepath(entry))
-		mtree_entry_set_filepath(clone, mtree_entry_get_filepath(entry));
 
-	for(int i = 0; i < sizeof(MTREE_ENTRY_ALL_KEYWORDS) / sizeof(MTREE_ENTRY_ALL_KEYWORDS[0]); i++) {
-		if(mtree_entry_has_keyword(entry, MTREE_ENTRY_ALL_KEYWORDS[i]))
-			mtree_entry_set_keyword(clone, MTREE_ENTRY_ALL_KEYWORDS[i], mtree_entry_get_keyword(entry, MTREE_ENTRY_ALL_KEYWORDS[i]));
+/**
+ * Creates an entry storing the keywords of values, which are taken over (including the link string), on top of
+ * defaults.
+ */
+static struct mtree_entry_t * mtree_entry_create(const char * filepath, mtree_defaults_t * defaults, mtree_values_t * values) {
+	size_t size = 0;
+	for(size_t i = 0; i < sizeof(MTREE_SLOT_ORDER) / sizeof(MTREE_SLOT_ORDER[0]); i++)
+		if(values->keywords & MTREE_KEYWORD_BIT(MTREE_SLOT_ORDER[i]))
+			size += mtree_slot_size(MTREE_SLOT_ORDER[i]);
+
+	size_t filepath_size = strlen(filepath) + 1;
+
+	mtree_entry_internal_t * entry = (mtree_entry_internal_t *)malloc(sizeof(mtree_entry_internal_t) + size + filepath_size);
+	assert(entry != NULL);
+	entry->filepath  = (char *)entry->values + size;
+	entry->defaults  = defaults;
+	entry->overrides = values->keywords;
+	memcpy(entry->filepath, filepath, filepath_size);
+	defaults->references++;
+
+	unsigned char * slot = (unsigned char *)entry->values;
+	for(size_t i = 0; i < sizeof(MTREE_SLOT_ORDER) / sizeof(MTREE_SLOT_ORDER[0]); i++) {
+		if(values->keywords & MTREE_KEYWORD_BIT(MTREE_SLOT_ORDER[i])) {
+			memcpy(slot, mtree_values_get_pointer(values, MTREE_SLOT_ORDER[i]), mtree_slot_size(MTREE_SLOT_ORDER[i]));
+			slot += mtree_slot_size(MTREE_SLOT_ORDER[i]);
+		}
 	}
 
-	return clone;
+	values->link     = NULL;
+	values->keywords = 0;
+	return (struct mtree_entry_t *)entry;
+}
+
+
+/**
+ * Returns where the value of a keyword is stored, in the entry itself or in its defaults; NULL if it is missing.
+ */
+static const unsigned char * mtree_entry_find_value(const struct mtree_entry_t * entry, mtree_keyword_t keyword) {
+	const mtree_entry_internal_t * priv = (const mtree_entry_internal_t *)entry;
+	if(keyword == MTREE_KEYWORD_UNKNOWN)
+		return NULL;
+
+	if(priv->overrides & MTREE_KEYWORD_BIT(keyword)) {
+		const unsigned char * slot = (const unsigned char *)priv->values;
+		for(size_t i = 0; MTREE_SLOT_ORDER[i] != keyword; i++)
+			if(priv->overrides & MTREE_KEYWORD_BIT(MTREE_SLOT_ORDER[i]))
+				slot += mtree_slot_size(MTREE_SLOT_ORDER[i]);
+		return slot;
+	}
+	if(priv->defaults->values.keywords & MTREE_KEYWORD_BIT(keyword))
+		return (const unsigned char *)mtree_values_get_pointer(&priv->defaults->values, keyword);
+	return NULL;
 }
 
 
 void mtree_entry_destroy(struct mtree_entry_t * entry) {
-	mtree_entry_unset_filepath(entry);
-	for(int i = 0; i < sizeof(MTREE_ENTRY_ALL_KEYWORDS) / sizeof(MTREE_ENTRY_ALL_KEYWORDS[0]); i++)
-		mtree_entry_unset_keyword(entry, MTREE_ENTRY_ALL_KEYWORDS[i]);
-	free(entry);
+	mtree_entry_internal_t * priv = (mtree_entry_internal_t *)entry;
+	if(priv->overrides & MTREE_KEYWORD_BIT(MTREE_KEYWORD_LINK)) {
+		char * link;
+		memcpy(&link, mtree_entry_find_value(entry, MTREE_KEYWORD_LINK), sizeof(link));
+		free(link);
+	}
+	mtree_defaults_release(priv->defaults);
+	free(priv);
 }
 
 
@@ -177,62 +445,178 @@ const char * mtree_entry_get_filepath(const struct mtree_entry_t * entry) {
 }
 
 
-void mtree_entry_set_filepath(struct mtree_entry_t * entry, const char * filepath) {
-	mtree_entry_unset_filepath(entry);
-
-	mtree_entry_internal_t * priv = (mtree_entry_internal_t *)entry;
-	priv->filepath = strdup(filepath);
+bool mtree_entry_has_keyword(const struct mtree_entry_t * entry, mtree_keyword_t keyword) {
+	return (mtree_entry_find_value(entry, keyword) != NULL);
 }
 
 
-void mtree_entry_unset_filepath(struct mtree_entry_t * entry) {
-	mtree_entry_internal_t * priv = (mtree_entry_internal_t *)entry;
-	if(priv->filepath != NULL) {
-		free(priv->filepath);
-		priv->filepath = NULL;
+const char * mtree_entry_format_keyword(const struct mtree_entry_t * entry, mtree_keyword_t keyword, char * buffer, size_t size) {
+	if(!mtree_entry_has_keyword(entry, keyword))
+		return "";
+
+	switch(keyword) {
+		case MTREE_KEYWORD_TIME: {
+			struct timespec time;
+			mtree_entry_get_time(entry, &time);
+			snprintf(buffer, size, "%lld.%ld", (long long)time.tv_sec, (long)time.tv_nsec);
+			break;
+		}
+		case MTREE_KEYWORD_MODE:         snprintf(buffer, size, "%o", (unsigned int)mtree_entry_get_mode(entry));                 break;
+		case MTREE_KEYWORD_SIZE:         snprintf(buffer, size, "%lld", (long long)mtree_entry_get_size(entry));                  break;
+		case MTREE_KEYWORD_TYPE:         return mtree_type_to_string(mtree_entry_get_type(entry));
+		case MTREE_KEYWORD_UID:          snprintf(buffer, size, "%u", (unsigned int)mtree_entry_get_uid(entry));                  break;
+		case MTREE_KEYWORD_GID:          snprintf(buffer, size, "%u", (unsigned int)mtree_entry_get_gid(entry));                  break;
+		case MTREE_KEYWORD_LINK:         return mtree_entry_get_link(entry);
+		case MTREE_KEYWORD_MD5DIGEST:    mtree_format_hex(mtree_entry_get_digest(entry, keyword), 16, buffer);                    break;
+		case MTREE_KEYWORD_SHA256DIGEST: mtree_format_hex(mtree_entry_get_digest(entry, keyword), 32, buffer);                    break;
+		default:                         return "";
 	}
+	return buffer;
 }
 
 
-bool mtree_entry_has_keyword(const struct mtree_entry_t * entry, mtree_keyword_t keyword) {
-	return (*mtree_entry_get_keyword_const_pointer(entry, keyword) != NULL);
+/**
+ * Copies the value of a keyword into result, which is left untouched if the keyword is missing.
+ */
+static bool mtree_entry_copy_value(const struct mtree_entry_t * entry, mtree_keyword_t keyword, void * result) {
+	const unsigned char * value = mtree_entry_find_value(entry, keyword);
+	if(value == NULL)
+		return false;
+	memcpy(result, value, mtree_slot_size(keyword));
+	return true;
 }
 
 
-const char * mtree_entry_get_keyword(const struct mtree_entry_t * entry, mtree_keyword_t keyword) {
-	const char ** ptr = mtree_entry_get_keyword_const_pointer(entry, keyword);
-	if(ptr == NULL)
-		return "";
-	else
-		return *ptr;
+mtree_type_t mtree_entry_get_type(const struct mtree_entry_t * entry) {
+	mtree_type_t type = MTREE_TYPE_UNKNOWN;
+	mtree_entry_copy_value(entry, MTREE_KEYWORD_TYPE, &type);
+	return type;
 }
 
 
-void mtree_entry_set_keyword(struct mtree_entry_t * entry, mtree_keyword_t keyword, const char * value) {
-	char ** ptr = mtree_entry_get_keyword_pointer(entry, keyword);
-	if(*ptr != NULL) {
-		free(*ptr);
-		*ptr = NULL;
-	}
-	*ptr = strdup(value);
+mode_t mtree_entry_get_mode(const struct mtree_entry_t * entry) {
+	mode_t mode = 0;
+	mtree_entry_copy_value(entry, MTREE_KEYWORD_MODE, &mode);
+	return mode;
+}
+
+
+uid_t mtree_entry_get_uid(const struct mtree_entry_t * entry) {
+	uid_t uid = 0;
+	mtree_entry_copy_value(entry, MTREE_KEYWORD_UID, &uid);
+	return uid;
 }
 
 
-void mtree_entry_unset_keyword(struct mtree_entry_t * entry, mtree_keyword_t keyword) {
-	char ** ptr = mtree_entry_get_keyword_pointer(entry, keyword);
-	if(*ptr != NULL) {
-		free(*ptr);
-		*ptr = NULL;
+gid_t mtree_entry_get_gid(const struct mtree_entry_t * entry) {
+	gid_t gid = 0;
+	mtree_entry_copy_value(entry, MTREE_KEYWORD_GID, &gid);
+	return gid;
+}
+
+
+off_t mtree_entry_get_size(const struct mtree_entry_t * entry) {
+	off_t size = 0;
+	mtree_entry_copy_value(entry, MTREE_KEYWORD_SIZE, &size);
+	return size;
+}
+
+
+const char * mtree_entry_get_link(const struct mtree_entry_t * entry) {
+	const char * link = "";
+	mtree_entry_copy_value(entry, MTREE_KEYWORD_LINK, &link);
+	return link;
+}
+
+
+const unsigned char * mtree_entry_get_digest(const struct mtree_entry_t * entry, mtree_keyword_t keyword) {
+	if(keyword != MTREE_KEYWORD_MD5DIGEST && keyword != MTREE_KEYWORD_SHA256DIGEST)
+		return NULL;
+	return mtree_entry_find_value(entry, keyword);
+}
+
+
+bool mtree_entry_get_time(const struct mtree_entry_t * entry, struct timespec * result) {
+	return mtree_entry_copy_value(entry, MTREE_KEYWORD_TIME, result);
+}
+
+
+/**
+ * Tokenizer over an mtree buffer, which is modified in place: lines and words are terminated and words unescaped
+ * where they are, and handed out as pointers into the buffer, so nothing is allocated while tokenizing.
+ */
+typedef struct {
+	char * next_line; // start of the line after the current one
+	char * cursor;    // rest of the current line, NULL once all of its words were taken
+} mtree_tokenizer_t;
+
+
+/**
+ * Advances to the next line, separated by "\n", "\r" or "\r\n". Returns false at the end of the buffer.
+ */
+static bool mtree_tokenizer_next_line(mtree_tokenizer_t * tokenizer) {
+	char * line = tokenizer->next_line;
+	if(*line == '\0')
+		return false;
+
+	char * end = line + strcspn(line, "\r\n");
+	tokenizer->next_line = end;
+	if(*tokenizer->next_line == '\r')
+		tokenizer->next_line++;
+	if(*tokenizer->next_line == '\n')
+		tokenizer->next_line++;
+	*end = '\0';
+
+	tokenizer->cursor = line;
+	return true;
+}
+
+
+/**
+ * Returns the next word of the current line, separated by spaces and tabs, with backslashes followed by exactly
+ * three digits converted to the byte of that octal value. Returns NULL at the end of the line.
+ */
+static char * mtree_tokenizer_next_word(mtree_tokenizer_t * tokenizer) {
+	char * source = tokenizer->cursor;
+	if(source == NULL)
+		return NULL;
+
+	// skip whitespace
+	while(*source == ' ' || *source == '\t')
+		source++;
+	if(*source == '\0') {
+		tokenizer->cursor = NULL;
+		return NULL;
 	}
+
+	// the unescaped word is never longer than the escaped one, so it is written over it;
+	// words rarely contain escapes, and up to the first one there is nothing to move
+	char * word = source;
+	source += strcspn(source, " \t\\");
+	char * dest = source;
+	while(*source != '\0' && *source != ' ' && *source != '\t') {
+		if(source[0] == '\\' && isdigit(source[1]) && isdigit(source[2]) && isdigit(source[3])) {
+			unsigned int value = (source[1] - '0') * 64 + (source[2] - '0') * 8  + (source[3] - '0');
+			if(value <= '\xFF') {
+				*dest++ = value;
+				source += 4;
+				continue;
+			}
+		}
+		*dest++ = *source++;
+	}
+	tokenizer->cursor = (*source != '\0' ? source + 1 : NULL);
+	*dest = '\0';
+	return word;
 }
 
 
 /**
- * Helper function to set a list of keywords at once. Each entry must start with a keyword, followed by a `=', followed by the value.
+ * Helper function to set the remaining words of a line as keywords. Each word must start with a keyword, followed by a `=', followed by the value.
  */
-static void mtree_entry_set_keyvalue_pairs(struct mtree_entry_t * entry, alpm_list_t * string_list) {
-	for(alpm_list_t * it = string_list; it != NULL; it = alpm_list_next(it)) {
-		const char * pair = it->data;
+static void mtree_values_set_keyvalue_pairs(mtree_values_t * values, mtree_tokenizer_t * tokenizer) {
+	const char * pair;
+	while((pair = mtree_tokenizer_next_word(tokenizer)) != NULL) {
 		const char * delimiter = strchr(pair, '=');
 		if(delimiter == NULL) {
 			fprintf(stderr, "Error: bad key-value pair `%s'\n", pair);
@@ -245,68 +629,172 @@ static void mtree_entry_set_keyvalue_pairs(struct mtree_entry_t * entry, alpm_li
 			continue;
 		}
 
-		mtree_entry_set_keyword(entry, keyword, delimiter + 1);
+		if(!mtree_values_set(values, keyword, delimiter + 1))
+			fprintf(stderr, "Error: bad value `%s' for keyword `%s'\n", delimiter + 1, mtree_keyword_to_string(keyword));
 	}
 }
 
 
 /**
- * Helper function to unset a list of keywords at once.
+ * Helper function to unset the keywords listed by the remaining words of a line.
  */
-static void mtree_entry_unset_keywords(struct mtree_entry_t * entry, alpm_list_t * string_list) {
-	for(alpm_list_t * it = string_list; it != NULL; it = alpm_list_next(it)) {
-		const char *    keyword_string = it->data;
-		mtree_keyword_t keyword        = mtree_parse_keyword(keyword_string, strlen(keyword_string));
+static void mtree_values_unset_keywords(mtree_values_t * values, mtree_tokenizer_t * tokenizer) {
+	const char * keyword_string;
+	while((keyword_string = mtree_tokenizer_next_word(tokenizer)) != NULL) {
+		mtree_keyword_t keyword = mtree_parse_keyword(keyword_string, strlen(keyword_string));
 		if(keyword != MTREE_KEYWORD_UNKNOWN)
-			mtree_entry_unset_keyword(entry, keyword);
+			mtree_values_unset(values, keyword);
 	}
 }
 
 
-alpm_list_t * mtree_parse(const char * str) {
-	alpm_list_t * entries = NULL;
-
-	struct mtree_entry_t * defaults = mtree_entry_create();
+typedef struct {
+	mtree_fn_entry     fn;
+	void *             user_data;
+	mtree_defaults_t * defaults;
+	mtree_values_t     line;      // the keywords of the current line, moved into its entry
+
+	// lines fed so far, the last one possibly incomplete
+	char *             buffer;
+	size_t             buffer_used;
+	size_t             buffer_allocated;
+} mtree_parser_internal_t;
+
+
+static void mtree_parser_init(mtree_parser_internal_t * priv, mtree_fn_entry fn, void * user_data) {
+	priv->fn               = fn;
+	priv->user_data        = user_data;
+	priv->defaults         = mtree_defaults_create();
+	priv->buffer           = NULL;
+	priv->buffer_used      = 0;
+	priv->buffer_allocated = 0;
+	mtree_values_init(&priv->line);
+}
 
-	alpm_list_t * lines = split_lines(str);
-	for(alpm_list_t * i_line = lines; i_line != NULL; i_line = alpm_list_next(i_line)) {
-		const char * line = i_line->data;
 
-		alpm_list_t * words = split_words(line);
-		alpm_list_each(words, (alpm_list_fn_each)convert_octal);
-		if(words == NULL) {
+/**
+ * Parses complete lines, str is tokenized in place.
+ */
+static void mtree_parser_parse_lines(mtree_parser_internal_t * priv, char * str) {
+	mtree_tokenizer_t tokenizer;
+	tokenizer.next_line = str;
+	tokenizer.cursor    = NULL;
+	while(mtree_tokenizer_next_line(&tokenizer)) {
+		const char * first_word = mtree_tokenizer_next_word(&tokenizer);
+		if(first_word == NULL) {
 			// do nothing for empty lines
 		}
-		else {
-			const char * first_word = (const char *)words->data;
-			if(first_word[0] == '#') {
-				// do nothing for comments
-			}
-			else if(first_word[0] == '/') { // special
-				const char * special = first_word + 1;
-				if(strcmp(special, "set") == 0)
-					mtree_entry_set_keyvalue_pairs(defaults, alpm_list_nth(words, 1));
-				else if(strcmp(special, "unset") == 0)
-					mtree_entry_unset_keywords(defaults, alpm_list_nth(words, 1));
-				else
-					fprintf(stderr, "Error: unknown command `%s'\n", special);
+		else if(first_word[0] == '#') {
+			// do nothing for comments
+		}
+		else if(first_word[0] == '/') { // special
+			const char * special = first_word + 1;
+			if(strcmp(special, "set") == 0) {
+				priv->defaults = mtree_defaults_make_writable(priv->defaults);
+				mtree_values_set_keyvalue_pairs(&priv->defaults->values, &tokenizer);
 			}
-			else if(first_word[0] == '.' && first_word[1] == '/') {
-				struct mtree_entry_t * entry = mtree_entry_clone(defaults);
-				mtree_entry_set_filepath(entry, first_word + 1);
-				mtree_entry_set_keyvalue_pairs(entry, alpm_list_nth(words, 1));
-				entries = alpm_list_add(entries, entry);
+			else if(strcmp(special, "unset") == 0) {
+				priv->defaults = mtree_defaults_make_writable(priv->defaults);
+				mtree_values_unset_keywords(&priv->defaults->values, &tokenizer);
 			}
 			else
-				fprintf(stderr, "Error: unsupported line `%s'\n", line);
+				fprintf(stderr, "Error: unknown command `%s'\n", special);
+		}
+		else if(first_word[0] == '.' && first_word[1] == '/') {
+			mtree_values_set_keyvalue_pairs(&priv->line, &tokenizer);
+			priv->fn(mtree_entry_create(first_word + 1, priv->defaults, &priv->line), priv->user_data);
 		}
+		else
+			fprintf(stderr, "Error: unsupported line starting with `%s'\n", first_word);
+	}
+}
+
+
+/**
+ * Drops the defaults of the file parsed so far.
+ */
+static void mtree_parser_reset(mtree_parser_internal_t * priv) {
+	mtree_defaults_release(priv->defaults);
+	priv->defaults    = mtree_defaults_create();
+	priv->buffer_used = 0;
+}
+
+
+struct mtree_parser_t * mtree_parser_create(mtree_fn_entry fn, void * user_data) {
+	mtree_parser_internal_t * priv = (mtree_parser_internal_t *)malloc(sizeof(mtree_parser_internal_t));
+	if(priv == NULL)
+		return NULL;
+	mtree_parser_init(priv, fn, user_data);
+	return (struct mtree_parser_t *)priv;
+}
+
+
+void mtree_parser_destroy(struct mtree_parser_t * parser) {
+	mtree_parser_internal_t * priv = (mtree_parser_internal_t *)parser;
+	mtree_defaults_release(priv->defaults);
+	free(priv->buffer);
+	free(priv);
+}
+
+
+void mtree_parser_feed(struct mtree_parser_t * parser, const char * data, size_t size) {
+	mtree_parser_internal_t * priv = (mtree_parser_internal_t *)parser;
+
+	// behind the incomplete line left from the previous chunk, with room for a terminating null byte
+	if(priv->buffer_used + size + 1 > priv->buffer_allocated) {
+		priv->buffer_allocated = (priv->buffer_used + size + 1 > 2 * priv->buffer_allocated ? priv->buffer_used + size + 1 : 2 * priv->buffer_allocated);
+		priv->buffer           = (char *)realloc(priv->buffer, priv->buffer_allocated);
+		assert(priv->buffer != NULL);
+	}
+	memcpy(priv->buffer + priv->buffer_used, data, size);
+	size_t used = priv->buffer_used + size;
+
+	// the last line end terminates the complete lines, what follows it is kept for the next chunk;
+	// a "\r\n" split between chunks merely adds an empty line
+	size_t end = used;
+	while(end > priv->buffer_used && priv->buffer[end - 1] != '\n' && priv->buffer[end - 1] != '\r')
+		end--;
+	if(end == priv->buffer_used) {
+		priv->buffer_used = used;
+		return;
+	}
+
+	priv->buffer[end - 1] = '\0';
+	mtree_parser_parse_lines(priv, priv->buffer);
+	memmove(priv->buffer, priv->buffer + end, used - end);
+	priv->buffer_used = used - end;
+}
 
-		FREELIST(words);
+
+void mtree_parser_finish(struct mtree_parser_t * parser) {
+	mtree_parser_internal_t * priv = (mtree_parser_internal_t *)parser;
+	if(priv->buffer_used > 0) {
+		priv->buffer[priv->buffer_used] = '\0';
+		mtree_parser_parse_lines(priv, priv->buffer);
 	}
+	mtree_parser_reset(priv);
+}
+
 
-	FREELIST(lines);
+void mtree_parser_discard(struct mtree_parser_t * parser) {
+	mtree_parser_reset((mtree_parser_internal_t *)parser);
+}
+
+
+/**
+ * Collects the entries of mtree_parse.
+ */
+static void mtree_append_entry(struct mtree_entry_t * entry, void * user_data) {
+	alpm_list_t ** entries = (alpm_list_t **)user_data;
+	*entries = alpm_list_add(*entries, entry);
+}
 
-	mtree_entry_destroy(defaults);
 
+alpm_list_t * mtree_parse(char * str) {
+	alpm_list_t *           entries = NULL;
+	mtree_parser_internal_t parser;
+	mtree_parser_init(&parser, mtree_append_entry, &entries);
+	mtree_parser_parse_lines(&parser, str);
+	mtree_defaults_release(parser.defaults);
 	return entries;
 }
@@ -3,6 +3,9 @@
 
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
 
 #include "list.h"
 
@@ -13,7 +16,7 @@ extern "C" {
 
 
 /**
- * Opaque struct representing a single entry in a mtree file.
+ * Opaque struct representing a single entry in a mtree file. Entries are immutable once parsed.
  */
 struct mtree_entry_t;
 
@@ -34,42 +37,116 @@ typedef enum {
 } mtree_keyword_t;
 
 /**
- * Helper functions to parse and stringify keywords.
+ * File types, as named by the type keyword.
+ */
+typedef enum {
+	MTREE_TYPE_UNKNOWN, // error value
+	MTREE_TYPE_FILE,
+	MTREE_TYPE_DIR,
+	MTREE_TYPE_LINK,
+	MTREE_TYPE_FIFO,
+	MTREE_TYPE_BLOCK,
+	MTREE_TYPE_CHAR,
+	MTREE_TYPE_SOCKET
+} mtree_type_t;
+
+/**
+ * Buffer size that fits any keyword value formatted by mtree_entry_format_keyword.
+ */
+#define MTREE_KEYWORD_FORMAT_SIZE 72
+
+/**
+ * Helper functions to parse and stringify keywords and types.
  */
 mtree_keyword_t mtree_parse_keyword(const char * keyword, int keyword_length);
 const char *    mtree_keyword_to_string(mtree_keyword_t keyword);
+mtree_type_t    mtree_parse_type(const char * type);
+const char *    mtree_type_to_string(mtree_type_t type);
 
 /**
  * Parses the contents of an mtree string and returns a resolved and cleaned-up list of entries.
+ * The string is tokenized in place and left modified.
  *
  * Free the resulting list with:
  *   alpm_list_free_inner(list, (alpm_list_fn_free)mtree_entry_destroy);
  *   alpm_list_free(list);
  */
-alpm_list_t * mtree_parse(const char * str);
+alpm_list_t * mtree_parse(char * str);
+
+/**
+ * Opaque handle of an incremental parser, fed with an mtree file chunk by chunk.
+ */
+struct mtree_parser_t;
+
+/**
+ * Callback function type for handing over a parsed entry; release it with mtree_entry_destroy.
+ */
+typedef void (*mtree_fn_entry)(struct mtree_entry_t * entry, void * user_data);
+
+/**
+ * Creates a parser that reports every entry via fn as soon as its line is complete. Returns NULL on failure.
+ */
+struct mtree_parser_t * mtree_parser_create(mtree_fn_entry fn, void * user_data);
+
+/**
+ * Releases the parser. Entries reported so far are not affected.
+ */
+void mtree_parser_destroy(struct mtree_parser_t * parser);
 
 /**
- * Allocation, cloning and destruction of entries.
+ * Parses the complete lines of the next size bytes of a file; chunks may end anywhere, an incomplete last line is
+ * kept until the next chunk. Memory is bounded by the chunk size plus the longest line.
  */
-struct mtree_entry_t * mtree_entry_create();
-struct mtree_entry_t * mtree_entry_clone(const struct mtree_entry_t * entry);
-void                   mtree_entry_destroy(struct mtree_entry_t * entry);
+void mtree_parser_feed(struct mtree_parser_t * parser, const char * data, size_t size);
 
 /**
- * Accessors and modifiers for the filepath stored in each entry.
+ * Parses what is left of the file after the last chunk and resets the parser for the next file.
+ */
+void mtree_parser_finish(struct mtree_parser_t * parser);
+
+/**
+ * Drops the incomplete last line of a file that could not be read to its end and resets the parser for the next file.
+ */
+void mtree_parser_discard(struct mtree_parser_t * parser);
+
+/**
+ * Releases an entry. Entries of one mtree_parse call share their defaults, so they must not be released concurrently.
+ */
+void mtree_entry_destroy(struct mtree_entry_t * entry);
+
+/**
+ * Accessors for the filepath stored in each entry.
  */
 bool         mtree_entry_has_filepath(const struct mtree_entry_t * entry);
 const char * mtree_entry_get_filepath(const struct mtree_entry_t * entry);
-void         mtree_entry_set_filepath(struct mtree_entry_t * entry, const char * filepath);
-void         mtree_entry_unset_filepath(struct mtree_entry_t * entry);
 
 /**
- * Accessors and modifiers for the keywords stored in each entry.
+ * Returns true if the entry has a value for keyword, set on its own line or by /set.
+ */
+bool mtree_entry_has_keyword(const struct mtree_entry_t * entry, mtree_keyword_t keyword);
+
+/**
+ * Formats the value of a keyword as written in mtree files, for reports. Returns buffer, which should have
+ * MTREE_KEYWORD_FORMAT_SIZE bytes, or a string owned by the entry; "" if the keyword is missing.
+ */
+const char * mtree_entry_format_keyword(const struct mtree_entry_t * entry, mtree_keyword_t keyword, char * buffer, size_t size);
+
+/**
+ * Typed accessors for the keywords of each entry. A missing keyword yields 0, MTREE_TYPE_UNKNOWN, "" or NULL.
+ * mtree_entry_get_digest takes MTREE_KEYWORD_MD5DIGEST for 16 bytes or MTREE_KEYWORD_SHA256DIGEST for 32 bytes.
+ */
+mtree_type_t          mtree_entry_get_type  (const struct mtree_entry_t * entry);
+mode_t                mtree_entry_get_mode  (const struct mtree_entry_t * entry);
+uid_t                 mtree_entry_get_uid   (const struct mtree_entry_t * entry);
+gid_t                 mtree_entry_get_gid   (const struct mtree_entry_t * entry);
+off_t                 mtree_entry_get_size  (const struct mtree_entry_t * entry);
+const char *          mtree_entry_get_link  (const struct mtree_entry_t * entry);
+const unsigned char * mtree_entry_get_digest(const struct mtree_entry_t * entry, mtree_keyword_t keyword);
+
+/**
+ * Copies the time keyword into result. Returns false if it is missing.
  */
-bool         mtree_entry_has_keyword(const struct mtree_entry_t * entry, mtree_keyword_t keyword);
-const char * mtree_entry_get_keyword(const struct mtree_entry_t * entry, mtree_keyword_t keyword);
-void         mtree_entry_set_keyword(struct mtree_entry_t * entry, mtree_keyword_t keyword, const char * value);
-void         mtree_entry_unset_keyword(struct mtree_entry_t * entry, mtree_keyword_t keyword);
+bool mtree_entry_get_time(const struct mtree_entry_t * entry, struct timespec * result);
 
 
 #ifdef __cplusplus
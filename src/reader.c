@@ -0,0 +1,272 @@
+#define _GNU_SOURCE
+#include "reader.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+typedef struct {
+	unsigned char * buffer;        // READER_BUFFER_SIZE bytes, page aligned
+	size_t          page_size;
+	int             fd;            // -1 if no file is open
+	bool            regular;       // a short read of a regular file means end of file
+	bool            eof;
+	void *          map;           // NULL if the file is read
+	size_t          map_size;
+
+	// cache neutral mode: resident[i] tells whether page i of the current file was cached before it was opened
+	bool            cache_neutral;
+	unsigned char * resident;
+	size_t          resident_allocated;
+	size_t          pages;
+} reader_internal_t;
+
+
+static pthread_once_t          reader_handler_once = PTHREAD_ONCE_INIT;
+static __thread sigjmp_buf *   reader_jump         = NULL; // of the innermost reader_guard of the thread
+static __thread const void *   reader_fault        = NULL;
+
+
+/**
+ * Abandons the guarded code a fault of a truncated file hit. Any other fault is left to the default action, which
+ * the faulting instruction runs into once more after returning.
+ */
+static void reader_handle_fault(int signal, siginfo_t * info, void * context) {
+	if(reader_jump == NULL || info->si_code != BUS_ADRERR) {
+		struct sigaction action;
+		memset(&action, 0, sizeof(action));
+		action.sa_handler = SIG_DFL;
+		sigaction(SIGBUS, &action, NULL);
+		return;
+	}
+	reader_fault = info->si_addr;
+	siglongjmp(*reader_jump, 1);
+}
+
+
+static void reader_install_handler() {
+	// SA_NODEFER, so the signal mask doesn't need to be saved and restored by every reader_guard
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_sigaction = reader_handle_fault;
+	action.sa_flags     = SA_SIGINFO | SA_NODEFER;
+	sigaction(SIGBUS, &action, NULL);
+}
+
+
+struct reader_t * reader_create(bool cache_neutral) {
+	pthread_once(&reader_handler_once, reader_install_handler);
+
+	reader_internal_t * priv = (reader_internal_t *)malloc(sizeof(reader_internal_t));
+	if(priv == NULL)
+		return NULL;
+	long page_size = sysconf(_SC_PAGESIZE);
+	priv->page_size = (page_size > 0 ? page_size : 4096);
+	if(posix_memalign((void **)&priv->buffer, priv->page_size, READER_BUFFER_SIZE) != 0) {
+		free(priv);
+		return NULL;
+	}
+	priv->fd                 = -1;
+	priv->regular            = false;
+	priv->eof                = true;
+	priv->map                = NULL;
+	priv->map_size           = 0;
+	priv->cache_neutral      = cache_neutral;
+	priv->resident           = NULL;
+	priv->resident_allocated = 0;
+	priv->pages              = 0;
+	return (struct reader_t *)priv;
+}
+
+
+void reader_destroy(struct reader_t * handle) {
+	reader_internal_t * priv = (reader_internal_t *)handle;
+	reader_close(handle);
+	free(priv->resident);
+	free(priv->buffer);
+	free(priv);
+}
+
+
+/**
+ * Records which pages of the file are in the page cache already, so reader_close only drops the pages it read in.
+ * map is the mapping of the file, or NULL to map it just for the check.
+ */
+static void reader_probe_residency(reader_internal_t * priv, int fd, size_t size, void * map) {
+	priv->pages = (size + priv->page_size - 1) / priv->page_size;
+	if(priv->pages > priv->resident_allocated) {
+		free(priv->resident);
+		priv->resident           = (unsigned char *)malloc(priv->pages);
+		priv->resident_allocated = (priv->resident != NULL ? priv->pages : 0);
+	}
+
+	bool probed = false;
+	if(priv->resident != NULL) {
+		void * probe = (map != NULL ? map : mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0));
+		if(probe != MAP_FAILED) {
+			probed = (mincore(probe, size, priv->resident) == 0);
+			if(probe != map)
+				munmap(probe, size);
+		}
+	}
+
+	// without knowing better, leave the cache alone
+	if(!probed)
+		priv->pages = 0;
+}
+
+
+/**
+ * Drops the pages of the current file from the page cache that were not cached before it was opened.
+ */
+static void reader_drop_pages(reader_internal_t * priv) {
+	for(size_t first = 0; first < priv->pages; ) {
+		if(priv->resident[first] & 1) {
+			first++;
+			continue;
+		}
+		size_t last = first + 1;
+		while(last < priv->pages && !(priv->resident[last] & 1))
+			last++;
+		posix_fadvise(priv->fd, first * priv->page_size, (last - first) * priv->page_size, POSIX_FADV_DONTNEED);
+		first = last;
+	}
+	priv->pages = 0;
+}
+
+
+int reader_open(struct reader_t * handle, const char * path) {
+	reader_internal_t * priv = (reader_internal_t *)handle;
+	reader_close(handle);
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd == -1)
+		return -1;
+
+	struct stat st;
+	if(fstat(fd, &st) != 0) {
+		int error = errno;
+		close(fd);
+		errno = error;
+		return -1;
+	}
+
+	priv->regular = S_ISREG(st.st_mode);
+	priv->eof     = false;
+
+	// large files are mapped: no copy through a buffer and no read() per piece, the kernel reads ahead
+	if(priv->regular && st.st_size >= READER_MMAP_THRESHOLD && (uintmax_t)st.st_size <= SIZE_MAX) {
+		void * map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(map != MAP_FAILED) {
+			// the file stays open, for dropping its pages again or for reading it after all
+			if(priv->cache_neutral)
+				reader_probe_residency(priv, fd, st.st_size, map);
+			priv->fd = fd;
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			priv->map      = map;
+			priv->map_size = st.st_size;
+			return 0;
+		}
+		// fall back to reading, e.g. on file systems that don't support mmap
+	}
+
+	if(priv->cache_neutral && priv->regular && st.st_size > 0 && (uintmax_t)st.st_size <= SIZE_MAX)
+		reader_probe_residency(priv, fd, st.st_size, NULL);
+
+	priv->fd = fd;
+	return 0;
+}
+
+
+ssize_t reader_read(struct reader_t * handle, const unsigned char ** data) {
+	reader_internal_t * priv = (reader_internal_t *)handle;
+	if(priv->eof)
+		return 0;
+
+	if(priv->map != NULL) {
+		priv->eof = true;
+		*data     = (const unsigned char *)priv->map;
+		return priv->map_size;
+	}
+
+	ssize_t size;
+	do {
+		size = read(priv->fd, priv->buffer, READER_BUFFER_SIZE);
+	} while(size == -1 && errno == EINTR);
+	if(size == -1)
+		return -1;
+
+	// saves the final read() returning 0, so small files take a single call
+	if(size == 0 || (priv->regular && size < READER_BUFFER_SIZE))
+		priv->eof = true;
+
+	*data = priv->buffer;
+	return size;
+}
+
+
+void reader_close(struct reader_t * handle) {
+	reader_internal_t * priv = (reader_internal_t *)handle;
+	if(priv->map != NULL)
+		munmap(priv->map, priv->map_size); // mapped pages can't be dropped
+	if(priv->pages > 0)
+		reader_drop_pages(priv);
+	if(priv->fd != -1)
+		close(priv->fd);
+	priv->fd       = -1;
+	priv->eof      = true;
+	priv->map      = NULL;
+	priv->map_size = 0;
+}
+
+
+bool reader_is_mapped(const struct reader_t * handle) {
+	const reader_internal_t * priv = (const reader_internal_t *)handle;
+	return (priv->map != NULL);
+}
+
+
+bool reader_maps(const struct reader_t * handle, const void * address) {
+	const reader_internal_t * priv = (const reader_internal_t *)handle;
+	return (priv->map != NULL && (const unsigned char *)address >= (const unsigned char *)priv->map && (const unsigned char *)address < (const unsigned char *)priv->map + priv->map_size);
+}
+
+
+int reader_reopen_unmapped(struct reader_t * handle) {
+	reader_internal_t * priv = (reader_internal_t *)handle;
+	if(priv->fd == -1) {
+		errno = EBADF;
+		return -1;
+	}
+	if(lseek(priv->fd, 0, SEEK_SET) == -1)
+		return -1;
+	if(priv->map != NULL)
+		munmap(priv->map, priv->map_size);
+	priv->map      = NULL;
+	priv->map_size = 0;
+	priv->eof      = false;
+	return 0;
+}
+
+
+const void * reader_guard(reader_fn_guarded fn, void * user_data) {
+	sigjmp_buf   jump;
+	sigjmp_buf * outer = reader_jump;
+	if(sigsetjmp(jump, 0) != 0) {
+		reader_jump = outer;
+		return reader_fault;
+	}
+	reader_jump = &jump;
+	fn(user_data);
+	reader_jump = outer;
+	return NULL;
+}
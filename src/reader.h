@@ -0,0 +1,99 @@
+#ifndef INCLUDE_READER_H
+#define INCLUDE_READER_H
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * Opaque handle of a file reader. It hands out the contents of one file at a time in as few pieces as possible:
+ * regular files of at least READER_MMAP_THRESHOLD bytes are mapped and returned in one piece, everything else is
+ * read() into a page aligned buffer owned by the reader, which is reused for every file. Code touching the pieces
+ * of a mapped file runs via reader_guard, unless the file can't be truncated meanwhile.
+ * A reader is not thread-safe; use one per thread (or per lane).
+ */
+struct reader_t;
+
+/**
+ * Size of the read buffer. Regular files up to this size take a single read() call.
+ */
+#define READER_BUFFER_SIZE (128 * 1024)
+
+/**
+ * Regular files of at least this size are mapped instead of read.
+ */
+#define READER_MMAP_THRESHOLD READER_BUFFER_SIZE
+
+/**
+ * Creates a reader. Returns NULL on failure.
+ * A cache neutral reader leaves the page cache as it found it: pages of a file that were not cached when the file
+ * was opened are dropped again (POSIX_FADV_DONTNEED) when it is closed, pages that were cached are kept.
+ */
+struct reader_t * reader_create(bool cache_neutral);
+
+/**
+ * Releases the handle, closing the current file if there is one.
+ */
+void reader_destroy(struct reader_t * handle);
+
+/**
+ * Opens the file at path, closing the previous one if there is one.
+ * Returns -1 on failure (with errno set), 0 otherwise.
+ */
+int reader_open(struct reader_t * handle, const char * path);
+
+/**
+ * Sets data to the next piece of the current file. The piece stays valid until the next call to reader_read,
+ * reader_open, reader_close or reader_destroy.
+ * Returns the size of the piece, 0 at the end of the file, or -1 on failure (with errno set).
+ */
+ssize_t reader_read(struct reader_t * handle, const unsigned char ** data);
+
+/**
+ * Closes the current file.
+ */
+void reader_close(struct reader_t * handle);
+
+/**
+ * Returns true if the current file is memory mapped.
+ */
+bool reader_is_mapped(const struct reader_t * handle);
+
+/**
+ * Returns true if address lies within the mapping of the current file.
+ */
+bool reader_maps(const struct reader_t * handle, const void * address);
+
+/**
+ * Starts the current file over, to be read() instead of mapped. For a mapped file that faulted, see reader_guard.
+ * Returns -1 on failure (with errno set), 0 otherwise.
+ */
+int reader_reopen_unmapped(struct reader_t * handle);
+
+/**
+ * Callback function type for code touching the pieces of mapped files, see reader_guard.
+ */
+typedef void (*reader_fn_guarded)(void * user_data);
+
+/**
+ * Calls fn on the calling thread. A mapped file truncated while fn touches its pieces raises SIGBUS for the pages
+ * past its new end; instead of the process being killed, fn is abandoned where it faulted, so it must only change
+ * state it can recover from. Faults of other memory are not caught.
+ * Returns NULL if fn returned, otherwise the address that faulted.
+ */
+const void * reader_guard(reader_fn_guarded fn, void * user_data);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
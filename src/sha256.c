@@ -0,0 +1,210 @@
+#include "sha256.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define SHA256_X86
+#endif
+
+
+/**
+ * Compression function type: processes a number of consecutive 64-byte blocks.
+ */
+typedef void (*sha256_fn_blocks)(uint32_t * state, const unsigned char * data, size_t blocks);
+
+
+static const uint32_t K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+
+static void sha256_blocks_portable(uint32_t * state, const unsigned char * data, size_t blocks) {
+	while(blocks-- > 0) {
+		uint32_t w[64];
+		for(int i = 0; i < 16; i++)
+			w[i] = ((uint32_t)data[4 * i] << 24) | ((uint32_t)data[4 * i + 1] << 16) | ((uint32_t)data[4 * i + 2] << 8) | (uint32_t)data[4 * i + 3];
+		for(int i = 16; i < 64; i++) {
+			uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+			uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+
+		uint32_t a = state[0], b = state[1], c = state[2], d = state[3],
+		         e = state[4], f = state[5], g = state[6], h = state[7];
+		for(int i = 0; i < 64; i++) {
+			uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+			uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
+
+		data += 64;
+	}
+}
+
+
+#ifdef SHA256_X86
+
+/**
+ * Compression with the SHA extensions. The state is kept in the ABEF/CDGH layout expected by sha256rnds2,
+ * the message schedule is computed four words at a time with sha256msg1/sha256msg2.
+ */
+__attribute__((target("sha,sse4.1,ssse3"))) static void sha256_blocks_shani(uint32_t * state, const unsigned char * data, size_t blocks) {
+	const __m128i byteswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+	__m128i tmp    = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xb1); // CDAB
+	__m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1b); // EFGH
+	__m128i state0 = _mm_alignr_epi8(tmp, state1, 8);                                      // ABEF
+	state1         = _mm_blend_epi16(state1, tmp, 0xf0);                                   // CDGH
+
+	while(blocks-- > 0) {
+		__m128i saved0 = state0,
+		        saved1 = state1;
+
+		__m128i w[4];
+		for(int i = 0; i < 4; i++)
+			w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16 * i)), byteswap);
+
+		for(int i = 0; i < 16; i++) {
+			__m128i msg = _mm_add_epi32(w[i & 3], _mm_loadu_si128((const __m128i *)&K[4 * i]));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));
+
+			// w[i + 4] replaces w[i], which has just been consumed
+			if(i < 12) {
+				__m128i next = _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]);
+				next         = _mm_add_epi32(next, _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4));
+				w[i & 3]     = _mm_sha256msg2_epu32(next, w[(i + 3) & 3]);
+			}
+		}
+
+		state0 = _mm_add_epi32(state0, saved0);
+		state1 = _mm_add_epi32(state1, saved1);
+
+		data += 64;
+	}
+
+	tmp    = _mm_shuffle_epi32(state0, 0x1b);    // FEBA
+	state1 = _mm_shuffle_epi32(state1, 0xb1);    // DCHG
+	state0 = _mm_blend_epi16(tmp, state1, 0xf0); // DCBA
+	state1 = _mm_alignr_epi8(state1, tmp, 8);    // HGFE
+	_mm_storeu_si128((__m128i *)&state[0], state0);
+	_mm_storeu_si128((__m128i *)&state[4], state1);
+}
+
+#endif
+
+
+static sha256_fn_blocks sha256_blocks = sha256_blocks_portable;
+
+
+#ifdef SHA256_X86
+__attribute__((constructor)) static void sha256_select_kernel() {
+	unsigned int eax, ebx, ecx, edx;
+	if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSE4_1) || !(ecx & bit_SSSE3))
+		return;
+	if(!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) || !(ebx & bit_SHA))
+		return;
+	sha256_blocks = sha256_blocks_shani;
+}
+#endif
+
+
+bool sha256_accelerated() {
+	return (sha256_blocks != sha256_blocks_portable);
+}
+
+
+void sha256_init(sha256_ctx_t * ctx) {
+	ctx->state[0]      = 0x6a09e667;
+	ctx->state[1]      = 0xbb67ae85;
+	ctx->state[2]      = 0x3c6ef372;
+	ctx->state[3]      = 0xa54ff53a;
+	ctx->state[4]      = 0x510e527f;
+	ctx->state[5]      = 0x9b05688c;
+	ctx->state[6]      = 0x1f83d9ab;
+	ctx->state[7]      = 0x5be0cd19;
+	ctx->length        = 0;
+	ctx->buffer_length = 0;
+}
+
+
+void sha256_update(sha256_ctx_t * ctx, const void * data, size_t size) {
+	const unsigned char * ptr = (const unsigned char *)data;
+	ctx->length += size;
+
+	// complete the partial block first
+	if(ctx->buffer_length > 0) {
+		size_t n = 64 - ctx->buffer_length;
+		if(n > size)
+			n = size;
+		memcpy(ctx->buffer + ctx->buffer_length, ptr, n);
+		ctx->buffer_length += n;
+		ptr  += n;
+		size -= n;
+		if(ctx->buffer_length < 64)
+			return;
+		sha256_blocks(ctx->state, ctx->buffer, 1);
+		ctx->buffer_length = 0;
+	}
+
+	if(size >= 64) {
+		sha256_blocks(ctx->state, ptr, size / 64);
+		ptr  += size & ~(size_t)63;
+		size &= 63;
+	}
+
+	memcpy(ctx->buffer, ptr, size);
+	ctx->buffer_length = size;
+}
+
+
+void sha256_final(unsigned char * result, sha256_ctx_t * ctx) {
+	uint64_t bits = ctx->length * 8;
+
+	ctx->buffer[ctx->buffer_length++] = 0x80;
+	if(ctx->buffer_length > 56) {
+		memset(ctx->buffer + ctx->buffer_length, 0, 64 - ctx->buffer_length);
+		sha256_blocks(ctx->state, ctx->buffer, 1);
+		ctx->buffer_length = 0;
+	}
+	memset(ctx->buffer + ctx->buffer_length, 0, 56 - ctx->buffer_length);
+	for(int i = 0; i < 8; i++)
+		ctx->buffer[56 + i] = bits >> (56 - 8 * i);
+	sha256_blocks(ctx->state, ctx->buffer, 1);
+
+	for(int i = 0; i < 8; i++) {
+		result[4 * i]     = ctx->state[i] >> 24;
+		result[4 * i + 1] = ctx->state[i] >> 16;
+		result[4 * i + 2] = ctx->state[i] >> 8;
+		result[4 * i + 3] = ctx->state[i];
+	}
+
+	memset(ctx, 0, sizeof(sha256_ctx_t));
+}
@@ -0,0 +1,43 @@
+#ifndef INCLUDE_SHA256_H
+#define INCLUDE_SHA256_H
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * SHA-256 context (FIPS 180-4). Treat all fields as private.
+ */
+typedef struct {
+	uint32_t      state[8];
+	uint64_t      length;        // bytes hashed so far
+	unsigned char buffer[64];    // partial block
+	size_t        buffer_length;
+} sha256_ctx_t;
+
+/**
+ * Returns true if blocks are compressed with the x86 SHA extensions, false if the portable implementation is used.
+ */
+bool sha256_accelerated();
+
+/**
+ * Incremental hashing; sha256_final writes the 32 byte digest to result.
+ */
+void sha256_init(sha256_ctx_t * ctx);
+void sha256_update(sha256_ctx_t * ctx, const void * data, size_t size);
+void sha256_final(unsigned char * result, sha256_ctx_t * ctx);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
@@ -0,0 +1,376 @@
+#define _GNU_SOURCE
+#include "uring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+/**
+ * Every queued file is a chain of three requests on the fixed file slot of the same index:
+ * openat (direct descriptor) -> read -> close. The read is hard linked to the close, so the file gets closed even
+ * if the read is short, which it is whenever the buffer is larger than the file.
+ * The user_data of a request is its slot index shifted left by two, or'ed with the operation below.
+ */
+enum {
+	URING_OP_OPEN,
+	URING_OP_READ,
+	URING_OP_CLOSE
+};
+
+
+typedef struct {
+	void *  user_data;
+	ssize_t result;    // of the openat until the read completes, then of the read
+	int     remaining; // completions still expected for this chain
+} uring_slot_t;
+
+
+typedef struct {
+	int                   fd;
+	unsigned              capacity;
+
+	void *                sq_ring;
+	size_t                sq_ring_size;
+	unsigned *            sq_head;
+	unsigned *            sq_tail;
+	unsigned              sq_mask;
+	unsigned *            sq_array;
+	struct io_uring_sqe * sqes;
+	size_t                sqes_size;
+	unsigned              sq_written; // tail including requests not yet made visible to the kernel
+
+	void *                cq_ring;    // same as sq_ring if the kernel maps both rings at once
+	size_t                cq_ring_size;
+	unsigned *            cq_head;
+	unsigned *            cq_tail;
+	unsigned              cq_mask;
+	struct io_uring_cqe * cqes;
+
+	uring_slot_t *        slots;
+	unsigned *            free_slots;
+	unsigned              free_count;
+	unsigned *            completed;  // fifo of completed slots
+	unsigned              completed_head;
+	unsigned              completed_count;
+} uring_internal_t;
+
+
+static int io_uring_setup(unsigned entries, struct io_uring_params * params) {
+	return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+
+static int io_uring_register(int fd, unsigned opcode, const void * arg, unsigned count) {
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+
+static unsigned uring_in_flight(const uring_internal_t * priv) {
+	return priv->capacity - priv->free_count - priv->completed_count;
+}
+
+
+static struct io_uring_sqe * uring_get_sqe(uring_internal_t * priv) {
+	unsigned index = priv->sq_written++ & priv->sq_mask;
+	struct io_uring_sqe * sqe = &priv->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	priv->sq_array[index] = index;
+	return sqe;
+}
+
+
+/**
+ * Moves completions from the completion ring to the slots.
+ */
+static void uring_collect(uring_internal_t * priv) {
+	unsigned head = *priv->cq_head;
+	unsigned tail = __atomic_load_n(priv->cq_tail, __ATOMIC_ACQUIRE);
+
+	for(; head != tail; head++) {
+		const struct io_uring_cqe * cqe = &priv->cqes[head & priv->cq_mask];
+		uring_slot_t * slot = &priv->slots[cqe->user_data >> 2];
+
+		switch(cqe->user_data & 3) {
+			case URING_OP_OPEN:
+				slot->result = cqe->res;
+				break;
+			case URING_OP_READ:
+				if(slot->result >= 0)
+					slot->result = cqe->res;
+				break;
+		}
+
+		if(--slot->remaining == 0) {
+			unsigned index = (priv->completed_head + priv->completed_count++) % priv->capacity;
+			priv->completed[index] = cqe->user_data >> 2;
+		}
+	}
+
+	__atomic_store_n(priv->cq_head, head, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * Returns whether the kernel knows all operations the chains consist of.
+ */
+static bool uring_probe(uring_internal_t * priv) {
+	const unsigned          ops_count = 256;
+	struct io_uring_probe * probe     = (struct io_uring_probe *)calloc(1, sizeof(struct io_uring_probe) + ops_count * sizeof(struct io_uring_probe_op));
+	if(probe == NULL)
+		return false;
+
+	static const unsigned ops[] = { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE };
+	bool supported = (io_uring_register(priv->fd, IORING_REGISTER_PROBE, probe, ops_count) == 0);
+	for(size_t i = 0; i < sizeof(ops) / sizeof(ops[0]) && supported; i++)
+		supported = (ops[i] < probe->ops_len && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED));
+	free(probe);
+	return supported;
+}
+
+
+/**
+ * Submits the single request prepared and waits for it to complete.
+ * Returns its result, or a negated errno value if it could not be submitted.
+ */
+static int uring_run_request(uring_internal_t * priv) {
+	__atomic_store_n(priv->sq_tail, priv->sq_written, __ATOMIC_RELEASE);
+
+	unsigned head = *priv->cq_head;
+	while(__atomic_load_n(priv->cq_tail, __ATOMIC_ACQUIRE) == head) {
+		unsigned to_submit = priv->sq_written - __atomic_load_n(priv->sq_head, __ATOMIC_ACQUIRE);
+		if(io_uring_enter(priv->fd, to_submit, 1, IORING_ENTER_GETEVENTS) == -1 && errno != EINTR)
+			return -errno;
+	}
+
+	int result = priv->cqes[head & priv->cq_mask].res;
+	__atomic_store_n(priv->cq_head, head + 1, __ATOMIC_RELEASE);
+	return result;
+}
+
+
+/**
+ * Opens a file into the first fixed file slot and closes it again. Direct descriptors need Linux 5.15, which the
+ * probe can't tell: older kernels either reject file_index or ignore it and return a regular descriptor, which
+ * the fixed file read and close of a chain would never touch.
+ */
+static bool uring_test_direct(uring_internal_t * priv) {
+	struct io_uring_sqe * sqe = uring_get_sqe(priv);
+	sqe->opcode     = IORING_OP_OPENAT;
+	sqe->fd         = AT_FDCWD;
+	sqe->addr       = (uintptr_t)"/";
+	sqe->open_flags = O_RDONLY | O_DIRECTORY;
+	sqe->file_index = 1;
+	int result = uring_run_request(priv);
+	if(result > 0)
+		close(result);
+	if(result != 0)
+		return false;
+
+	sqe = uring_get_sqe(priv);
+	sqe->opcode     = IORING_OP_CLOSE;
+	sqe->file_index = 1;
+	return (uring_run_request(priv) == 0);
+}
+
+
+struct uring_t * uring_create(unsigned capacity) {
+	uring_internal_t * priv = (uring_internal_t *)calloc(1, sizeof(uring_internal_t));
+	if(priv == NULL)
+		return NULL;
+	priv->fd       = -1;
+	priv->capacity = capacity;
+
+	// three requests per file
+	unsigned entries = 1;
+	while(entries < 3 * capacity)
+		entries *= 2;
+
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	priv->fd = io_uring_setup(entries, &params);
+	if(priv->fd == -1)
+		goto failure;
+
+	priv->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	priv->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if(params.features & IORING_FEAT_SINGLE_MMAP) {
+		if(priv->cq_ring_size > priv->sq_ring_size)
+			priv->sq_ring_size = priv->cq_ring_size;
+		priv->cq_ring_size = 0;
+	}
+
+	priv->sq_ring = mmap(NULL, priv->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, priv->fd, IORING_OFF_SQ_RING);
+	if(priv->sq_ring == MAP_FAILED)
+		goto failure;
+	if(priv->cq_ring_size == 0)
+		priv->cq_ring = priv->sq_ring;
+	else {
+		priv->cq_ring = mmap(NULL, priv->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, priv->fd, IORING_OFF_CQ_RING);
+		if(priv->cq_ring == MAP_FAILED)
+			goto failure;
+	}
+	priv->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	priv->sqes      = (struct io_uring_sqe *)mmap(NULL, priv->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, priv->fd, IORING_OFF_SQES);
+	if(priv->sqes == MAP_FAILED)
+		goto failure;
+
+	priv->sq_head    = (unsigned *)((char *)priv->sq_ring + params.sq_off.head);
+	priv->sq_tail    = (unsigned *)((char *)priv->sq_ring + params.sq_off.tail);
+	priv->sq_mask    = *(unsigned *)((char *)priv->sq_ring + params.sq_off.ring_mask);
+	priv->sq_array   = (unsigned *)((char *)priv->sq_ring + params.sq_off.array);
+	priv->sq_written = *priv->sq_tail;
+	priv->cq_head    = (unsigned *)((char *)priv->cq_ring + params.cq_off.head);
+	priv->cq_tail    = (unsigned *)((char *)priv->cq_ring + params.cq_off.tail);
+	priv->cq_mask    = *(unsigned *)((char *)priv->cq_ring + params.cq_off.ring_mask);
+	priv->cqes       = (struct io_uring_cqe *)((char *)priv->cq_ring + params.cq_off.cqes);
+	if(!uring_probe(priv))
+		goto failure;
+
+	priv->slots      = (uring_slot_t *)calloc(capacity, sizeof(uring_slot_t));
+	priv->free_slots = (unsigned *)malloc(capacity * sizeof(unsigned));
+	priv->completed  = (unsigned *)malloc(capacity * sizeof(unsigned));
+	int * files      = (int *)malloc(capacity * sizeof(int));
+	if(priv->slots == NULL || priv->free_slots == NULL || priv->completed == NULL || files == NULL) {
+		free(files);
+		goto failure;
+	}
+	for(unsigned i = 0; i < capacity; i++) {
+		priv->free_slots[i] = capacity - 1 - i;
+		files[i]            = -1;
+	}
+	priv->free_count = capacity;
+
+	// a sparse table of fixed files, one per slot, which the chains open their file into
+	int result = io_uring_register(priv->fd, IORING_REGISTER_FILES, files, capacity);
+	free(files);
+	if(result != 0 || !uring_test_direct(priv))
+		goto failure;
+
+	return (struct uring_t *)priv;
+
+failure:
+	uring_destroy((struct uring_t *)priv);
+	return NULL;
+}
+
+
+void uring_destroy(struct uring_t * handle) {
+	uring_internal_t * priv = (uring_internal_t *)handle;
+
+	// the kernel may still write to the buffers of chains in flight, wait for them
+	if(priv->slots != NULL) {
+		void *  user_data;
+		ssize_t result;
+		while(uring_in_flight(priv) > 0 && uring_submit(handle, true) == 0)
+			while(uring_reap(handle, &user_data, &result))
+				;
+	}
+
+	if(priv->sqes != NULL && priv->sqes != MAP_FAILED)
+		munmap(priv->sqes, priv->sqes_size);
+	if(priv->cq_ring != NULL && priv->cq_ring != MAP_FAILED && priv->cq_ring != priv->sq_ring)
+		munmap(priv->cq_ring, priv->cq_ring_size);
+	if(priv->sq_ring != NULL && priv->sq_ring != MAP_FAILED)
+		munmap(priv->sq_ring, priv->sq_ring_size);
+	if(priv->fd != -1)
+		close(priv->fd);
+	free(priv->completed);
+	free(priv->free_slots);
+	free(priv->slots);
+	free(priv);
+}
+
+
+bool uring_queue(struct uring_t * handle, const char * path, void * buffer, size_t size, void * user_data) {
+	uring_internal_t * priv = (uring_internal_t *)handle;
+	if(priv->free_count == 0)
+		return false;
+
+	unsigned index = priv->free_slots[--priv->free_count];
+	priv->slots[index].user_data = user_data;
+	priv->slots[index].result    = 0;
+	priv->slots[index].remaining = 3;
+
+	struct io_uring_sqe * sqe = uring_get_sqe(priv);
+	sqe->opcode     = IORING_OP_OPENAT;
+	sqe->flags      = IOSQE_IO_LINK;
+	sqe->fd         = AT_FDCWD;
+	sqe->addr       = (uintptr_t)path;
+	sqe->open_flags = O_RDONLY;
+	sqe->file_index = index + 1;
+	sqe->user_data  = ((__u64)index << 2) | URING_OP_OPEN;
+
+	sqe = uring_get_sqe(priv);
+	sqe->opcode    = IORING_OP_READ;
+	sqe->flags     = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+	sqe->fd        = index;
+	sqe->addr      = (uintptr_t)buffer;
+	sqe->len       = size;
+	sqe->off       = 0;
+	sqe->user_data = ((__u64)index << 2) | URING_OP_READ;
+
+	sqe = uring_get_sqe(priv);
+	sqe->opcode     = IORING_OP_CLOSE;
+	sqe->file_index = index + 1;
+	sqe->user_data  = ((__u64)index << 2) | URING_OP_CLOSE;
+
+	return true;
+}
+
+
+int uring_submit(struct uring_t * handle, bool wait) {
+	uring_internal_t * priv = (uring_internal_t *)handle;
+	__atomic_store_n(priv->sq_tail, priv->sq_written, __ATOMIC_RELEASE);
+
+	uring_collect(priv);
+	while(true) {
+		unsigned to_submit = priv->sq_written - __atomic_load_n(priv->sq_head, __ATOMIC_ACQUIRE);
+		bool     block     = (wait && priv->completed_count == 0 && uring_in_flight(priv) > 0);
+		if(to_submit == 0 && !block)
+			return 0;
+
+		int result = io_uring_enter(priv->fd, to_submit, block ? 1 : 0, block ? IORING_ENTER_GETEVENTS : 0);
+		if(result == -1) {
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		uring_collect(priv);
+		if(result == 0 && !block)
+			return 0;
+	}
+}
+
+
+bool uring_reap(struct uring_t * handle, void ** user_data, ssize_t * result) {
+	uring_internal_t * priv = (uring_internal_t *)handle;
+	if(priv->completed_count == 0)
+		return false;
+
+	unsigned index = priv->completed[priv->completed_head];
+	priv->completed_head = (priv->completed_head + 1) % priv->capacity;
+	priv->completed_count--;
+
+	*user_data = priv->slots[index].user_data;
+	*result    = priv->slots[index].result;
+	priv->free_slots[priv->free_count++] = index;
+	return true;
+}
+
+
+size_t uring_get_pending(const struct uring_t * handle) {
+	const uring_internal_t * priv = (const uring_internal_t *)handle;
+	return priv->capacity - priv->free_count;
+}
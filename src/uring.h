@@ -0,0 +1,66 @@
+#ifndef INCLUDE_URING_H
+#define INCLUDE_URING_H
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * Opaque handle of an io_uring based batch reader. Each queued file is opened, read into a buffer and closed by
+ * the kernel as one linked chain, so many small files can be in flight with a single system call per batch.
+ * The ring is driven by raw system calls, there is no dependency on liburing. A handle is not thread-safe.
+ */
+struct uring_t;
+
+/**
+ * Creates a batch reader that keeps at most capacity files in flight.
+ * Returns NULL if io_uring is not available (e.g. seccomp or kernel.io_uring_disabled), if it can't open files into
+ * fixed file slots (before Linux 5.15) or on failure.
+ */
+struct uring_t * uring_create(unsigned capacity);
+
+/**
+ * Releases the handle. Waits for files still in flight first, as the kernel may still write to their buffers.
+ */
+void uring_destroy(struct uring_t * handle);
+
+/**
+ * Queues reading up to size bytes from the start of the file at path into buffer.
+ * path and buffer have to stay valid until the file is reaped.
+ * Returns false if capacity files are queued or in flight already.
+ */
+bool uring_queue(struct uring_t * handle, const char * path, void * buffer, size_t size, void * user_data);
+
+/**
+ * Hands all queued files to the kernel and collects completions. If wait is true, blocks until at least one file
+ * can be reaped, unless none is in flight.
+ * Returns -1 on failure (with errno set), 0 otherwise.
+ */
+int uring_submit(struct uring_t * handle, bool wait);
+
+/**
+ * Takes a completed file: sets user_data as passed to uring_queue and result to the number of bytes read,
+ * or to a negated errno value if opening or reading the file failed.
+ * Returns false if no file has completed.
+ */
+bool uring_reap(struct uring_t * handle, void ** user_data, ssize_t * result);
+
+/**
+ * Returns the number of files queued, in flight or completed but not yet reaped.
+ */
+size_t uring_get_pending(const struct uring_t * handle);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
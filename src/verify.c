@@ -0,0 +1,884 @@
+#define _GNU_SOURCE
+#include "verify.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "md5.h"
+#include "md5_mb.h"
+#include "reader.h"
+#include "uring.h"
+#include "sha256.h"
+
+
+typedef struct {
+	char *          path;
+	size_t          number;    // as returned by verify_submit
+	verify_digest_t digest;
+	unsigned char   expected[32];
+	unsigned char   checksum[32];
+	cache_key_t     key;       // key.size is -1 if unknown
+	uint64_t        position;  // physical position of the contents, used to order jobs
+	unsigned char * data;      // contents of the file if it has been read via io_uring already
+	size_t          data_size;
+	bool            cacheable; // key is valid and the checksum should be stored in the cache
+	bool            duplicate; // an earlier job hashes the same file, its checksum is taken from the memo
+	bool            failed;
+	bool            done;
+} verify_job_t;
+
+
+/**
+ * Initial number of memo slots.
+ */
+#define VERIFY_MEMO_SIZE 1024
+
+
+/**
+ * Checksum of a file hashed during this run, keyed by its identity.
+ */
+typedef struct {
+	cache_key_t   key;
+	unsigned char checksum[32];
+	bool          failed;
+	bool          occupied;
+} verify_memo_t;
+
+
+typedef struct {
+	pthread_mutex_t  mutex;
+	pthread_cond_t   job_available; // signaled when a job got submitted or the workers should quit
+	pthread_cond_t   job_done;      // signaled when a worker finished a job
+	bool             quit;
+
+	pthread_t *      threads;
+	size_t           threads_count;
+
+	struct cache_t * cache;
+	verify_order_t   order;
+	bool             cache_neutral; // read files without leaving them in the page cache
+
+	// checksums of all files submitted so far, so every inode is read at most once per run;
+	// only touched by the thread submitting and collecting jobs
+	verify_memo_t *  memo;
+	size_t           memo_count;    // always a power of two
+	size_t           memo_occupied;
+	size_t           duplicates;
+
+	// jobs in submission order:
+	// jobs[0 .. next_report) have been reported and released, the others are pending or done
+	verify_job_t **  jobs;
+	size_t           jobs_count;
+	size_t           jobs_allocated;
+	size_t           next_report;
+	size_t           submitted;     // jobs submitted over the lifetime of the handle, numbers them
+
+	// jobs that have to be hashed, in the order workers take them:
+	// queue[0 .. next_dispatch) are taken by workers,
+	// queue[next_dispatch .. queue_ready) wait for a worker,
+	// queue[queue_ready .. queue_count) are held back until they are released and ordered
+	verify_job_t **  queue;
+	size_t           queue_count;
+	size_t           queue_allocated;
+	size_t           queue_ready;
+	size_t           next_dispatch;
+} verify_internal_t;
+
+
+static void hex_encode(const unsigned char * digest, size_t length, char * result) {
+	for(size_t i = 0; i < length; i++)
+		sprintf(result + 2 * i, "%02x", digest[i]);
+	result[2 * length] = '\0';
+}
+
+
+static size_t verify_digest_size(verify_digest_t digest) {
+	switch(digest) {
+		default:                   return 0;
+		case VERIFY_DIGEST_MD5:    return 16;
+		case VERIFY_DIGEST_SHA256: return 32;
+	}
+}
+
+
+/**
+ * State of hashing a file with the reader.
+ */
+typedef struct {
+	struct reader_t * reader;
+	verify_digest_t   digest;
+	unsigned char *   result;
+	ssize_t           size; // of the last piece read, -1 on failure
+} verify_sum_t;
+
+
+/**
+ * Hashes the current file of the reader from its start; guarded, as mapped files may fault.
+ */
+static void verify_sum_file(void * user_data) {
+	verify_sum_t *        sum = (verify_sum_t *)user_data;
+	const unsigned char * data;
+	if(sum->digest == VERIFY_DIGEST_MD5) {
+		MD5_CTX ctx;
+		MD5_Init(&ctx);
+		while((sum->size = reader_read(sum->reader, &data)) > 0)
+			MD5_Update(&ctx, data, sum->size);
+		MD5_Final(sum->result, &ctx);
+	}
+	else {
+		sha256_ctx_t ctx;
+		sha256_init(&ctx);
+		while((sum->size = reader_read(sum->reader, &data)) > 0)
+			sha256_update(&ctx, data, sum->size);
+		sha256_final(sum->result, &ctx);
+	}
+}
+
+
+static int digestsum(struct reader_t * reader, const char * path, verify_digest_t digest, unsigned char * result) {
+	if(digest != VERIFY_DIGEST_MD5 && digest != VERIFY_DIGEST_SHA256)
+		return -1;
+
+	if(reader_open(reader, path) != 0) {
+		perror("file open");
+		return -1;
+	}
+
+	// a mapped file truncated while it is hashed is hashed again, read this time
+	verify_sum_t sum = { reader, digest, result, 0 };
+	if(reader_guard(verify_sum_file, &sum) != NULL) {
+		if(reader_reopen_unmapped(reader) == 0)
+			verify_sum_file(&sum);
+		else
+			sum.size = -1;
+	}
+	reader_close(reader);
+	if(sum.size == -1) {
+		perror("file read");
+		return -1;
+	}
+	return 0;
+}
+
+
+/**
+ * Returns the current time in nanoseconds since the epoch from the coarse clock file timestamps are taken from,
+ * so a file changed after this call never gets an older timestamp.
+ */
+static int64_t verify_get_file_time() {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/**
+ * Returns the memo slot holding key, or the free slot where it belongs.
+ */
+static verify_memo_t * verify_find_memo(verify_internal_t * priv, const cache_key_t * key) {
+	size_t mask = priv->memo_count - 1;
+	for(size_t i = cache_key_hash(key) & mask; ; i = (i + 1) & mask) {
+		verify_memo_t * memo = &priv->memo[i];
+		if(!memo->occupied || cache_key_equals(&memo->key, key))
+			return memo;
+	}
+}
+
+
+/**
+ * Adds key to the memo. Returns false if it is there already.
+ */
+static bool verify_insert_memo(verify_internal_t * priv, const cache_key_t * key) {
+	// keep the load factor below 1/2
+	if(2 * (priv->memo_occupied + 1) > priv->memo_count) {
+		verify_memo_t * old_memo  = priv->memo;
+		size_t          old_count = priv->memo_count;
+		priv->memo_count *= 2;
+		priv->memo        = (verify_memo_t *)calloc(priv->memo_count, sizeof(verify_memo_t));
+		assert(priv->memo != NULL);
+		for(size_t i = 0; i < old_count; i++)
+			if(old_memo[i].occupied)
+				*verify_find_memo(priv, &old_memo[i].key) = old_memo[i];
+		free(old_memo);
+	}
+
+	verify_memo_t * memo = verify_find_memo(priv, key);
+	if(memo->occupied)
+		return false;
+	memo->key      = *key;
+	memo->failed   = true; // until the job hashing the file is collected
+	memo->occupied = true;
+	priv->memo_occupied++;
+	return true;
+}
+
+
+/**
+ * Takes the next job from the queue. If block is true, waits for a job to become available.
+ * Returns NULL if there is no job (anymore). Expects the mutex to be locked.
+ */
+static verify_job_t * verify_take_job(verify_internal_t * priv, bool block) {
+	while(block && !priv->quit && priv->next_dispatch == priv->queue_ready)
+		pthread_cond_wait(&priv->job_available, &priv->mutex);
+	if(priv->next_dispatch == priv->queue_ready)
+		return NULL;
+
+	verify_job_t * job = priv->queue[priv->next_dispatch];
+	priv->queue[priv->next_dispatch++] = NULL;
+	return job;
+}
+
+
+static int verify_compare_jobs(const void * a, const void * b) {
+	const verify_job_t * x = *(verify_job_t * const *)a,
+	                   * y = *(verify_job_t * const *)b;
+	if(x->key.device != y->key.device)
+		return (x->key.device < y->key.device ? -1 : 1);
+	if(x->position != y->position)
+		return (x->position < y->position ? -1 : 1);
+	if(x->key.inode != y->key.inode)
+		return (x->key.inode < y->key.inode ? -1 : 1);
+	return 0;
+}
+
+
+/**
+ * Returns the physical position of the first extent of the file at path on its device, or UINT64_MAX if it is
+ * unknown, e.g. because the file is empty or the file system does not support FIEMAP.
+ */
+static uint64_t verify_physical_position(const char * path) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd == -1)
+		return UINT64_MAX;
+
+	uint64_t request[(sizeof(struct fiemap) + sizeof(struct fiemap_extent)) / sizeof(uint64_t) + 1];
+	memset(request, 0, sizeof(request));
+	struct fiemap * map = (struct fiemap *)request;
+	map->fm_start        = 0;
+	map->fm_length       = FIEMAP_MAX_OFFSET;
+	map->fm_extent_count = 1;
+
+	uint64_t result = UINT64_MAX;
+	if(ioctl(fd, FS_IOC_FIEMAP, map) == 0 && map->fm_mapped_extents > 0 && !(map->fm_extents[0].fe_flags & FIEMAP_EXTENT_UNKNOWN))
+		result = map->fm_extents[0].fe_physical;
+
+	close(fd);
+	return result;
+}
+
+
+/**
+ * Orders the jobs held back since the last call and hands them to the workers.
+ * Only the thread submitting jobs touches the held back part of the queue, so this runs without the mutex.
+ */
+static void verify_release_jobs(verify_internal_t * priv) {
+	pthread_mutex_lock(&priv->mutex);
+	size_t first = priv->queue_ready,
+	       count = priv->queue_count - first;
+	pthread_mutex_unlock(&priv->mutex);
+	if(count == 0)
+		return;
+
+	// inode order first: it is wanted for VERIFY_ORDER_INODE, and makes looking up the extents cheap
+	verify_job_t ** jobs = priv->queue + first;
+	qsort(jobs, count, sizeof(verify_job_t *), verify_compare_jobs);
+
+	if(priv->order == VERIFY_ORDER_EXTENT) {
+		for(size_t i = 0; i < count; i++)
+			jobs[i]->position = verify_physical_position(jobs[i]->path);
+		qsort(jobs, count, sizeof(verify_job_t *), verify_compare_jobs);
+	}
+
+	pthread_mutex_lock(&priv->mutex);
+	priv->queue_ready = priv->queue_count;
+	pthread_cond_broadcast(&priv->job_available);
+	pthread_mutex_unlock(&priv->mutex);
+}
+
+
+/**
+ * Number of small files a worker keeps in flight on its io_uring, and the size of the buffer each one is read into.
+ * Files of at least VERIFY_URING_FILE_SIZE bytes are read by the reader instead.
+ */
+#define VERIFY_URING_DEPTH     128
+#define VERIFY_URING_FILE_SIZE 16384
+
+
+/**
+ * Per-thread state of a worker.
+ */
+typedef struct {
+	verify_internal_t * priv;
+	struct reader_t *   reader;       // for files that are not read via io_uring
+	struct uring_t *    ring;         // NULL if io_uring is not available or the page cache has to be left alone
+	unsigned char *     buffers;      // VERIFY_URING_DEPTH buffers of VERIFY_URING_FILE_SIZE bytes
+	size_t *            free_buffers; // indices of buffers that are neither in flight nor being hashed
+	size_t              free_count;
+	verify_job_t *      deferred;     // job taken while filling the ring that has to be read by the reader
+} verify_worker_t;
+
+
+static void verify_worker_init(verify_worker_t * worker, verify_internal_t * priv) {
+	worker->priv         = priv;
+	worker->reader       = reader_create(priv->cache_neutral);
+	worker->ring         = (priv->cache_neutral ? NULL : uring_create(VERIFY_URING_DEPTH));
+	worker->buffers      = NULL;
+	worker->free_buffers = NULL;
+	worker->free_count   = 0;
+	worker->deferred     = NULL;
+	assert(worker->reader != NULL);
+	if(worker->ring != NULL) {
+		worker->buffers      = (unsigned char *)malloc(VERIFY_URING_DEPTH * VERIFY_URING_FILE_SIZE);
+		worker->free_buffers = (size_t *)malloc(VERIFY_URING_DEPTH * sizeof(size_t));
+		assert(worker->buffers != NULL && worker->free_buffers != NULL);
+		for(size_t i = 0; i < VERIFY_URING_DEPTH; i++)
+			worker->free_buffers[worker->free_count++] = i;
+	}
+}
+
+
+static void verify_worker_cleanup(verify_worker_t * worker) {
+	if(worker->ring != NULL)
+		uring_destroy(worker->ring);
+	free(worker->free_buffers);
+	free(worker->buffers);
+	reader_destroy(worker->reader);
+}
+
+
+/**
+ * Starts reading the file of a small job via io_uring. Returns false if the job has to be read by the reader.
+ */
+static bool verify_prefetch_job(verify_worker_t * worker, verify_job_t * job) {
+	if(worker->ring == NULL || worker->free_count == 0 || job->key.size < 0 || job->key.size >= VERIFY_URING_FILE_SIZE)
+		return false;
+
+	// one byte more than expected, to notice files that grew in the meantime
+	unsigned char * buffer = worker->buffers + worker->free_buffers[worker->free_count - 1] * VERIFY_URING_FILE_SIZE;
+	if(!uring_queue(worker->ring, job->path, buffer, job->key.size + 1, job))
+		return false;
+
+	worker->free_count--;
+	job->data = buffer;
+	return true;
+}
+
+
+/**
+ * Returns the buffer of a job read via io_uring to the worker.
+ */
+static void verify_release_buffer(verify_worker_t * worker, verify_job_t * job) {
+	if(job->data == NULL)
+		return;
+	worker->free_buffers[worker->free_count++] = (job->data - worker->buffers) / VERIFY_URING_FILE_SIZE;
+	job->data = NULL;
+}
+
+
+/**
+ * Returns the next job to be hashed: either its contents have been read into job->data already, or it has to be
+ * read by the reader. If block is true, waits for a job to become available.
+ * Returns NULL if there is no job (anymore).
+ */
+static verify_job_t * verify_next_job(verify_worker_t * worker, bool block) {
+	verify_internal_t * priv = worker->priv;
+
+	while(true) {
+		// keep the ring filled with small files
+		if(worker->ring != NULL && worker->deferred == NULL) {
+			pthread_mutex_lock(&priv->mutex);
+			while(worker->free_count > 0) {
+				verify_job_t * job = verify_take_job(priv, false);
+				if(job == NULL)
+					break;
+				if(!verify_prefetch_job(worker, job)) {
+					worker->deferred = job;
+					break;
+				}
+			}
+			pthread_mutex_unlock(&priv->mutex);
+		}
+
+		if(worker->deferred != NULL) {
+			verify_job_t * job = worker->deferred;
+			worker->deferred = NULL;
+			return job;
+		}
+
+		if(worker->ring != NULL && uring_get_pending(worker->ring) > 0) {
+			if(uring_submit(worker->ring, block) != 0) {
+				perror("io_uring_enter");
+				exit(EXIT_FAILURE);
+			}
+
+			void *  user_data;
+			ssize_t result;
+			if(uring_reap(worker->ring, &user_data, &result)) {
+				verify_job_t * job = (verify_job_t *)user_data;
+				// a file whose size changed since it was statted goes to the reader as well, like a failed one
+				if(result == job->key.size)
+					job->data_size = result;
+				else
+					verify_release_buffer(worker, job); // let the reader try again, it reports errors as well
+				return job;
+			}
+			if(!block)
+				return NULL;
+			continue;
+		}
+
+		// nothing in flight
+		pthread_mutex_lock(&priv->mutex);
+		verify_job_t * job = verify_take_job(priv, block);
+		pthread_mutex_unlock(&priv->mutex);
+		if(job == NULL || !verify_prefetch_job(worker, job))
+			return job;
+	}
+}
+
+
+/**
+ * Hashes the contents of a job, from memory or by reading the file.
+ */
+static void verify_hash_job(verify_worker_t * worker, verify_job_t * job) {
+	if(job->data == NULL) {
+		job->failed = (digestsum(worker->reader, job->path, job->digest, job->checksum) != 0);
+		return;
+	}
+
+	if(job->digest == VERIFY_DIGEST_MD5) {
+		MD5_CTX ctx;
+		MD5_Init(&ctx);
+		MD5_Update(&ctx, job->data, job->data_size);
+		MD5_Final(job->checksum, &ctx);
+	}
+	else if(job->digest == VERIFY_DIGEST_SHA256) {
+		sha256_ctx_t ctx;
+		sha256_init(&ctx);
+		sha256_update(&ctx, job->data, job->data_size);
+		sha256_final(job->checksum, &ctx);
+	}
+	else
+		job->failed = true;
+}
+
+
+/**
+ * Marks a job as done and wakes up verify_collect.
+ */
+static void verify_finish_job(verify_worker_t * worker, verify_job_t * job) {
+	verify_internal_t * priv = worker->priv;
+	verify_release_buffer(worker, job);
+
+	pthread_mutex_lock(&priv->mutex);
+	job->done = true;
+	pthread_cond_broadcast(&priv->job_done);
+	pthread_mutex_unlock(&priv->mutex);
+}
+
+
+/**
+ * Worker hashing one file at a time.
+ */
+static void verify_worker_scalar(verify_worker_t * worker) {
+	verify_job_t * job;
+	while((job = verify_next_job(worker, true)) != NULL) {
+		verify_hash_job(worker, job);
+		verify_finish_job(worker, job);
+	}
+}
+
+
+/**
+ * Per-lane state of the multi-buffer worker.
+ */
+typedef struct {
+	verify_job_t *    job;
+	struct reader_t * reader;
+} verify_lane_t;
+
+
+static void verify_run_lanes(void * user_data) {
+	md5_mb_run((md5_mb_t *)user_data);
+}
+
+
+/**
+ * Worker hashing several files at once, one per lane of the multi-buffer md5 kernel.
+ * Jobs using any other digest are hashed right away, one at a time.
+ */
+static void verify_worker_multi_buffer(verify_worker_t * worker) {
+	size_t        lanes  = md5_mb_lanes();
+	size_t        active = 0;
+	verify_lane_t lane[MD5_MB_MAX_LANES];
+	md5_mb_t      ctx;
+	md5_mb_init(&ctx);
+	for(size_t i = 0; i < lanes; i++) {
+		lane[i].job    = NULL;
+		lane[i].reader = reader_create(worker->priv->cache_neutral);
+		assert(lane[i].reader != NULL);
+	}
+
+	while(true) {
+		// fill idle lanes, but only wait for new jobs if there is nothing else to do
+		for(size_t i = 0; i < lanes; i++) {
+			while(lane[i].job == NULL) {
+				verify_job_t * job = verify_next_job(worker, active == 0);
+				if(job == NULL)
+					break;
+
+				if(job->digest != VERIFY_DIGEST_MD5) {
+					verify_hash_job(worker, job);
+					verify_finish_job(worker, job);
+					continue;
+				}
+
+				if(job->data == NULL && reader_open(lane[i].reader, job->path) != 0) {
+					perror("file open");
+					job->failed = true;
+					verify_finish_job(worker, job);
+					continue;
+				}
+
+				lane[i].job = job;
+				md5_mb_start(&ctx, i);
+				if(job->data != NULL && job->data_size > 0)
+					md5_mb_feed(&ctx, i, job->data, job->data_size); // the whole file at once
+				active++;
+			}
+		}
+
+		if(active == 0)
+			break; // quit was requested and there is nothing left to do
+
+		// refill hungry lanes, finish lanes at the end of their file
+		for(size_t i = 0; i < lanes; i++) {
+			if(lane[i].job == NULL || !md5_mb_hungry(&ctx, i))
+				continue;
+
+			const unsigned char * data;
+			ssize_t size = (lane[i].job->data != NULL ? 0 : reader_read(lane[i].reader, &data));
+			if(size > 0) {
+				md5_mb_feed(&ctx, i, data, size);
+				continue;
+			}
+
+			if(size == -1) {
+				perror("file read");
+				lane[i].job->failed = true;
+			}
+			md5_mb_final(lane[i].job->checksum, &ctx, i);
+			reader_close(lane[i].reader);
+
+			verify_finish_job(worker, lane[i].job);
+			lane[i].job = NULL;
+			active--;
+		}
+
+		// a lane whose mapped file got truncated starts over, reading the file this time; the other lanes go on
+		const void * fault;
+		while((fault = reader_guard(verify_run_lanes, &ctx)) != NULL) {
+			size_t i = 0;
+			while(i < lanes && !(lane[i].job != NULL && reader_maps(lane[i].reader, fault)))
+				i++;
+			if(i == lanes) {
+				fprintf(stderr, "error: bus error at %p\n", fault);
+				abort();
+			}
+
+			md5_mb_cancel(&ctx, i);
+			md5_mb_start(&ctx, i);
+			if(reader_reopen_unmapped(lane[i].reader) != 0) {
+				perror("file read");
+				lane[i].job->failed = true; // finished empty, like a lane failing to read
+			}
+		}
+	}
+
+	for(size_t i = 0; i < lanes; i++)
+		reader_destroy(lane[i].reader);
+}
+
+
+static void * verify_worker(void * arg) {
+	verify_worker_t worker;
+	verify_worker_init(&worker, (verify_internal_t *)arg);
+	if(md5_mb_lanes() > 0)
+		verify_worker_multi_buffer(&worker);
+	else
+		verify_worker_scalar(&worker);
+	verify_worker_cleanup(&worker);
+	return NULL;
+}
+
+
+const char * verify_digest_to_string(verify_digest_t digest) {
+	switch(digest) {
+		default:                   return "";
+		case VERIFY_DIGEST_MD5:    return "md5";
+		case VERIFY_DIGEST_SHA256: return "sha256";
+	}
+}
+
+
+struct verify_t * verify_create(size_t jobs, verify_order_t order, bool cache_neutral, struct cache_t * cache) {
+	if(jobs == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		jobs = (cpus > 0 ? cpus : 1);
+	}
+
+	verify_internal_t * priv = (verify_internal_t *)malloc(sizeof(verify_internal_t));
+	if(priv == NULL)
+		return NULL;
+	pthread_mutex_init(&priv->mutex, NULL);
+	pthread_cond_init(&priv->job_available, NULL);
+	pthread_cond_init(&priv->job_done, NULL);
+	priv->quit            = false;
+	priv->cache           = cache;
+	priv->order           = order;
+	priv->cache_neutral   = cache_neutral;
+	priv->memo_count      = VERIFY_MEMO_SIZE;
+	priv->memo            = (verify_memo_t *)calloc(priv->memo_count, sizeof(verify_memo_t));
+	priv->memo_occupied   = 0;
+	priv->duplicates      = 0;
+	priv->jobs_allocated  = 1024;
+	priv->jobs            = (verify_job_t **)malloc(priv->jobs_allocated * sizeof(verify_job_t *));
+	priv->jobs_count      = 0;
+	priv->next_report     = 0;
+	priv->submitted       = 0;
+	priv->queue_allocated = 1024;
+	priv->queue           = (verify_job_t **)malloc(priv->queue_allocated * sizeof(verify_job_t *));
+	priv->queue_count     = 0;
+	priv->queue_ready     = 0;
+	priv->next_dispatch   = 0;
+	priv->threads         = (pthread_t *)malloc(jobs * sizeof(pthread_t));
+	priv->threads_count   = 0;
+	assert(priv->memo != NULL && priv->jobs != NULL && priv->queue != NULL && priv->threads != NULL);
+
+	for(size_t i = 0; i < jobs; i++) {
+		if(pthread_create(&priv->threads[i], NULL, verify_worker, priv) != 0) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+		priv->threads_count++;
+	}
+
+	return (struct verify_t *)priv;
+}
+
+
+void verify_destroy(struct verify_t * handle) {
+	verify_internal_t * priv = (verify_internal_t *)handle;
+
+	pthread_mutex_lock(&priv->mutex);
+	priv->quit = true;
+	pthread_cond_broadcast(&priv->job_available);
+	pthread_mutex_unlock(&priv->mutex);
+
+	for(size_t i = 0; i < priv->threads_count; i++)
+		pthread_join(priv->threads[i], NULL);
+
+	for(size_t i = priv->next_report; i < priv->jobs_count; i++) {
+		free(priv->jobs[i]->path);
+		free(priv->jobs[i]);
+	}
+
+	pthread_cond_destroy(&priv->job_done);
+	pthread_cond_destroy(&priv->job_available);
+	pthread_mutex_destroy(&priv->mutex);
+	free(priv->threads);
+	free(priv->queue);
+	free(priv->jobs);
+	free(priv->memo);
+	free(priv);
+}
+
+
+size_t verify_submit(struct verify_t * handle, const char * path, const cache_key_t * key, verify_digest_t digest, const unsigned char * expected) {
+	verify_internal_t * priv = (verify_internal_t *)handle;
+
+	verify_job_t * job = (verify_job_t *)malloc(sizeof(verify_job_t));
+	assert(job != NULL);
+	job->path      = strdup(path);
+	job->number    = priv->submitted++;
+	job->digest    = digest;
+	memcpy(job->expected, expected, verify_digest_size(digest));
+	job->data      = NULL;
+	job->data_size = 0;
+	job->position  = 0;
+	job->cacheable = (priv->cache != NULL && key != NULL);
+	job->duplicate = false;
+	job->failed    = false;
+	job->done      = false;
+
+	if(key != NULL) {
+		job->key        = *key;
+		job->key.digest = digest;
+	}
+	else {
+		memset(&job->key, 0, sizeof(job->key));
+		job->key.size = -1;
+	}
+
+	// hardlinks and paths owned by several packages are read once, all other jobs for the file copy the result
+	if(key != NULL && !verify_insert_memo(priv, &job->key)) {
+		job->cacheable = false;
+		job->duplicate = true;
+		job->done      = true;
+		priv->duplicates++;
+	}
+
+	// files that did not change since the last run don't have to be read again
+	if(job->cacheable) {
+		if(cache_lookup(priv->cache, &job->key, job->checksum, verify_digest_size(digest))) {
+			job->cacheable = false;
+			job->done      = true;
+		}
+	}
+
+	// a file changed again within the timestamp tick of its last change keeps its key, so like racy entries of
+	// git's index, a digest is only cached if that tick has passed before the file is read
+	if(job->cacheable) {
+		int64_t now = verify_get_file_time();
+		if(job->key.mtime >= now || job->key.ctime >= now)
+			job->cacheable = false;
+	}
+
+	pthread_mutex_lock(&priv->mutex);
+	if(priv->jobs_count == priv->jobs_allocated) {
+		priv->jobs_allocated *= 2;
+		priv->jobs = (verify_job_t **)realloc(priv->jobs, priv->jobs_allocated * sizeof(verify_job_t *));
+		assert(priv->jobs != NULL);
+	}
+	priv->jobs[priv->jobs_count++] = job;
+
+	if(!job->done) {
+		if(priv->queue_count == priv->queue_allocated) {
+			priv->queue_allocated *= 2;
+			priv->queue = (verify_job_t **)realloc(priv->queue, priv->queue_allocated * sizeof(verify_job_t *));
+			assert(priv->queue != NULL);
+		}
+		priv->queue[priv->queue_count++] = job;
+
+		// in any other order, jobs are held back until they are released
+		if(priv->order == VERIFY_ORDER_SUBMISSION) {
+			priv->queue_ready = priv->queue_count;
+			pthread_cond_signal(&priv->job_available);
+		}
+	}
+	size_t number = job->number;
+	pthread_mutex_unlock(&priv->mutex);
+
+	return number;
+}
+
+
+size_t verify_collect(struct verify_t * handle, bool wait, verify_fn_report fn, void * user_data) {
+	verify_internal_t * priv = (verify_internal_t *)handle;
+	size_t mismatches = 0;
+
+	if(wait)
+		verify_release_jobs(priv);
+
+	pthread_mutex_lock(&priv->mutex);
+	while(priv->next_report < priv->jobs_count) {
+		verify_job_t * job = priv->jobs[priv->next_report];
+		if(!job->done) {
+			if(!wait)
+				break;
+			pthread_cond_wait(&priv->job_done, &priv->mutex);
+			continue;
+		}
+		priv->jobs[priv->next_report++] = NULL;
+		pthread_mutex_unlock(&priv->mutex);
+
+		// the job hashing the file was submitted, and thus collected, before its duplicates
+		if(job->key.size >= 0) {
+			verify_memo_t * memo = verify_find_memo(priv, &job->key);
+			if(job->duplicate) {
+				memcpy(job->checksum, memo->checksum, sizeof(job->checksum));
+				job->failed = memo->failed;
+			}
+			else {
+				memcpy(memo->checksum, job->checksum, sizeof(job->checksum));
+				memo->failed = job->failed;
+			}
+		}
+
+		if(!job->failed) {
+			size_t size = verify_digest_size(job->digest);
+			if(job->cacheable)
+				cache_store(priv->cache, &job->key, job->checksum, size);
+
+			// hex encoded only to be reported
+			if(memcmp(job->expected, job->checksum, size) != 0) {
+				char expected[65],
+				     actual[65];
+				hex_encode(job->expected, size, expected);
+				hex_encode(job->checksum, size, actual);
+				fn(job->path, job->digest, expected, actual, job->number, user_data);
+				mismatches++;
+			}
+		}
+		free(job->path);
+		free(job);
+
+		pthread_mutex_lock(&priv->mutex);
+	}
+	pthread_mutex_unlock(&priv->mutex);
+
+	return mismatches;
+}
+
+
+void verify_release(struct verify_t * handle) {
+	verify_release_jobs((verify_internal_t *)handle);
+}
+
+
+size_t verify_get_pending(const struct verify_t * handle) {
+	verify_internal_t * priv = (verify_internal_t *)handle;
+
+	pthread_mutex_lock(&priv->mutex);
+	size_t pending = priv->jobs_count - priv->next_report;
+	pthread_mutex_unlock(&priv->mutex);
+	return pending;
+}
+
+
+void verify_reset(struct verify_t * handle) {
+	verify_internal_t * priv = (verify_internal_t *)handle;
+
+	pthread_mutex_lock(&priv->mutex);
+	assert(priv->next_report == priv->jobs_count && priv->next_dispatch == priv->queue_count);
+	priv->jobs_count    = 0;
+	priv->next_report   = 0;
+	priv->queue_count   = 0;
+	priv->queue_ready   = 0;
+	priv->next_dispatch = 0;
+	pthread_mutex_unlock(&priv->mutex);
+
+	// the memo of a full run has a slot for every file, which isn't kept around afterwards
+	free(priv->memo);
+	priv->memo_count    = VERIFY_MEMO_SIZE;
+	priv->memo          = (verify_memo_t *)calloc(priv->memo_count, sizeof(verify_memo_t));
+	priv->memo_occupied = 0;
+	assert(priv->memo != NULL);
+}
+
+
+size_t verify_get_duplicates(const struct verify_t * handle) {
+	const verify_internal_t * priv = (const verify_internal_t *)handle;
+	return priv->duplicates;
+}
@@ -0,0 +1,114 @@
+#ifndef INCLUDE_VERIFY_H
+#define INCLUDE_VERIFY_H
+
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "cache.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * Opaque handle of the content verification engine. It owns a pool of worker threads that hash
+ * submitted files concurrently, while results are handed back in submission order.
+ */
+struct verify_t;
+
+/**
+ * Supported content digests.
+ */
+typedef enum {
+	VERIFY_DIGEST_MD5,
+	VERIFY_DIGEST_SHA256
+} verify_digest_t;
+
+/**
+ * Order in which submitted files are hashed. Results are reported in submission order regardless.
+ */
+typedef enum {
+	VERIFY_ORDER_SUBMISSION, // right away, as they are submitted
+	VERIFY_ORDER_INODE,      // by device and inode number, once verify_release is called or verify_collect waits
+	VERIFY_ORDER_EXTENT      // by device and physical position of the first extent (FIEMAP), likewise
+} verify_order_t;
+
+/**
+ * Returns the name of a digest as used in reports, e.g. "md5".
+ */
+const char * verify_digest_to_string(verify_digest_t digest);
+
+/**
+ * Callback function type for reporting a content mismatch.
+ *
+ * path     = path of the file as passed to verify_submit
+ * digest   = digest as passed to verify_submit
+ * expected = expected digest as passed to verify_submit, hex encoded
+ * actual   = digest of the file contents, hex encoded
+ * job      = number of the job as returned by verify_submit
+ */
+typedef void (*verify_fn_report)(const char * path, verify_digest_t digest, const char * expected, const char * actual, size_t job, void * user_data);
+
+/**
+ * Creates a verification engine with the given number of worker threads, or one per cpu if jobs is 0.
+ * Files are hashed in the given order; any order but VERIFY_ORDER_SUBMISSION defers all hashing until
+ * verify_release, or verify_collect with wait set, is called, which keeps rotational disks from seeking back and forth.
+ * If cache_neutral is true, files are read without evicting the working set of other processes from the page cache
+ * (see reader_create); small files are not batched via io_uring then.
+ * If cache is not NULL, checksums are looked up in and stored to it; it has to outlive the engine.
+ * Returns NULL on failure.
+ */
+struct verify_t * verify_create(size_t jobs, verify_order_t order, bool cache_neutral, struct cache_t * cache);
+
+/**
+ * Waits for all pending jobs, stops the worker threads and releases the handle.
+ * Results that have not been collected are discarded.
+ */
+void verify_destroy(struct verify_t * handle);
+
+/**
+ * Queues the file at path to be compared against the expected digest (16 bytes for md5, 32 for sha256).
+ * key identifies the file in the cache (its digest field is filled in here), or is NULL to bypass the cache.
+ * All arguments are copied. Returns the number of the job, which is never reused by the handle.
+ */
+size_t verify_submit(struct verify_t * handle, const char * path, const cache_key_t * key, verify_digest_t digest, const unsigned char * expected);
+
+/**
+ * Reports all finished jobs in submission order via fn, stopping at the first unfinished job.
+ * If wait is true, releases deferred jobs to the workers and blocks until every submitted job has been reported.
+ * Returns the number of mismatches reported.
+ */
+size_t verify_collect(struct verify_t * handle, bool wait, verify_fn_report fn, void * user_data);
+
+/**
+ * Releases deferred jobs to the workers without waiting for them, for callers that collect as results come in.
+ */
+void verify_release(struct verify_t * handle);
+
+/**
+ * Returns the number of submitted jobs that have not been reported yet.
+ */
+size_t verify_get_pending(const struct verify_t * handle);
+
+/**
+ * Forgets the files hashed so far and releases the memory held for them, so a long running process doesn't keep
+ * every file it ever hashed. Every submitted job has to be collected before.
+ */
+void verify_reset(struct verify_t * handle);
+
+/**
+ * Returns the number of submitted files that were not read because an earlier job hashes the same inode
+ * (hardlinks, or paths listed by several packages).
+ */
+size_t verify_get_duplicates(const struct verify_t * handle);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
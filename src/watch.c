@@ -0,0 +1,235 @@
+#define _GNU_SOURCE
+#include "watch.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/fanotify.h>
+#include <sys/statfs.h>
+#include <unistd.h>
+
+
+/**
+ * Everything that changes what a diff reports: contents, metadata and directory entries, of files and directories.
+ */
+#define WATCH_MASK        (FAN_MODIFY | FAN_ATTRIB | FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO | FAN_ONDIR)
+#define WATCH_MASK_MOVED  (FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO)
+
+#define WATCH_BUFFER_SIZE (64 * 1024)
+
+
+/**
+ * A watched file system: file handles are only meaningful together with a descriptor on the same file system.
+ */
+typedef struct {
+	int fsid[2];
+	int mount_fd;
+} watch_filesystem_t;
+
+
+typedef struct {
+	int                  fd;
+	watch_filesystem_t * filesystems;
+	size_t               filesystems_count;
+	char *               buffer;
+} watch_internal_t;
+
+
+struct watch_t * watch_create() {
+	watch_internal_t * priv = (watch_internal_t *)malloc(sizeof(watch_internal_t));
+	if(priv == NULL)
+		return NULL;
+	priv->filesystems       = NULL;
+	priv->filesystems_count = 0;
+	priv->buffer            = (char *)malloc(WATCH_BUFFER_SIZE);
+	if(priv->buffer == NULL) {
+		free(priv);
+		return NULL;
+	}
+
+	// the queue is bounded, so kernel memory is as well while the reader is busy: an overflow is reported, and
+	// everything is compared again then
+	priv->fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK | FAN_REPORT_FID | FAN_REPORT_DFID_NAME, O_RDONLY | O_LARGEFILE);
+	if(priv->fd == -1) {
+		int error = errno;
+		free(priv->buffer);
+		free(priv);
+		errno = error;
+		return NULL;
+	}
+	return (struct watch_t *)priv;
+}
+
+
+void watch_destroy(struct watch_t * handle) {
+	watch_internal_t * priv = (watch_internal_t *)handle;
+	for(size_t i = 0; i < priv->filesystems_count; i++)
+		close(priv->filesystems[i].mount_fd);
+	free(priv->filesystems);
+	free(priv->buffer);
+	close(priv->fd);
+	free(priv);
+}
+
+
+int watch_add(struct watch_t * handle, const char * path) {
+	watch_internal_t * priv = (watch_internal_t *)handle;
+
+	int           mount_fd = open(path, O_RDONLY | O_CLOEXEC);
+	struct statfs info;
+	if(mount_fd == -1)
+		return -1;
+	if(fstatfs(mount_fd, &info) != 0) {
+		int error = errno;
+		close(mount_fd);
+		errno = error;
+		return -1;
+	}
+
+	// a file system mounted several times is marked once
+	for(size_t i = 0; i < priv->filesystems_count; i++) {
+		if(memcmp(priv->filesystems[i].fsid, &info.f_fsid, sizeof(priv->filesystems[i].fsid)) == 0) {
+			close(mount_fd);
+			return 0;
+		}
+	}
+
+	if(fanotify_mark(priv->fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, WATCH_MASK, AT_FDCWD, path) != 0) {
+		int error = errno;
+		close(mount_fd);
+		errno = error;
+		return -1;
+	}
+
+	watch_filesystem_t * filesystems = (watch_filesystem_t *)realloc(priv->filesystems, (priv->filesystems_count + 1) * sizeof(watch_filesystem_t));
+	if(filesystems == NULL) {
+		close(mount_fd);
+		errno = ENOMEM;
+		return -1;
+	}
+	priv->filesystems = filesystems;
+	memcpy(priv->filesystems[priv->filesystems_count].fsid, &info.f_fsid, sizeof(priv->filesystems[0].fsid));
+	priv->filesystems[priv->filesystems_count].mount_fd = mount_fd;
+	priv->filesystems_count++;
+	return 0;
+}
+
+
+int watch_get_fd(const struct watch_t * handle) {
+	const watch_internal_t * priv = (const watch_internal_t *)handle;
+	return priv->fd;
+}
+
+
+/**
+ * Returns the current path of the entry a file handle refers to, or NULL if it is gone.
+ */
+static char * watch_resolve_handle(const watch_internal_t * priv, const __kernel_fsid_t * fsid, struct file_handle * file_handle) {
+	int mount_fd = -1;
+	for(size_t i = 0; i < priv->filesystems_count && mount_fd == -1; i++) {
+		if(memcmp(priv->filesystems[i].fsid, fsid, sizeof(priv->filesystems[i].fsid)) == 0)
+			mount_fd = priv->filesystems[i].mount_fd;
+	}
+	if(mount_fd == -1)
+		return NULL;
+
+	int fd = open_by_handle_at(mount_fd, file_handle, O_PATH | O_CLOEXEC);
+	if(fd == -1)
+		return NULL; // ESTALE once removed
+
+	char link[64];
+	char path[PATH_MAX];
+	snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+	ssize_t length = readlink(link, path, sizeof(path) - 1);
+	close(fd);
+	if(length <= 0 || path[0] != '/')
+		return NULL;
+	path[length] = '\0';
+
+	// removed after it was opened
+	static const char deleted[] = " (deleted)";
+	if((size_t)length >= sizeof(deleted) - 1 && strcmp(path + length - (sizeof(deleted) - 1), deleted) == 0)
+		return NULL;
+
+	return strdup(path);
+}
+
+
+/**
+ * Returns the path of the entry an event is about, from the directory and name record if there is one (the name
+ * of an event on a directory itself is "."), from the record of the entry itself otherwise.
+ */
+static char * watch_resolve_event(const watch_internal_t * priv, const struct fanotify_event_metadata * event) {
+	const struct fanotify_event_info_fid * object = NULL;
+	const char *                           info   = (const char *)event + event->metadata_len;
+	const char *                           end    = (const char *)event + event->event_len;
+	while(info + sizeof(struct fanotify_event_info_header) <= end) {
+		const struct fanotify_event_info_header * header = (const struct fanotify_event_info_header *)info;
+		if(header->len == 0 || info + header->len > end)
+			break;
+
+		const struct fanotify_event_info_fid * fid = (const struct fanotify_event_info_fid *)info;
+		if(header->info_type == FAN_EVENT_INFO_TYPE_DFID_NAME) {
+			struct file_handle * file_handle = (struct file_handle *)fid->handle;
+			const char *         name        = (const char *)file_handle->f_handle + file_handle->handle_bytes;
+			char *               directory   = watch_resolve_handle(priv, &fid->fsid, file_handle);
+			if(directory == NULL || strcmp(name, ".") == 0 || name[0] == '\0')
+				return directory;
+
+			char * path;
+			size_t length = strlen(directory);
+			if(asprintf(&path, "%s%s%s", directory, (length > 0 && directory[length - 1] == '/') ? "" : "/", name) == -1)
+				path = NULL;
+			free(directory);
+			return path;
+		}
+		else if(header->info_type == FAN_EVENT_INFO_TYPE_FID || header->info_type == FAN_EVENT_INFO_TYPE_DFID)
+			object = fid;
+
+		info += header->len;
+	}
+
+	if(object == NULL)
+		return NULL;
+	return watch_resolve_handle(priv, &object->fsid, (struct file_handle *)object->handle);
+}
+
+
+ssize_t watch_read(struct watch_t * handle, watch_fn_event fn, void * user_data) {
+	watch_internal_t * priv  = (watch_internal_t *)handle;
+	ssize_t            count = 0,
+	                   length;
+
+	// one buffer at a time: reading until the queue is empty never ends on a busy system
+	do {
+		length = read(priv->fd, priv->buffer, WATCH_BUFFER_SIZE);
+	} while(length == -1 && errno == EINTR);
+	if(length == -1)
+		return (errno == EAGAIN ? 0 : -1);
+
+	struct fanotify_event_metadata * event = (struct fanotify_event_metadata *)priv->buffer;
+	for(; FAN_EVENT_OK(event, length); event = FAN_EVENT_NEXT(event, length)) {
+		if(event->vers != FANOTIFY_METADATA_VERSION) {
+			errno = EPROTO;
+			return -1;
+		}
+
+		if(event->mask & FAN_Q_OVERFLOW) {
+			fn(WATCH_EVENT_OVERFLOW, NULL, user_data);
+			count++;
+			continue;
+		}
+
+		char * path = watch_resolve_event(priv, event);
+		if(path == NULL)
+			continue;
+		fn((event->mask & WATCH_MASK_MOVED) ? WATCH_EVENT_MOVED : WATCH_EVENT_MODIFIED, path, user_data);
+		free(path);
+		count++;
+	}
+
+	return count;
+}
@@ -0,0 +1,68 @@
+#ifndef INCLUDE_WATCH_H
+#define INCLUDE_WATCH_H
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * Opaque handle of a fanotify based change watch over whole file systems. Events carry file handles instead of
+ * file descriptors (FAN_REPORT_FID, FAN_REPORT_DFID_NAME), which are resolved to paths as they are read, so
+ * nothing is kept open per watched entry. Needs CAP_SYS_ADMIN and Linux 5.9. A handle is not thread-safe.
+ */
+struct watch_t;
+
+typedef enum {
+	WATCH_EVENT_MODIFIED, // the contents or metadata of the entry at path changed
+	WATCH_EVENT_MOVED,    // an entry at path was created, removed or renamed from or to there
+	WATCH_EVENT_OVERFLOW  // events were lost, anything may have changed; path is NULL
+} watch_event_t;
+
+/**
+ * Callback function type for reporting an event; path is absolute.
+ */
+typedef void (*watch_fn_event)(watch_event_t event, const char * path, void * user_data);
+
+/**
+ * Creates a watch without any file systems. Returns NULL on failure (with errno set).
+ */
+struct watch_t * watch_create();
+
+/**
+ * Releases the handle.
+ */
+void watch_destroy(struct watch_t * handle);
+
+/**
+ * Watches the whole file system the entry at path is on, including parts of it mounted elsewhere.
+ * Returns -1 on failure (with errno set; ENODEV, EXDEV or EOPNOTSUPP for file systems fanotify can't identify
+ * entries on, like most pseudo file systems), 0 otherwise.
+ */
+int watch_add(struct watch_t * handle, const char * path);
+
+/**
+ * Returns the descriptor to poll for readability before calling watch_read.
+ */
+int watch_get_fd(const struct watch_t * handle);
+
+/**
+ * Reads pending events, as many as fit into one buffer, without blocking and reports them via fn. Events on entries that are gone by the time
+ * they are read can't be resolved and are dropped, the removal of the entry is reported on its directory anyway.
+ * Returns the number of events reported, or -1 on failure (with errno set).
+ */
+ssize_t watch_read(struct watch_t * handle, watch_fn_event fn, void * user_data);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif